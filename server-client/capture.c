@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#ifdef __linux__
+#include <linux/videodev2.h>
+#endif
+
+#include "capture.h"
+#include "udp_batch.h"
+
+#define RAW_PREFIX "raw:"
+
+// True for the paths handled here rather than by the demuxer
+bool capture_is_live(const char *path) {
+    return strncmp(path, "/dev/video", 10) == 0 || strncmp(path, RAW_PREFIX, strlen(RAW_PREFIX)) == 0;
+}
+
+// Raw file frames point into a mapping that lives until capture_close()
+static void keep_mapping(void *opaque, uint8_t *data) {
+}
+
+#ifdef __linux__
+static int xioctl(int fd, unsigned long request, void *arg) {
+    int ret;
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+// The last reference to a frame is gone: give its buffer back to the driver
+static void release_v4l2_buffer(void *opaque, uint8_t *data) {
+    CaptureBuffer *buffer = (CaptureBuffer *)opaque;
+    if (!buffer->owner->streaming) {
+        return;
+    }
+
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = buffer->index;
+    if (xioctl(buffer->owner->fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("Failed to requeue capture buffer");
+    }
+}
+
+// Ask for one pixel format; true if the driver took it
+static bool set_v4l2_format(Capture *cap, uint32_t fourcc, int width, int height) {
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.pixelformat = fourcc;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(cap->fd, VIDIOC_S_FMT, &fmt) < 0 || fmt.fmt.pix.pixelformat != fourcc) {
+        return false;
+    }
+
+    cap->fourcc = fourcc;
+    cap->width = fmt.fmt.pix.width;
+    cap->height = fmt.fmt.pix.height;
+    cap->bytes_per_line = fmt.fmt.pix.bytesperline;
+    cap->frame_size = fmt.fmt.pix.sizeimage;
+    cap->mjpeg = fourcc == V4L2_PIX_FMT_MJPEG;
+    cap->pix_fmt = fourcc == V4L2_PIX_FMT_NV12 ? AV_PIX_FMT_NV12
+                 : fourcc == V4L2_PIX_FMT_YUYV ? AV_PIX_FMT_YUYV422
+                 : AV_PIX_FMT_NONE;
+    return true;
+}
+
+// Request a frame rate; returns what the driver granted (0 = unknown)
+static int set_v4l2_fps(Capture *cap, int fps) {
+    struct v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe.numerator = 1;
+    parm.parm.capture.timeperframe.denominator = fps;
+    if (xioctl(cap->fd, VIDIOC_S_PARM, &parm) < 0 || parm.parm.capture.timeperframe.numerator == 0) {
+        return 0;
+    }
+    return parm.parm.capture.timeperframe.denominator / parm.parm.capture.timeperframe.numerator;
+}
+
+// Negotiate a native format and start streaming into mmap'ed buffers
+static bool open_v4l2(Capture *cap, const char *path, int width, int height, int fps) {
+    cap->fd = open(path, O_RDWR | O_NONBLOCK);
+    if (cap->fd < 0) {
+        perror("Could not open camera");
+        return false;
+    }
+    cap->v4l2 = true;
+
+    struct v4l2_capability caps;
+    memset(&caps, 0, sizeof(caps));
+    if (xioctl(cap->fd, VIDIOC_QUERYCAP, &caps) < 0) {
+        perror("Not a V4L2 device");
+        return false;
+    }
+    uint32_t device_caps = (caps.capabilities & V4L2_CAP_DEVICE_CAPS) ? caps.device_caps : caps.capabilities;
+    if (!(device_caps & V4L2_CAP_VIDEO_CAPTURE) || !(device_caps & V4L2_CAP_STREAMING)) {
+        fprintf(stderr, "%s cannot stream video capture\n", path);
+        return false;
+    }
+
+    // Formats the pipeline takes without a decoder come first; MJPEG is the
+    // fallback, and also wins when USB bandwidth caps raw formats below fps
+    bool has_nv12 = false, has_yuyv = false, has_mjpeg = false;
+    struct v4l2_fmtdesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    while (xioctl(cap->fd, VIDIOC_ENUM_FMT, &desc) == 0) {
+        has_nv12 |= desc.pixelformat == V4L2_PIX_FMT_NV12;
+        has_yuyv |= desc.pixelformat == V4L2_PIX_FMT_YUYV;
+        has_mjpeg |= desc.pixelformat == V4L2_PIX_FMT_MJPEG;
+        desc.index++;
+    }
+
+    bool ok = (has_nv12 && set_v4l2_format(cap, V4L2_PIX_FMT_NV12, width, height)) ||
+              (has_yuyv && set_v4l2_format(cap, V4L2_PIX_FMT_YUYV, width, height)) ||
+              (has_mjpeg && set_v4l2_format(cap, V4L2_PIX_FMT_MJPEG, width, height));
+    if (!ok) {
+        fprintf(stderr, "%s offers none of NV12, YUYV or MJPEG\n", path);
+        return false;
+    }
+
+    cap->fps = set_v4l2_fps(cap, fps);
+    if (!cap->mjpeg && has_mjpeg && cap->fps > 0 && cap->fps < fps &&
+        set_v4l2_format(cap, V4L2_PIX_FMT_MJPEG, width, height)) {
+        cap->fps = set_v4l2_fps(cap, fps);
+    }
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = CAPTURE_BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(cap->fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+        perror("Could not get capture buffers");
+        return false;
+    }
+
+    for (unsigned int i = 0; i < req.count && i < CAPTURE_BUFFERS; i++) {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(cap->fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            perror("Could not query capture buffer");
+            return false;
+        }
+
+        void *start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, buf.m.offset);
+        if (start == MAP_FAILED) {
+            perror("Could not map capture buffer");
+            return false;
+        }
+
+        CaptureBuffer *buffer = &cap->buffers[cap->num_buffers++];
+        buffer->owner = cap;
+        buffer->index = i;
+        buffer->start = (uint8_t *)start;
+        buffer->length = buf.length;
+
+        if (xioctl(cap->fd, VIDIOC_QBUF, &buf) < 0) {
+            perror("Could not queue capture buffer");
+            return false;
+        }
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(cap->fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("Could not start capture");
+        return false;
+    }
+    cap->streaming = true;
+
+    char fourcc[5] = {
+        cap->fourcc & 0xff, (cap->fourcc >> 8) & 0xff, (cap->fourcc >> 16) & 0xff, (cap->fourcc >> 24) & 0xff, 0
+    };
+    printf("Camera %s (%s): %dx%d %s at %d fps, %d mmap buffers\n",
+           path, (const char *)caps.card, cap->width, cap->height, fourcc, cap->fps, cap->num_buffers);
+    return true;
+}
+
+// Dequeue the next filled buffer and wrap it without copying
+static CaptureResult read_v4l2(Capture *cap, AVFrame *frame, AVPacket *packet, uint64_t *capture_ns) {
+    struct pollfd pfd = { .fd = cap->fd, .events = POLLIN };
+    int ready = poll(&pfd, 1, CAPTURE_TIMEOUT_MS);
+    if (ready <= 0) {
+        return (ready == 0 || errno == EINTR) ? CAPTURE_AGAIN : CAPTURE_ERROR;
+    }
+
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(cap->fd, VIDIOC_DQBUF, &buf) < 0) {
+        if (errno == EAGAIN) {
+            return CAPTURE_AGAIN;
+        }
+        perror("Capture failed");
+        return errno == ENODEV ? CAPTURE_END : CAPTURE_ERROR;
+    }
+
+    CaptureBuffer *buffer = &cap->buffers[buf.index];
+    if (buf.flags & V4L2_BUF_FLAG_ERROR) {
+        release_v4l2_buffer(buffer, NULL);
+        return CAPTURE_AGAIN;
+    }
+
+    // Drivers stamp the end of exposure or readout on the monotonic clock
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        *capture_ns = (uint64_t)buf.timestamp.tv_sec * 1000000000ull + (uint64_t)buf.timestamp.tv_usec * 1000ull;
+    } else {
+        *capture_ns = monotonic_ns();
+    }
+
+    if (cap->frames > 0 && buf.sequence > cap->last_sequence + 1) {
+        cap->dropped += buf.sequence - cap->last_sequence - 1;
+    }
+    cap->last_sequence = buf.sequence;
+    cap->frames++;
+
+    AVBufferRef *ref = av_buffer_create(buffer->start, buf.bytesused, release_v4l2_buffer, buffer, 0);
+    if (!ref) {
+        release_v4l2_buffer(buffer, NULL);
+        return CAPTURE_ERROR;
+    }
+
+    if (cap->mjpeg) {
+        packet->buf = ref;
+        packet->data = buffer->start;
+        packet->size = (int)buf.bytesused;
+        packet->flags = AV_PKT_FLAG_KEY;
+        return CAPTURE_PACKET;
+    }
+
+    frame->buf[0] = ref;
+    frame->format = cap->pix_fmt;
+    frame->width = cap->width;
+    frame->height = cap->height;
+    frame->data[0] = buffer->start;
+    frame->linesize[0] = cap->bytes_per_line;
+    if (cap->pix_fmt == AV_PIX_FMT_NV12) {
+        frame->data[1] = buffer->start + (size_t)cap->bytes_per_line * cap->height;
+        frame->linesize[1] = cap->bytes_per_line;
+    }
+    return CAPTURE_FRAME;
+}
+#endif
+
+// Map a raw file, or wait for a writer on a FIFO
+static bool open_raw(Capture *cap, const char *path, int width, int height, int fps, const char *raw_format) {
+    cap->pix_fmt = av_get_pix_fmt(raw_format);
+    if (cap->pix_fmt == AV_PIX_FMT_NONE) {
+        fprintf(stderr, "Unknown raw pixel format: %s\n", raw_format);
+        return false;
+    }
+    cap->width = width;
+    cap->height = height;
+    cap->fps = fps;
+    cap->frame_size = (size_t)av_image_get_buffer_size(cap->pix_fmt, width, height, 1);
+
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        perror("Could not open raw video source");
+        return false;
+    }
+    cap->fifo = S_ISFIFO(st.st_mode);
+    if (cap->fifo) {
+        printf("Waiting for a writer on %s...\n", path);
+    }
+
+    cap->fd = open(path, O_RDONLY);
+    if (cap->fd < 0) {
+        perror("Could not open raw video source");
+        return false;
+    }
+
+    if (cap->fifo) {
+        cap->fifo_pool = av_buffer_pool_init(cap->frame_size, av_buffer_alloc);
+        if (!cap->fifo_pool) {
+            fprintf(stderr, "Could not allocate raw frame pool\n");
+            return false;
+        }
+    } else {
+        cap->num_frames = (size_t)st.st_size / cap->frame_size;
+        if (cap->num_frames == 0) {
+            fprintf(stderr, "%s is smaller than one %dx%d %s frame\n", path, width, height, raw_format);
+            return false;
+        }
+
+        void *start = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, cap->fd, 0);
+        if (start == MAP_FAILED) {
+            perror("Could not map raw video source");
+            return false;
+        }
+        cap->buffers[0].owner = cap;
+        cap->buffers[0].start = (uint8_t *)start;
+        cap->buffers[0].length = (size_t)st.st_size;
+        cap->num_buffers = 1;
+        cap->next_frame_ns = monotonic_ns();
+    }
+
+    printf("Raw video source %s: %dx%d %s, %s\n", path, width, height, raw_format,
+           cap->fifo ? "FIFO" : "looped file");
+    return true;
+}
+
+// Next raw frame: a slice of the mapping on schedule, or a copy from the FIFO
+static CaptureResult read_raw(Capture *cap, AVFrame *frame, uint64_t *capture_ns) {
+    AVBufferRef *ref;
+
+    if (cap->fifo) {
+        struct pollfd pfd = { .fd = cap->fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, CAPTURE_TIMEOUT_MS);
+        if (ready <= 0) {
+            return (ready == 0 || errno == EINTR) ? CAPTURE_AGAIN : CAPTURE_ERROR;
+        }
+        *capture_ns = monotonic_ns();
+
+        ref = av_buffer_pool_get(cap->fifo_pool);
+        if (!ref) {
+            return CAPTURE_ERROR;
+        }
+
+        // The writer may split a frame across writes; pipes never split a byte stream
+        size_t filled = 0;
+        while (filled < cap->frame_size) {
+            ssize_t len = read(cap->fd, ref->data + filled, cap->frame_size - filled);
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len <= 0) {
+                av_buffer_unref(&ref);
+                if (len == 0) {
+                    printf("Raw video source closed by its writer\n");
+                    return CAPTURE_END;
+                }
+                perror("Raw video read failed");
+                return CAPTURE_ERROR;
+            }
+            filled += (size_t)len;
+        }
+    } else {
+        // Release frames at the camera's pace, stamped with their due time
+        uint64_t now = monotonic_ns();
+        if (now < cap->next_frame_ns) {
+            uint64_t wait_ns = cap->next_frame_ns - now;
+            struct timespec ts = { .tv_sec = wait_ns / 1000000000ull, .tv_nsec = wait_ns % 1000000000ull };
+            nanosleep(&ts, NULL);
+        }
+        *capture_ns = cap->next_frame_ns;
+        cap->next_frame_ns += 1000000000ull / cap->fps;
+        if (cap->next_frame_ns < now) {
+            cap->next_frame_ns = now;
+        }
+
+        uint8_t *start = cap->buffers[0].start + cap->next_frame * cap->frame_size;
+        cap->next_frame = (cap->next_frame + 1) % cap->num_frames;
+        ref = av_buffer_create(start, cap->frame_size, keep_mapping, NULL, AV_BUFFER_FLAG_READONLY);
+        if (!ref) {
+            return CAPTURE_ERROR;
+        }
+    }
+
+    frame->buf[0] = ref;
+    frame->format = cap->pix_fmt;
+    frame->width = cap->width;
+    frame->height = cap->height;
+    av_image_fill_arrays(frame->data, frame->linesize, ref->data, cap->pix_fmt, cap->width, cap->height, 1);
+    cap->frames++;
+    return CAPTURE_FRAME;
+}
+
+// Open a camera or a raw stand-in
+bool capture_open(Capture *cap, const char *path, int width, int height, int fps,
+                  const char *raw_format) {
+    memset(cap, 0, sizeof(*cap));
+    cap->fd = -1;
+    cap->pix_fmt = AV_PIX_FMT_NONE;
+
+    bool ok;
+    if (strncmp(path, RAW_PREFIX, strlen(RAW_PREFIX)) == 0) {
+        ok = open_raw(cap, path + strlen(RAW_PREFIX), width, height, fps, raw_format);
+    } else {
+#ifdef __linux__
+        ok = open_v4l2(cap, path, width, height, fps);
+#else
+        fprintf(stderr, "V4L2 capture needs Linux; use a raw: source here\n");
+        ok = false;
+#endif
+    }
+
+    if (!ok) {
+        capture_close(cap);
+    }
+    return ok;
+}
+
+// Wait for the next frame
+CaptureResult capture_read(Capture *cap, AVFrame *frame, AVPacket *packet, uint64_t *capture_ns) {
+#ifdef __linux__
+    if (cap->v4l2) {
+        return read_v4l2(cap, frame, packet, capture_ns);
+    }
+#endif
+    return read_raw(cap, frame, capture_ns);
+}
+
+// Stop streaming and unmap
+void capture_close(Capture *cap) {
+#ifdef __linux__
+    if (cap->streaming) {
+        cap->streaming = false;
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(cap->fd, VIDIOC_STREAMOFF, &type);
+    }
+#endif
+
+    for (int i = 0; i < cap->num_buffers; i++) {
+        munmap(cap->buffers[i].start, cap->buffers[i].length);
+    }
+    cap->num_buffers = 0;
+
+    if (cap->fifo_pool) av_buffer_pool_uninit(&cap->fifo_pool);
+    if (cap->fd >= 0) close(cap->fd);
+    cap->fd = -1;
+}
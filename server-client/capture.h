@@ -0,0 +1,91 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/buffer.h>
+
+// Live video sources that bypass the demuxer:
+//   /dev/videoN  V4L2 camera, streaming I/O into mmap'ed driver buffers.
+//                Raw frames are handed on as AVFrames that point straight
+//                into the buffer, which goes back to the driver when the
+//                last reference is dropped. MJPEG comes out as a packet.
+//   raw:PATH     Headerless frames of a fixed size and pixel format from
+//                a file (mmap'ed, looped, released at the frame rate like
+//                a camera) or a FIFO (read as fast as the writer fills it),
+//                to test the live path without a camera or v4l2loopback.
+// Every frame carries its capture time on the monotonic clock.
+
+#define CAPTURE_BUFFERS 8             // Driver buffers; more than the pipeline can hold at once
+#define CAPTURE_TIMEOUT_MS 100        // Longest wait for a frame before giving the caller a turn
+
+// Result of capture_read()
+typedef enum {
+    CAPTURE_FRAME,                    // `frame` references a raw frame
+    CAPTURE_PACKET,                   // `packet` references an MJPEG frame to decode
+    CAPTURE_AGAIN,                    // Nothing yet; call again
+    CAPTURE_END,                      // The source is gone (FIFO writer closed, camera unplugged)
+    CAPTURE_ERROR
+} CaptureResult;
+
+typedef struct Capture Capture;
+
+// One mmap'ed driver buffer (or a raw file's mapping)
+typedef struct {
+    Capture *owner;
+    int index;
+    uint8_t *start;
+    size_t length;
+} CaptureBuffer;
+
+struct Capture {
+    int fd;
+    bool v4l2;
+    bool fifo;                        // raw: source is a pipe, read() into pooled copies
+    bool streaming;                   // Buffers may be queued back to the driver
+
+    // Negotiated format
+    int width;
+    int height;
+    enum AVPixelFormat pix_fmt;       // AV_PIX_FMT_NONE when mjpeg
+    bool mjpeg;
+    uint32_t fourcc;                  // V4L2 pixel format
+    int bytes_per_line;
+    size_t frame_size;
+    int fps;
+
+    // V4L2 buffers, or the whole raw file as buffer 0
+    CaptureBuffer buffers[CAPTURE_BUFFERS];
+    int num_buffers;
+
+    // raw: file position and pacing, or the FIFO's frame copies
+    AVBufferPool *fifo_pool;
+    size_t num_frames;
+    size_t next_frame;
+    uint64_t next_frame_ns;
+
+    // Statistics
+    uint64_t frames;
+    uint64_t dropped;                 // Sequence gaps reported by the driver
+    uint32_t last_sequence;
+};
+
+// True for the paths handled here rather than by the demuxer
+bool capture_is_live(const char *path);
+
+// Open a camera at about `width` x `height` and `fps`, or a raw stand-in
+// of exactly that size in `raw_format` (an FFmpeg pixel format name)
+bool capture_open(Capture *cap, const char *path, int width, int height, int fps,
+                  const char *raw_format);
+
+// Wait up to CAPTURE_TIMEOUT_MS for the next frame. The frame or packet
+// references the capture buffer; unref it to give the buffer back.
+CaptureResult capture_read(Capture *cap, AVFrame *frame, AVPacket *packet, uint64_t *capture_ns);
+
+// Stop streaming and unmap. Frames still referencing buffers must be gone.
+void capture_close(Capture *cap);
+
+#endif /* CAPTURE_H */
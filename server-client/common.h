@@ -3,41 +3,154 @@
 
 #include <stdint.h>
 
-// Common configuration
+// Common configuration. Settings marked * are defaults that config.h lets a
+// file or the command line override at runtime.
 // #define SERVER_IP "192.168.1.246"         // Change to your server's IP address
-#define SERVER_IP "127.0.0.1"         // Change to your server's IP address
-#define VIDEO_PORT 5555               // Port for video streaming
-#define CONTROL_PORT 5556             // Port for control messages
+#define SERVER_IP "127.0.0.1"         // * Change to your server's IP address
+#define VIDEO_PORT 5555               // * Port for video streaming
+#define CONTROL_PORT 5556             // * Port for control messages
+#define CONTROL_DSCP 46               // DSCP of control port traffic (46 = Expedited Forwarding, 0 = unmarked)
 
-#define FRAME_WIDTH 640               // Frame width
-#define FRAME_HEIGHT 480              // Frame height
-#define MAX_PACKET_SIZE 1400          // Maximum UDP packet size (to avoid fragmentation)
-#define MAX_FRAME_SIZE (FRAME_WIDTH * FRAME_HEIGHT * 3) // RGB frame size
+// Multicast distribution: the server publishes every frame once to the
+// group and clients join it; NACKs and keyframe requests stay unicast
+#define VIDEO_MULTICAST 0             // 1 = video to VIDEO_MULTICAST_GROUP, 0 = unicast to each client
+#define VIDEO_MULTICAST_GROUP "239.255.42.1" // Administratively scoped group on the topside LAN
+#define VIDEO_MULTICAST_TTL 1         // Router hops the stream may cross (1 = local subnet only)
+#define VIDEO_MULTICAST_INTERFACE "0.0.0.0" // Local interface address (0.0.0.0 = routing table picks)
+
+#define FRAME_WIDTH 640               // * Frame width
+#define FRAME_HEIGHT 480              // * Frame height
+#define MAX_PACKET_SIZE 1400          // * Chunk datagram size until path MTU discovery finds more (to avoid fragmentation)
+#define MAX_DATAGRAM_SIZE 8972        // Largest chunk datagram: 9000-byte jumbo MTU minus IPv4/UDP headers
+#define MIN_PACKET_SIZE 548           // Smallest chunk datagram: 576-byte minimum IPv4 MTU minus headers
+#define MAX_FRAME_DIMENSION 4096      // Largest width/height a receiver will accept
 
 // Protocol message types
 #define MSG_TYPE_FRAME_CHUNK 1        // Frame chunk message
 #define MSG_TYPE_CONTROL 2            // Control message
+#define MSG_TYPE_NACK 3               // Retransmit request (client -> server, control port)
+#define MSG_TYPE_CLOCK_SYNC 4         // Clock offset probe (client -> server, echoed back)
+#define MSG_TYPE_KEYFRAME_REQUEST 5   // Decoder lost sync, asks for an early keyframe (client -> server)
+#define MSG_TYPE_RECEIVER_REPORT 6    // Loss, jitter and delay feedback (client -> server)
+#define MSG_TYPE_PATH_PROBE 7         // Path MTU probe: type, WIRE_VERSION, zero padding (server -> client, video port)
+
+// Video codecs carried in frame chunks
+#define VIDEO_CODEC_RAW_RGB24 0       // Uncompressed RGB24 (benchmarking)
+#define VIDEO_CODEC_H264 1            // H.264 Annex B access units
+#define VIDEO_CODEC_MJPEG 2           // Motion JPEG, every frame independent
+#define VIDEO_CODEC_RAW_YUV420 3      // Uncompressed planar YUV 4:2:0 (I420, see yuv.h), half of RGB24
+
+// Frame flags (FrameInfo)
+#define FRAME_FLAG_KEYFRAME 0x01      // Frame decodes without earlier frames
+#define FRAME_FLAG_DELTA 0x02         // Raw payload holds only the tiles that changed (tile_delta.h)
+
+// Chunk flags (FrameChunkHeader)
+#define CHUNK_FLAG_PARITY 0x01        // Datagram carries FEC parity for group chunk_index
+
+// Wire format: every message starts with its type byte and WIRE_VERSION.
+// All of them travel in the fixed little-endian layout of wire.h, so builds
+// from different compilers and architectures interoperate; the structs
+// below are their host-side form.
+#define WIRE_VERSION 3                // Bumped on any incompatible layout change
+#define CHUNK_HEADER_SIZE 16          // Encoded FrameChunkHeader
+#define FRAME_INFO_SIZE 32            // Encoded FrameInfo
+#define CONTROL_MESSAGE_SIZE 12       // Encoded ControlMessage
+#define NACK_HEADER_SIZE 12           // Encoded NackMessage up to its bitmap
+#define CLOCK_SYNC_SIZE 32            // Encoded ClockSyncMessage
+#define KEYFRAME_REQUEST_SIZE 8       // Encoded KeyframeRequest
+#define RECEIVER_REPORT_SIZE 36       // Encoded ReceiverReport
+#define TILE_DELTA_HEADER_SIZE 8      // Encoded TileDeltaHeader
+#define WIRE_MAX_CHUNKS 65535         // Data chunks a frame may have (16-bit chunk index)
 
-// Frame chunk header
+// Frame chunk header, at the start of every chunk datagram. A frame travels
+// as one stream, its FrameInfo followed by the payload, cut into chunks of
+// chunk_stride bytes; the chunk count, each chunk's offset and the parity
+// length all follow from frame_size and chunk_stride.
 typedef struct {
     uint8_t msg_type;                 // Message type (MSG_TYPE_FRAME_CHUNK)
+    uint8_t version;                  // WIRE_VERSION
+    uint8_t flags;                    // Chunk flags (CHUNK_FLAG_*)
+    uint8_t fec_group_size;           // Data chunks per parity group (0 = no FEC)
     uint32_t frame_id;                // Frame identifier
-    uint32_t chunk_index;             // Chunk index
-    uint32_t total_chunks;            // Total chunks in frame
-    uint32_t width;                   // Frame width
-    uint32_t height;                  // Frame height
-    uint32_t chunk_size;              // Size of this chunk's data
-    uint32_t chunk_offset;            // Offset in the frame
+    uint32_t frame_size;              // Stream bytes: FRAME_INFO_SIZE + payload
+    uint16_t chunk_index;             // Chunk index (parity: group)
+    uint16_t chunk_stride;            // Stream bytes per data chunk, the last may be shorter
 } FrameChunkHeader;
 
+// Frame metadata, sent once at the start of the frame stream (chunk 0)
+typedef struct {
+    uint16_t width;                   // Frame width
+    uint16_t height;                  // Frame height
+    uint8_t codec;                    // Payload codec (VIDEO_CODEC_*)
+    uint8_t flags;                    // Frame flags (FRAME_FLAG_*)
+    uint64_t decode_ns;               // Server monotonic clock when the frame was decoded
+    uint32_t scale_us;                // Server: decode done -> scale/encode done
+    uint32_t send_us;                 // Server: decode done -> first chunk handed to the kernel
+    uint32_t capture_us;              // Server: camera capture -> decode done (0 = file source)
+    uint32_t pacing_us;               // Server: data chunks spread over at most this long (0 = one burst)
+} FrameInfo;
+
 // Control message
 typedef struct {
     uint8_t msg_type;                 // Message type (MSG_TYPE_CONTROL)
     float x_axis;                     // X-axis value (-1.0 to 1.0)
     float y_axis;                     // Y-axis value (-1.0 to 1.0)
-    uint8_t buttons[8];               // Button states
+    uint8_t buttons[8];               // Button states (one bit each on the wire)
 } ControlMessage;
 
+// Retransmit request: bit i of bitmap set = chunk base_chunk + i is missing.
+// Only the bitmap bytes in use are sent.
+#define NACK_MAX_CHUNKS 1024          // Chunks covered by one NACK datagram
+#define RETRANSMIT_DEADLINE_MS 100    // Frames older than this are not worth recovering
+
+typedef struct {
+    uint8_t msg_type;                 // Message type (MSG_TYPE_NACK)
+    uint32_t frame_id;                // Frame with missing chunks
+    uint32_t base_chunk;              // Chunk index of bitmap bit 0
+    uint8_t bitmap[NACK_MAX_CHUNKS / 8];
+} NackMessage;
+
+#define NACK_MESSAGE_SIZE (NACK_HEADER_SIZE + NACK_MAX_CHUNKS / 8) // Longest encoded NACK
+
+// Clock offset probe (NTP style): the client stamps client_send_ns, the
+// server fills in its receive and reply times and sends it straight back
+typedef struct {
+    uint8_t msg_type;                 // Message type (MSG_TYPE_CLOCK_SYNC)
+    uint64_t client_send_ns;          // Client clock when the probe left (echoed)
+    uint64_t server_recv_ns;          // Server clock when the probe arrived
+    uint64_t server_send_ns;          // Server clock when the reply left
+} ClockSyncMessage;
+
+// Keyframe request: sent while the client's decoder waits for a keyframe
+// (after a gap, or on joining a multicast stream mid-GOP)
+typedef struct {
+    uint8_t msg_type;                 // Message type (MSG_TYPE_KEYFRAME_REQUEST)
+    uint32_t last_frame_id;           // Last frame the client could decode (0 = none)
+} KeyframeRequest;
+
+// Receiver report: what the link did to the stream over the last interval.
+// The server's rate controller turns these into bitrate, resolution and
+// frame rate. Delays are one-way, so only their changes are meaningful.
+typedef struct {
+    uint8_t msg_type;                 // Message type (MSG_TYPE_RECEIVER_REPORT)
+    uint8_t fraction_lost;            // Data chunks missing on first arrival, in 1/256 (before FEC/NACK repair)
+    uint16_t probe_size;              // Largest path MTU probe received in the interval (0 = none)
+    uint32_t last_frame_id;           // Newest frame seen
+    uint32_t interval_us;             // Time covered by this report
+    uint32_t frames_completed;        // Frames completed in the interval
+    uint32_t frames_skipped;          // Frames released incomplete or never seen
+    uint32_t receive_rate_kbps;       // Video bytes received in the interval (incl. parity, resends)
+    uint32_t jitter_us;               // Inter-arrival jitter of frame first chunks (RFC 3550)
+    uint32_t queue_delay_us;          // Mean one-way delay above the recent minimum
+} ReceiverReport;
+
+// Start of a delta frame's payload (FRAME_FLAG_DELTA), followed by the
+// tile bitmap and the changed tiles (see tile_delta.h)
+typedef struct {
+    uint16_t tile_size;               // Tile edge in luma pixels
+    uint32_t tiles_changed;           // Tiles in the payload (bits set in the bitmap)
+} TileDeltaHeader;
+
 // Calculate number of chunks needed for a frame
 #define CALC_NUM_CHUNKS(frame_size, chunk_size) \
     (((frame_size) + (chunk_size) - 1) / (chunk_size))
@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
+
+#include "config.h"
+
+typedef enum {
+    CONFIG_INT,
+    CONFIG_DOUBLE,
+    CONFIG_STRING,
+    CONFIG_SCALER
+} ConfigType;
+
+// One settable key: where it lives in Config and what it accepts
+typedef struct {
+    const char *name;
+    ConfigType type;
+    size_t offset;
+    double min;                           // Range of numeric keys
+    double max;
+    const char *help;
+} ConfigKey;
+
+#define KEY(name, type, min, max, help) {#name, type, offsetof(Config, name), min, max, help}
+
+static const ConfigKey config_keys[] = {
+    KEY(server_ip, CONFIG_STRING, 0, 0, "server address (clients)"),
+    KEY(video_port, CONFIG_INT, 1, 65535, "UDP port of the video stream"),
+    KEY(control_port, CONFIG_INT, 1, 65535, "UDP port of control input, NACKs and reports"),
+    KEY(packet_size, CONFIG_INT, MIN_PACKET_SIZE, MAX_DATAGRAM_SIZE,
+        "chunk datagram bytes before path MTU discovery"),
+    KEY(send_buffer_size, CONFIG_INT, 0, 1 << 30, "SO_SNDBUF per subscriber, 0 = kernel default (server)"),
+    KEY(receive_buffer_size, CONFIG_INT, 0, 1 << 30, "SO_RCVBUF of the video socket, 0 = kernel default (client)"),
+    KEY(frame_width, CONFIG_INT, 16, MAX_FRAME_DIMENSION, "stream width, even"),
+    KEY(frame_height, CONFIG_INT, 16, MAX_FRAME_DIMENSION, "stream height, even"),
+    KEY(target_fps, CONFIG_INT, 1, 240, "frames per second (server)"),
+    KEY(scaler, CONFIG_SCALER, 0, 0, "resize filter: bilinear, fast_bilinear, point, bicubic, area"),
+    KEY(video_path, CONFIG_STRING, 0, 0, "file, V4L2 device or raw:FILE_OR_FIFO (server)"),
+    KEY(capture_width, CONFIG_INT, 16, MAX_FRAME_DIMENSION, "camera or raw: frame width (server)"),
+    KEY(capture_height, CONFIG_INT, 16, MAX_FRAME_DIMENSION, "camera or raw: frame height (server)"),
+    KEY(capture_format, CONFIG_STRING, 0, 0, "pixel format of raw: frames (server)"),
+    KEY(pacing_rate_mbps, CONFIG_DOUBLE, 0, 100000, "egress ceiling per subscriber, 0 = none (server)"),
+    KEY(pacing_spread, CONFIG_DOUBLE, 0, 1, "share of the frame interval a frame is spread over (server)"),
+    KEY(decode_cpu, CONFIG_INT, -1, 1023, "core of the decode thread, -1 = unpinned (server)"),
+    KEY(scale_cpu, CONFIG_INT, -1, 1023, "core of the scale/encode thread (server)"),
+    KEY(send_cpu, CONFIG_INT, -1, 1023, "core of the send thread (server)"),
+    KEY(control_cpu, CONFIG_INT, -1, 1023, "core of the control thread (server)"),
+    KEY(image_path, CONFIG_STRING, 0, 0, "image to hand out (image server)"),
+    KEY(image_port, CONFIG_INT, 1, 65535, "TCP port of the image server"),
+};
+
+#define CONFIG_KEYS ((int)(sizeof(config_keys) / sizeof(config_keys[0])))
+
+// Resize filters by name, indexed by Scaler
+static const char *const scaler_names[] = {
+    [SCALER_BILINEAR] = "bilinear",
+    [SCALER_FAST_BILINEAR] = "fast_bilinear",
+    [SCALER_POINT] = "point",
+    [SCALER_BICUBIC] = "bicubic",
+    [SCALER_AREA] = "area",
+};
+
+#define SCALERS ((int)(sizeof(scaler_names) / sizeof(scaler_names[0])))
+
+static int scaler_from_name(const char *name) {
+    for (int i = 0; i < SCALERS; i++) {
+        if (strcmp(scaler_names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+// Long options for getopt_long, one per key: each returns 0
+const struct option *config_long_options(void) {
+    static struct option options[CONFIG_KEYS + 1];
+    if (!options[0].name) {
+        for (int i = 0; i < CONFIG_KEYS; i++) {
+            options[i] = (struct option){config_keys[i].name, required_argument, NULL, 0};
+        }
+    }
+    return options;
+}
+
+// Every key at its compile-time default
+void config_defaults(Config *config) {
+    memset(config, 0, sizeof(*config));
+    snprintf(config->server_ip, sizeof(config->server_ip), "%s", SERVER_IP);
+    config->video_port = VIDEO_PORT;
+    config->control_port = CONTROL_PORT;
+    config->packet_size = MAX_PACKET_SIZE;
+    config->send_buffer_size = SEND_BUFFER_SIZE;
+    config->receive_buffer_size = RECEIVE_BUFFER_SIZE;
+    config->frame_width = FRAME_WIDTH;
+    config->frame_height = FRAME_HEIGHT;
+    config->target_fps = TARGET_FPS;
+    config->scaler = (Scaler)scaler_from_name(SCALER);
+    snprintf(config->video_path, sizeof(config->video_path), "%s", VIDEO_PATH);
+    config->capture_width = CAPTURE_WIDTH;
+    config->capture_height = CAPTURE_HEIGHT;
+    snprintf(config->capture_format, sizeof(config->capture_format), "%s", CAPTURE_RAW_FORMAT);
+    config->pacing_rate_mbps = PACING_RATE_MBPS;
+    config->pacing_spread = PACING_SPREAD;
+    config->decode_cpu = DECODE_CPU;
+    config->scale_cpu = SCALE_CPU;
+    config->send_cpu = SEND_CPU;
+    config->control_cpu = CONTROL_CPU;
+    snprintf(config->image_path, sizeof(config->image_path), "%s", IMAGE_PATH);
+    config->image_port = IMAGE_PORT;
+}
+
+// Set one key from its text value
+bool config_set(Config *config, const char *key, const char *value) {
+    const ConfigKey *entry = NULL;
+    for (int i = 0; i < CONFIG_KEYS; i++) {
+        if (strcmp(config_keys[i].name, key) == 0) {
+            entry = &config_keys[i];
+            break;
+        }
+    }
+    if (!entry) {
+        fprintf(stderr, "Unknown setting: %s\n", key);
+        return false;
+    }
+
+    void *field = (uint8_t *)config + entry->offset;
+    char *end = NULL;
+    errno = 0;
+    switch (entry->type) {
+        case CONFIG_INT: {
+            long number = strtol(value, &end, 0);
+            if (errno || end == value || *end || number < entry->min || number > entry->max) {
+                fprintf(stderr, "Invalid %s: %s (%.0f to %.0f)\n", key, value, entry->min, entry->max);
+                return false;
+            }
+            *(int *)field = (int)number;
+            return true;
+        }
+        case CONFIG_DOUBLE: {
+            double number = strtod(value, &end);
+            if (errno || end == value || *end || number < entry->min || number > entry->max) {
+                fprintf(stderr, "Invalid %s: %s (%g to %g)\n", key, value, entry->min, entry->max);
+                return false;
+            }
+            *(double *)field = number;
+            return true;
+        }
+        case CONFIG_STRING:
+            if (!*value || strlen(value) >= CONFIG_STRING_SIZE) {
+                fprintf(stderr, "Invalid %s: '%s'\n", key, value);
+                return false;
+            }
+            strcpy(field, value);
+            return true;
+        case CONFIG_SCALER: {
+            int scaler = scaler_from_name(value);
+            if (scaler < 0) {
+                fprintf(stderr, "Invalid %s: %s\n", key, value);
+                return false;
+            }
+            *(Scaler *)field = (Scaler)scaler;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Strip leading and trailing whitespace in place
+static char *trim(char *text) {
+    while (isspace((unsigned char)*text)) text++;
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return text;
+}
+
+// Apply a `key = value` file
+bool config_load_file(Config *config, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    char line[2 * CONFIG_STRING_SIZE];
+    int line_number = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *text = trim(line);
+        if (!*text) {
+            continue;
+        }
+
+        char *equals = strchr(text, '=');
+        if (!equals) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, line_number);
+            ok = false;
+            continue;
+        }
+        *equals = '\0';
+        if (!config_set(config, trim(text), trim(equals + 1))) {
+            fprintf(stderr, "%s:%d: setting ignored\n", path, line_number);
+            ok = false;
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+// Defaults, then the -c file, then the --key options
+bool config_parse_args(Config *config, int argc, char *argv[], const char *short_options) {
+    config_defaults(config);
+    const struct option *options = config_long_options();
+
+    // The file first, wherever -c is, so the command line overrides it
+    int opt, index;
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, short_options, options, &index)) != -1) {
+        if (opt == '?') {
+            return false;
+        }
+        if (opt == 'c' && !config_load_file(config, optarg)) {
+            return false;
+        }
+    }
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, short_options, options, &index)) != -1) {
+        if (opt == 0 && !config_set(config, options[index].name, optarg)) {
+            return false;
+        }
+    }
+
+    // getopt moved the rest to the end; settings are never positional
+    if (optind < argc) {
+        fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+        return false;
+    }
+    optind = 1;
+
+    // Planar 4:2:0 halves both dimensions
+    if (config->frame_width % 2 || config->frame_height % 2) {
+        fprintf(stderr, "Frame size must be even: %dx%d\n", config->frame_width, config->frame_height);
+        return false;
+    }
+    return true;
+}
+
+// The keys with their defaults, for usage messages
+void config_print_usage(FILE *out) {
+    Config defaults;
+    config_defaults(&defaults);
+    fprintf(out, "  -c FILE   read settings from FILE (key = value lines); --key options override it\n");
+    for (int i = 0; i < CONFIG_KEYS; i++) {
+        const ConfigKey *entry = &config_keys[i];
+        const void *field = (const uint8_t *)&defaults + entry->offset;
+        char value[CONFIG_STRING_SIZE];
+        switch (entry->type) {
+            case CONFIG_INT:
+                snprintf(value, sizeof(value), "%d", *(const int *)field);
+                break;
+            case CONFIG_DOUBLE:
+                snprintf(value, sizeof(value), "%g", *(const double *)field);
+                break;
+            case CONFIG_STRING:
+                snprintf(value, sizeof(value), "%s", (const char *)field);
+                break;
+            case CONFIG_SCALER:
+                snprintf(value, sizeof(value), "%s", scaler_names[*(const Scaler *)field]);
+                break;
+        }
+        fprintf(out, "  --%-20s %s [%s]\n", entry->name, entry->help, value);
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <getopt.h>
+
+#include "common.h"
+
+// Runtime configuration shared by the server and the client. Every setting
+// starts at the compile-time default below (or in common.h), may be set in
+// a file of `key = value` lines (`#` starts a comment) named with -c FILE,
+// and then on the command line as `--key value` or `--key=value`, which
+// wins over the file. Each program reads the keys it has a use for,
+// the image client and server included.
+
+// Defaults
+#define VIDEO_PATH "video.mp4"   // Looped file, V4L2 camera ("/dev/video0") or raw frames ("raw:FILE_OR_FIFO")
+#define TARGET_FPS 30            // Target frames per second
+#define CAPTURE_WIDTH 1280       // Camera size to ask for (the driver picks the nearest), or raw: frame size
+#define CAPTURE_HEIGHT 720
+#define CAPTURE_RAW_FORMAT "yuyv422" // Pixel format of raw: frames (FFmpeg name)
+#define SEND_BUFFER_SIZE (4 * 1024 * 1024)    // Socket send buffer per subscriber (holds several raw frames)
+#define RECEIVE_BUFFER_SIZE (8 * 1024 * 1024) // Client socket receive buffer (absorbs render stalls)
+#define PACING_RATE_MBPS 0       // Video egress ceiling per subscriber in Mbit/s (0 = none)
+#define PACING_SPREAD 0.5        // Spread each frame's datagrams over this share of its interval (0 = off)
+#define DECODE_CPU -1            // Core for the demux/decode thread (-1 = unpinned)
+#define SCALE_CPU -1             // Core for the scale/encode thread
+#define SEND_CPU -1              // Core for the network send thread
+#define CONTROL_CPU -1           // Core for the control thread
+#define SCALER "bilinear"        // Resize filter: bilinear, fast_bilinear, point, bicubic, area
+#define IMAGE_PATH "image2.jpg"  // Image the image server hands out
+#define IMAGE_PORT 5555          // TCP port of the image server
+
+#define CONFIG_STRING_SIZE 256   // Longest string setting, including the terminator
+
+// Resize filters, by the names the scaler key takes. The video programs map
+// them to libswscale's SWS_* flags, so this file needs no FFmpeg headers.
+typedef enum {
+    SCALER_BILINEAR,
+    SCALER_FAST_BILINEAR,
+    SCALER_POINT,
+    SCALER_BICUBIC,
+    SCALER_AREA
+} Scaler;
+
+typedef struct {
+    // Network
+    char server_ip[CONFIG_STRING_SIZE];   // Client: server to connect to
+    int video_port;
+    int control_port;
+    int packet_size;                      // Chunk datagram size until path MTU discovery finds more
+    int send_buffer_size;                 // Server: SO_SNDBUF of each subscriber socket
+    int receive_buffer_size;              // Client: SO_RCVBUF of the video socket
+
+    // Stream
+    int frame_width;                      // Full-quality stream size, client window size
+    int frame_height;
+    int target_fps;
+    Scaler scaler;                        // Resize filter, parsed from its name
+
+    // Server source
+    char video_path[CONFIG_STRING_SIZE];
+    int capture_width;
+    int capture_height;
+    char capture_format[CONFIG_STRING_SIZE];
+
+    // Server transmit
+    double pacing_rate_mbps;
+    double pacing_spread;
+
+    // Server thread affinity (-1 = unpinned)
+    int decode_cpu;
+    int scale_cpu;
+    int send_cpu;
+    int control_cpu;
+
+    // Image client and server
+    char image_path[CONFIG_STRING_SIZE];
+    int image_port;
+} Config;
+
+// Long options for getopt_long, one per key: each returns 0
+const struct option *config_long_options(void);
+
+// Every key at its compile-time default
+void config_defaults(Config *config);
+
+// Set one key from its text value. Reports and returns false for unknown
+// keys and values that do not parse or are out of range.
+bool config_set(Config *config, const char *key, const char *value);
+
+// Apply a `key = value` file
+bool config_load_file(Config *config, const char *path);
+
+// Defaults, then the -c file, then the --key options. `short_options` are
+// the program's own getopt options, which must include "c:"; the program
+// parses them afterwards with getopt_long and config_long_options(),
+// skipping 'c' and 0 (optind is reset for it). Arguments that are not
+// options are rejected.
+bool config_parse_args(Config *config, int argc, char *argv[], const char *short_options);
+
+// The keys with their defaults, for usage messages
+void config_print_usage(FILE *out);
+
+#endif /* CONFIG_H */
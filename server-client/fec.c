@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_X86 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define FEC_NEON 1
+#endif
+
+// Portable tail/fallback kernel
+static void xor_scalar(uint8_t *dst, const uint8_t *src, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+#ifdef FEC_X86
+static void xor_sse2(uint8_t *dst, const uint8_t *src, size_t len) {
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(dst + i + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i *)(dst + i + 32));
+        __m128i a3 = _mm_loadu_si128((const __m128i *)(dst + i + 48));
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i *)(src + i)));
+        a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i *)(src + i + 16)));
+        a2 = _mm_xor_si128(a2, _mm_loadu_si128((const __m128i *)(src + i + 32)));
+        a3 = _mm_xor_si128(a3, _mm_loadu_si128((const __m128i *)(src + i + 48)));
+        _mm_storeu_si128((__m128i *)(dst + i), a0);
+        _mm_storeu_si128((__m128i *)(dst + i + 16), a1);
+        _mm_storeu_si128((__m128i *)(dst + i + 32), a2);
+        _mm_storeu_si128((__m128i *)(dst + i + 48), a3);
+    }
+    xor_scalar(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(uint8_t *dst, const uint8_t *src, size_t len) {
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i *)(dst + i + 32));
+        __m256i a2 = _mm256_loadu_si256((const __m256i *)(dst + i + 64));
+        __m256i a3 = _mm256_loadu_si256((const __m256i *)(dst + i + 96));
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i *)(src + i)));
+        a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((const __m256i *)(src + i + 32)));
+        a2 = _mm256_xor_si256(a2, _mm256_loadu_si256((const __m256i *)(src + i + 64)));
+        a3 = _mm256_xor_si256(a3, _mm256_loadu_si256((const __m256i *)(src + i + 96)));
+        _mm256_storeu_si256((__m256i *)(dst + i), a0);
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), a1);
+        _mm256_storeu_si256((__m256i *)(dst + i + 64), a2);
+        _mm256_storeu_si256((__m256i *)(dst + i + 96), a3);
+    }
+    xor_sse2(dst + i, src + i, len - i);
+}
+#endif
+
+#ifdef FEC_NEON
+static void xor_neon(uint8_t *dst, const uint8_t *src, size_t len) {
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        uint8x16_t a0 = vld1q_u8(dst + i);
+        uint8x16_t a1 = vld1q_u8(dst + i + 16);
+        uint8x16_t a2 = vld1q_u8(dst + i + 32);
+        uint8x16_t a3 = vld1q_u8(dst + i + 48);
+        vst1q_u8(dst + i, veorq_u8(a0, vld1q_u8(src + i)));
+        vst1q_u8(dst + i + 16, veorq_u8(a1, vld1q_u8(src + i + 16)));
+        vst1q_u8(dst + i + 32, veorq_u8(a2, vld1q_u8(src + i + 32)));
+        vst1q_u8(dst + i + 48, veorq_u8(a3, vld1q_u8(src + i + 48)));
+    }
+    xor_scalar(dst + i, src + i, len - i);
+}
+#endif
+
+typedef void (*XorKernel)(uint8_t *dst, const uint8_t *src, size_t len);
+
+static XorKernel xor_kernel = NULL;
+static const char *xor_kernel_name = "scalar";
+
+// Pick the widest XOR kernel this CPU supports
+static void select_xor_kernel(void) {
+    xor_kernel = xor_scalar;
+#if defined(FEC_X86)
+    xor_kernel = xor_sse2;
+    xor_kernel_name = "sse2";
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        xor_kernel = xor_avx2;
+        xor_kernel_name = "avx2";
+    }
+#elif defined(FEC_NEON)
+    xor_kernel = xor_neon;
+    xor_kernel_name = "neon";
+#endif
+}
+
+// dst ^= src over len bytes
+void fec_xor(uint8_t *dst, const uint8_t *src, size_t len) {
+    if (!xor_kernel) {
+        select_xor_kernel();
+    }
+    xor_kernel(dst, src, len);
+}
+
+// Name of the XOR kernel selected for this CPU
+const char *fec_xor_backend(void) {
+    if (!xor_kernel) {
+        select_xor_kernel();
+    }
+    return xor_kernel_name;
+}
+
+// Prepare for a new frame; storage only grows
+bool fec_groups_reset(FecGroups *fec, uint32_t total_chunks, uint32_t group_size, size_t max_stride) {
+    uint32_t num_groups = fec_num_groups(total_chunks, group_size);
+
+    if (num_groups > fec->capacity || max_stride > fec->max_stride) {
+        uint32_t capacity = num_groups > fec->capacity ? num_groups : fec->capacity;
+        size_t stride = max_stride > fec->max_stride ? max_stride : fec->max_stride;
+
+        fec_groups_free(fec);
+        fec->parity = (uint8_t *)malloc((size_t)capacity * stride);
+        fec->have_parity = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+        fec->data_received = (uint16_t *)calloc(capacity, sizeof(uint16_t));
+        fec->scratch = (uint8_t *)malloc(stride);
+        if (!fec->parity || !fec->have_parity || !fec->data_received || !fec->scratch) {
+            fprintf(stderr, "Failed to allocate FEC groups\n");
+            fec_groups_free(fec);
+            return false;
+        }
+
+        fec->capacity = capacity;
+        fec->max_stride = stride;
+    }
+
+    fec->group_size = group_size;
+    fec->num_groups = num_groups;
+    fec->stride = 0;
+    memset(fec->have_parity, 0, fec->capacity);
+    memset(fec->data_received, 0, fec->capacity * sizeof(uint16_t));
+    return true;
+}
+
+// Release parity storage
+void fec_groups_free(FecGroups *fec) {
+    free(fec->parity);
+    free(fec->have_parity);
+    free(fec->data_received);
+    free(fec->scratch);
+    fec->parity = NULL;
+    fec->have_parity = NULL;
+    fec->data_received = NULL;
+    fec->scratch = NULL;
+    fec->capacity = 0;
+    fec->max_stride = 0;
+}
+
+// Rebuild the single missing chunk of a group into `out` (stride bytes)
+void fec_rebuild(FecGroups *fec, uint32_t group, const uint8_t *const *members,
+                 const size_t *sizes, uint32_t count, uint8_t *out) {
+    memcpy(out, fec->parity + (size_t)group * fec->max_stride, fec->stride);
+    for (uint32_t i = 0; i < count; i++) {
+        fec_xor(out, members[i], sizes[i]);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// XOR parity forward error correction for frame chunks.
+//
+// A frame's data chunks are split into interleaved groups: with G groups,
+// chunk i belongs to group i % G, so a burst of consecutive losses lands in
+// different groups. Each group gets one parity chunk holding the XOR of its
+// members (zero-padded to the chunk stride) and can rebuild one lost member.
+
+#define FEC_MAX_GROUP_SIZE 255        // Group size travels in one header byte
+
+// Number of parity groups for a frame
+static inline uint32_t fec_num_groups(uint32_t total_chunks, uint32_t group_size) {
+    return group_size ? (total_chunks + group_size - 1) / group_size : 0;
+}
+
+// Data chunks in one interleaved group
+static inline uint32_t fec_group_length(uint32_t total_chunks, uint32_t num_groups, uint32_t group) {
+    return (group < total_chunks) ? (total_chunks - group + num_groups - 1) / num_groups : 0;
+}
+
+// dst ^= src over len bytes (SIMD where available)
+void fec_xor(uint8_t *dst, const uint8_t *src, size_t len);
+
+// Name of the XOR kernel selected for this CPU
+const char *fec_xor_backend(void);
+
+// Receiver side parity bookkeeping for one frame
+typedef struct {
+    uint32_t group_size;              // Data chunks per group (K)
+    uint32_t num_groups;              // Groups in the current frame
+    uint32_t capacity;                // Groups allocated
+    size_t max_stride;                // Bytes reserved per parity payload
+    uint32_t stride;                  // Chunk stride announced by parity chunks
+    uint8_t *parity;                  // capacity * max_stride bytes
+    uint8_t *have_parity;             // Parity received per group
+    uint16_t *data_received;          // Data chunks received per group
+    uint8_t *scratch;                 // One stride of working space
+} FecGroups;
+
+// Prepare for a new frame; storage only grows
+bool fec_groups_reset(FecGroups *fec, uint32_t total_chunks, uint32_t group_size, size_t max_stride);
+
+// Release parity storage
+void fec_groups_free(FecGroups *fec);
+
+// Rebuild the single missing chunk of a group into `out` (stride bytes).
+// `members`/`sizes` list the group's received data chunks.
+void fec_rebuild(FecGroups *fec, uint32_t group, const uint8_t *const *members,
+                 const size_t *sizes, uint32_t count, uint8_t *out);
+
+#endif /* FEC_H */
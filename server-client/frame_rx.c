@@ -0,0 +1,657 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "frame_rx.h"
+#include "wire.h"
+
+// Largest frame stream accepted: a raw RGB frame at the dimension limit,
+// which also bounds any encoded packet
+#define MAX_STREAM_SIZE (FRAME_INFO_SIZE + (uint64_t)MAX_FRAME_DIMENSION * MAX_FRAME_DIMENSION * 3)
+
+// Set up an empty window; payload buffers are allocated on first use
+void frame_rx_init(FrameRx *rx, uint32_t playout_delay_ms, FrameRxDeliver deliver, void *context) {
+    memset(rx, 0, sizeof(*rx));
+    rx->playout_delay_ms = playout_delay_ms;
+    rx->deliver = deliver;
+    rx->context = context;
+    rx->feedback.transit_min_ns = INT64_MAX;
+    rx->feedback.transit_base_ns = INT64_MAX;
+}
+
+// Allocate or reallocate frame resources
+static bool ensure_frame_resources(FrameBuffer *frame, uint32_t payload_size, uint32_t total_chunks) {
+    // Buffers are swapped with the display frame and payload sizes vary, so
+    // track capacity and only ever grow
+    size_t needed = (size_t)payload_size + FRAME_BUFFER_PADDING;
+    if (needed > frame->data_capacity || !frame->frame_data) {
+        if (frame->frame_data) {
+            free(frame->frame_data);
+            frame->frame_data = NULL;
+        }
+
+        // Update frame properties
+        frame->chunks_received = 0;
+        frame->complete = false;
+
+        frame->frame_data = (uint8_t *)malloc(needed);
+        frame->data_capacity = frame->frame_data ? needed : 0;
+        if (!frame->frame_data) {
+            fprintf(stderr, "Failed to allocate frame resources\n");
+            return false;
+        }
+
+        // Initialize frame data to black
+        memset(frame->frame_data, 0, needed);
+
+        printf("Allocated frame resources: %zu bytes\n", needed);
+    }
+
+    // Encoded frames vary in chunk count, so the status array only ever grows
+    if (total_chunks > frame->chunks_capacity || !frame->chunks_status) {
+        if (frame->chunks_status) {
+            free(frame->chunks_status);
+        }
+
+        frame->chunks_status = (uint8_t *)calloc(total_chunks, sizeof(uint8_t));
+        frame->chunks_capacity = total_chunks;
+        frame->chunks_received = 0;
+        if (!frame->chunks_status) {
+            fprintf(stderr, "Failed to allocate frame resources\n");
+            frame->chunks_capacity = 0;
+            return false;
+        }
+    }
+
+    frame->total_chunks = total_chunks;
+    return true;
+}
+
+// Reset frame for new frame ID
+static void reset_frame(FrameBuffer *frame, uint32_t frame_id) {
+    frame->frame_id = frame_id;
+    frame->chunks_received = 0;
+    frame->chunks_reached = 0;
+    frame->chunks_nacked = 0;
+    frame->chunks_arrived = 0;
+    frame->complete = false;
+    frame->have_info = false;
+    frame->first_chunk_ns = monotonic_ns();
+    frame->last_nack_ns = 0;
+
+    // Reset chunk status
+    if (frame->chunks_status) {
+        memset(frame->chunks_status, 0, frame->chunks_capacity);
+    }
+}
+
+// Decode and validate the headers of a received batch in one pass,
+// collecting the chunks that are safe to apply. Returns the number of
+// valid chunks.
+int frame_rx_validate(FrameRx *rx, const UdpReceiver *receiver, int count, FrameChunk *valid) {
+    int num_valid = 0;
+    int num_probes = 0;
+
+    for (int i = 0; i < count; i++) {
+        const uint8_t *datagram = udp_receiver_slot(receiver, i);
+        size_t recv_size = udp_receiver_length(receiver, i);
+
+        // Short datagrams are rejected before the header is looked at
+        if (recv_size < CHUNK_HEADER_SIZE) {
+            continue;
+        }
+
+        // A path MTU probe only matters for its size
+        bool probe = (datagram[0] == MSG_TYPE_PATH_PROBE) & (datagram[1] == WIRE_VERSION);
+        uint32_t probe_size = probe ? (uint32_t)recv_size : 0;
+        rx->feedback.probe_size = probe_size > rx->feedback.probe_size ? probe_size : rx->feedback.probe_size;
+        num_probes += probe;
+
+        FrameChunk *chunk = &valid[num_valid];
+        FrameChunkHeader *header = &chunk->header;
+        wire_decode_chunk_header(datagram, header);
+        chunk->data = datagram + CHUNK_HEADER_SIZE;
+        chunk->size = (uint32_t)(recv_size - CHUNK_HEADER_SIZE);
+
+        // The stream layout follows from its size and stride. A stride must
+        // fit a datagram and hold more than the FrameInfo, so chunk 0
+        // carries all of it.
+        uint32_t stride = header->chunk_stride;
+        bool layout_ok = (stride > FRAME_INFO_SIZE) & (stride <= MAX_DATAGRAM_SIZE - CHUNK_HEADER_SIZE) &
+                         (header->frame_size > FRAME_INFO_SIZE) &
+                         (header->frame_size <= MAX_STREAM_SIZE);
+        uint32_t total_chunks = CALC_NUM_CHUNKS(header->frame_size, stride | (stride == 0));
+
+        // Data chunks must lie inside the stream with exactly their share of
+        // it, parity chunks inside the group table with one stride
+        uint64_t offset = (uint64_t)header->chunk_index * stride;
+        uint64_t remaining = offset < header->frame_size ? header->frame_size - offset : 0;
+        bool is_parity = (header->flags & CHUNK_FLAG_PARITY) != 0;
+        bool in_frame = is_parity
+            ? (header->fec_group_size > 0) &
+              (header->chunk_index < fec_num_groups(total_chunks, header->fec_group_size)) &
+              (chunk->size == (header->frame_size < stride ? header->frame_size : stride))
+            : (header->chunk_index < total_chunks) &
+              (chunk->size == (remaining < stride ? remaining : stride));
+
+        bool ok = (header->msg_type == MSG_TYPE_FRAME_CHUNK) &
+                  (header->version == WIRE_VERSION) &
+                  layout_ok &
+                  in_frame;
+
+        num_valid += ok;
+    }
+
+    rx->probes_received += num_probes;
+    if (num_valid + num_probes != count) {
+        fprintf(stderr, "Dropped %d invalid chunks\n", count - num_valid - num_probes);
+        rx->invalid_chunks += count - num_valid - num_probes;
+    }
+
+    return num_valid;
+}
+
+// Track one-way delay from the first chunk of each frame: its jitter
+// (RFC 3550 estimator) and how far it sits above the recent minimum.
+// The send time comes with the FrameInfo, so this runs once it is in.
+static void observe_transit(FrameRx *rx, const FrameBuffer *frame) {
+    FrameRxFeedback *fb = &rx->feedback;
+    uint64_t arrival_ns = frame->first_chunk_ns;
+    uint64_t server_send_ns = frame->server_decode_ns + frame->server_send_us * 1000ull;
+    int64_t transit = (int64_t)(arrival_ns - server_send_ns);
+
+    if (fb->have_transit) {
+        int64_t d = transit - fb->last_transit_ns;
+        if (d < 0) d = -d;
+        fb->jitter_ns += ((double)d - fb->jitter_ns) / 16.0;
+    }
+    fb->last_transit_ns = transit;
+    fb->have_transit = true;
+
+    // Two overlapping windows: the base follows slow clock drift and route changes
+    if (arrival_ns - fb->window_start_ns > DELAY_BASE_WINDOW_MS * 1000000ull) {
+        fb->transit_base_ns = fb->transit_min_ns;
+        fb->transit_min_ns = INT64_MAX;
+        fb->window_start_ns = arrival_ns;
+    }
+    if (transit < fb->transit_min_ns) {
+        fb->transit_min_ns = transit;
+    }
+
+    int64_t base = fb->transit_min_ns < fb->transit_base_ns ? fb->transit_min_ns : fb->transit_base_ns;
+    fb->queue_delay_sum_ns += (uint64_t)(transit - base);
+    fb->delay_samples++;
+}
+
+// Where a data chunk's stream bytes are kept
+static uint8_t *chunk_data(FrameBuffer *frame, uint32_t index) {
+    return index == 0 ? frame->head
+                      : frame->frame_data + (size_t)index * frame->chunk_stride - FRAME_INFO_SIZE;
+}
+
+// Pick up the FrameInfo once chunk 0 is in, received or rebuilt
+static void read_frame_info(FrameRx *rx, FrameBuffer *frame) {
+    FrameInfo info;
+    wire_decode_frame_info(frame->head, &info);
+
+    if (info.codec > VIDEO_CODEC_RAW_YUV420 ||
+        info.width == 0 || info.width > MAX_FRAME_DIMENSION ||
+        info.height == 0 || info.height > MAX_FRAME_DIMENSION) {
+        // The frame can never complete; it is skipped at release
+        rx->invalid_chunks++;
+        return;
+    }
+
+    frame->width = info.width;
+    frame->height = info.height;
+    frame->codec = info.codec;
+    frame->flags = info.flags;
+    frame->server_decode_ns = info.decode_ns;
+    frame->server_capture_us = info.capture_us;
+    frame->server_scale_us = info.scale_us;
+    frame->server_send_us = info.send_us;
+    frame->server_pacing_us = info.pacing_us;
+    frame->have_info = true;
+    observe_transit(rx, frame);
+}
+
+// Put a data chunk's stream bytes in place: chunk 0 whole into the head,
+// and every payload byte into frame_data
+static void store_chunk(FrameRx *rx, FrameBuffer *frame, uint32_t index, const uint8_t *data, size_t size) {
+    if (index == 0) {
+        memcpy(frame->head, data, size);
+        memcpy(frame->frame_data, data + FRAME_INFO_SIZE, size - FRAME_INFO_SIZE);
+        read_frame_info(rx, frame);
+        return;
+    }
+    memcpy(chunk_data(frame, index), data, size);
+}
+
+// Rebuild the missing chunk of an FEC group once its parity and all
+// but one of its data chunks are in
+static void try_recover_group(FrameRx *rx, FrameBuffer *frame, uint32_t group) {
+    FecGroups *fec = &frame->fec;
+    uint32_t group_length = fec_group_length(frame->total_chunks, fec->num_groups, group);
+
+    if (!fec->have_parity[group] || (uint32_t)fec->data_received[group] + 1 != group_length) {
+        return;
+    }
+
+    // Collect the received members, zero-padded by the XOR to the stride
+    const uint8_t *members[FEC_MAX_GROUP_SIZE];
+    size_t sizes[FEC_MAX_GROUP_SIZE];
+    uint32_t count = 0;
+    uint32_t missing = frame->total_chunks;
+
+    for (uint32_t i = group; i < frame->total_chunks; i += fec->num_groups) {
+        size_t offset = (size_t)i * frame->chunk_stride;
+        if (offset >= frame->stream_size) {
+            return;
+        }
+
+        size_t size = frame->stream_size - offset;
+        if (size > fec->stride) size = fec->stride;
+
+        if (frame->chunks_status[i]) {
+            members[count] = chunk_data(frame, i);
+            sizes[count] = size;
+            count++;
+        } else {
+            missing = i;
+        }
+    }
+
+    if (missing == frame->total_chunks) {
+        return;
+    }
+
+    fec_rebuild(fec, group, members, sizes, count, fec->scratch);
+
+    size_t offset = (size_t)missing * frame->chunk_stride;
+    size_t size = frame->stream_size - offset;
+    if (size > fec->stride) size = fec->stride;
+    store_chunk(rx, frame, missing, fec->scratch, size);
+
+    frame->chunks_status[missing] = 1;
+    frame->chunks_received++;
+    fec->data_received[group]++;
+    rx->chunks_recovered++;
+}
+
+// Mark a frame complete once every data chunk and a valid FrameInfo are in
+static void check_frame_complete(FrameRx *rx, FrameBuffer *frame) {
+    if (!frame->complete && frame->have_info && frame->chunks_received == frame->total_chunks) {
+        frame->complete = true;
+        frame->complete_ns = monotonic_ns();
+        rx->frames_received++;
+    }
+}
+
+// Release the frame at the head of the window: deliver it if complete,
+// otherwise skip it, then move on to the next frame_id
+static void advance_window(FrameRx *rx) {
+    FrameBuffer *frame = &rx->frames[rx->next_frame_id % REASSEMBLY_FRAMES];
+
+    if (frame->frame_id == rx->next_frame_id && frame->complete) {
+        rx->deliver(rx->context, frame);
+    } else {
+        rx->frames_skipped++;
+    }
+
+    // Retire the slot so stray chunks of this frame are treated as late
+    if (frame->frame_id == rx->next_frame_id) {
+        frame->total_chunks = 0;
+    }
+    rx->next_frame_id++;
+}
+
+// Release frames in order: complete ones as soon as they reach the head,
+// missing or incomplete ones once they have held up a later frame for
+// the playout delay
+void frame_rx_release(FrameRx *rx) {
+    if (rx->next_frame_id == 0) {
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    while (1) {
+        FrameBuffer *head = &rx->frames[rx->next_frame_id % REASSEMBLY_FRAMES];
+        bool head_present = head->frame_id == rx->next_frame_id && head->total_chunks > 0;
+        if (head_present && head->complete) {
+            advance_window(rx);
+            continue;
+        }
+
+        // The head's deadline runs from the first sign of it or of any later frame
+        uint64_t since = head_present ? head->first_chunk_ns : UINT64_MAX;
+        for (uint32_t i = 1; i < REASSEMBLY_FRAMES; i++) {
+            FrameBuffer *later = &rx->frames[(rx->next_frame_id + i) % REASSEMBLY_FRAMES];
+            if (later->frame_id == rx->next_frame_id + i && later->total_chunks > 0 &&
+                later->first_chunk_ns < since) {
+                since = later->first_chunk_ns;
+            }
+        }
+
+        if (since == UINT64_MAX || now - since < rx->playout_delay_ms * 1000000ull) {
+            return;
+        }
+
+        advance_window(rx);
+    }
+}
+
+// Loss as the link delivered it, before FEC or retransmission repaired it.
+// Counted when the slot is reused rather than at release: FEC can complete
+// a frame before its last data chunks arrive, and those were not lost.
+static void account_loss(FrameRx *rx, FrameBuffer *frame) {
+    if (frame->chunks_expected == 0) {
+        return;
+    }
+    uint32_t arrived = frame->chunks_arrived < frame->chunks_expected
+                     ? frame->chunks_arrived : frame->chunks_expected;
+    rx->feedback.chunks_expected += frame->chunks_expected;
+    rx->feedback.chunks_lost += frame->chunks_expected - arrived;
+    frame->chunks_expected = 0;
+}
+
+// Find (or claim) the window slot for a chunk's frame. Returns NULL for
+// chunks of frames that were already released.
+static FrameBuffer *window_slot(FrameRx *rx, const FrameChunkHeader *header) {
+    uint32_t frame_id = header->frame_id;
+    int32_t ahead = (int32_t)(frame_id - rx->next_frame_id);
+
+    // First frame, or the server restarted its frame counter
+    if (rx->next_frame_id == 0 || ahead < -REASSEMBLY_RESYNC_FRAMES) {
+        for (int i = 0; i < REASSEMBLY_FRAMES; i++) {
+            rx->frames[i].total_chunks = 0;
+            rx->frames[i].frame_id = 0;
+            rx->frames[i].chunks_expected = 0;
+        }
+        rx->next_frame_id = frame_id;
+        ahead = 0;
+    }
+
+    if (ahead < 0) {
+        rx->late_chunks++;
+        return NULL;
+    }
+
+    // Too far ahead: release the oldest frames to make room
+    while (frame_id - rx->next_frame_id >= REASSEMBLY_FRAMES) {
+        advance_window(rx);
+    }
+
+    FrameBuffer *frame = &rx->frames[frame_id % REASSEMBLY_FRAMES];
+    if (frame->frame_id == frame_id && frame->total_chunks == 0) {
+        // Retired after release
+        if (!(header->flags & CHUNK_FLAG_PARITY) && header->chunk_index >= frame->chunks_nacked) {
+            frame->chunks_arrived++;
+        }
+        rx->late_chunks++;
+        return NULL;
+    }
+    return frame;
+}
+
+// Apply one validated chunk to its frame in the reassembly window
+void frame_rx_apply(FrameRx *rx, const FrameChunk *chunk) {
+    const FrameChunkHeader *header = &chunk->header;
+    rx->bytes_received += CHUNK_HEADER_SIZE + chunk->size;
+
+    FrameBuffer *frame = window_slot(rx, header);
+    if (!frame) {
+        return;
+    }
+
+    // Check if this is a new frame
+    bool new_frame = header->frame_id != frame->frame_id;
+    if (new_frame) {
+        // New frame
+        account_loss(rx, frame);
+        reset_frame(frame, header->frame_id);
+        if ((int32_t)(header->frame_id - rx->feedback.newest_frame_id) > 0) {
+            rx->feedback.newest_frame_id = header->frame_id;
+        }
+    }
+
+    // Every chunk of a frame must agree on how it is cut
+    if (new_frame) {
+        frame->stream_size = header->frame_size;
+        frame->frame_size = header->frame_size - FRAME_INFO_SIZE;
+        frame->chunk_stride = header->chunk_stride;
+    } else if (header->frame_size != frame->stream_size || header->chunk_stride != frame->chunk_stride) {
+        rx->invalid_chunks++;
+        return;
+    }
+
+    // Ensure we have resources for this frame
+    uint32_t total_chunks = CALC_NUM_CHUNKS(header->frame_size, header->chunk_stride);
+    if (!ensure_frame_resources(frame, header->frame_size - FRAME_INFO_SIZE, total_chunks)) {
+        fprintf(stderr, "Failed to ensure frame resources\n");
+        return;
+    }
+
+    // Parity groups are laid out per frame
+    if (new_frame) {
+        frame->chunks_expected = total_chunks;
+        frame->fec.num_groups = 0;
+        if (header->fec_group_size > 0 &&
+            !fec_groups_reset(&frame->fec, total_chunks, header->fec_group_size, header->chunk_stride)) {
+            return;
+        }
+    }
+
+    frame->last_chunk_ns = monotonic_ns();
+
+    if (header->flags & CHUNK_FLAG_PARITY) {
+        // Keep the parity until its group can use it
+        uint32_t group = header->chunk_index;
+        if (group >= frame->fec.num_groups || frame->fec.have_parity[group]) {
+            return;
+        }
+
+        frame->fec.stride = chunk->size;
+        memcpy(frame->fec.parity + (size_t)group * frame->fec.max_stride, chunk->data, chunk->size);
+        frame->fec.have_parity[group] = 1;
+
+        try_recover_group(rx, frame, group);
+        check_frame_complete(rx, frame);
+        return;
+    }
+
+    // Arrivals that were never NACKed count for loss, even if FEC got
+    // there first; the rest may be retransmissions
+    uint32_t chunk_index = header->chunk_index;
+    if (chunk_index >= frame->chunks_nacked) {
+        frame->chunks_arrived++;
+    }
+    if (chunk_index >= frame->chunks_reached) {
+        frame->chunks_reached = chunk_index + 1;
+        frame->reached_ns = frame->last_chunk_ns;
+    }
+
+    // Skip if we've already received this chunk
+    if (frame->chunks_status[chunk_index]) {
+        return;
+    }
+
+    // Copy chunk data to frame buffer
+    store_chunk(rx, frame, chunk_index, chunk->data, chunk->size);
+
+    // Mark chunk as received
+    frame->chunks_status[chunk_index] = 1;
+    frame->chunks_received++;
+    rx->chunks_received++;
+
+    if (frame->fec.num_groups > 0) {
+        uint32_t group = chunk_index % frame->fec.num_groups;
+        frame->fec.data_received[group]++;
+        try_recover_group(rx, frame, group);
+    }
+
+    // Check if frame is complete
+    check_frame_complete(rx, frame);
+}
+
+// Ask the server to resend chunks still missing once a frame has gone quiet
+static void send_frame_nacks(FrameRx *rx, FrameBuffer *frame, int socket,
+                             const struct sockaddr_in *dst, uint64_t now) {
+    if (frame->complete || frame->total_chunks == 0 || !frame->chunks_status) {
+        return;
+    }
+
+    // Still arriving, too old to display, or asked recently
+    if (now - frame->last_chunk_ns < NACK_QUIET_MS * 1000000ull ||
+        now - frame->first_chunk_ns > RETRANSMIT_DEADLINE_MS * 1000000ull ||
+        (frame->last_nack_ns && now - frame->last_nack_ns < NACK_RETRY_MS * 1000000ull)) {
+        return;
+    }
+
+    // A paced sender may not have sent the chunks past the highest one in
+    // yet. They are due the frame's pacing span after its first chunk or,
+    // with a sender running late, their share of the span after the highest
+    // one. Until then only gaps below that one are missing. Without the
+    // FrameInfo the span is unknown, but chunk 0 is a gap then.
+    uint32_t limit = frame->total_chunks;
+    uint64_t pacing_ns = frame->server_pacing_us * 1000ull;
+    uint64_t tail_ns = frame->first_chunk_ns + pacing_ns;
+    uint64_t late_ns = frame->reached_ns +
+                       pacing_ns * (frame->total_chunks - frame->chunks_reached) / frame->total_chunks;
+    if (late_ns > tail_ns) {
+        tail_ns = late_ns;
+    }
+    if (!frame->have_info || now < tail_ns + NACK_QUIET_MS * 1000000ull) {
+        limit = frame->chunks_reached;
+    }
+
+    // One bitmap per NACK_MAX_CHUNKS chunks, trimmed to the last missing bit
+    NackMessage nack;
+    uint8_t wire[NACK_MESSAGE_SIZE];
+    uint32_t nacked = 0;
+    for (uint32_t base = 0; base < limit; base += NACK_MAX_CHUNKS) {
+        memset(&nack, 0, sizeof(nack));
+        nack.msg_type = MSG_TYPE_NACK;
+        nack.frame_id = frame->frame_id;
+        nack.base_chunk = base;
+
+        size_t bitmap_bytes = 0;
+        for (uint32_t bit = 0; bit < NACK_MAX_CHUNKS && base + bit < limit; bit++) {
+            if (!frame->chunks_status[base + bit]) {
+                nack.bitmap[bit / 8] |= 1u << (bit % 8);
+                bitmap_bytes = bit / 8 + 1;
+                nacked = base + bit + 1;
+            }
+        }
+
+        if (bitmap_bytes == 0) {
+            continue;
+        }
+
+        size_t length = wire_encode_nack(wire, &nack, bitmap_bytes);
+        sendto(socket, wire, length, 0, (const struct sockaddr*)dst, sizeof(*dst));
+        rx->nacks_sent++;
+    }
+
+    // Nothing missing yet below the highest chunk in
+    if (nacked == 0) {
+        return;
+    }
+    if (nacked > frame->chunks_nacked) {
+        frame->chunks_nacked = nacked;
+    }
+    frame->last_nack_ns = now;
+}
+
+// Whether a frame in the window is still waiting for chunks
+bool frame_rx_waiting(const FrameRx *rx) {
+    for (int i = 0; i < REASSEMBLY_FRAMES; i++) {
+        const FrameBuffer *frame = &rx->frames[i];
+        if (frame->total_chunks > 0 && !frame->complete) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// NACK every frame in the window that is still waiting for chunks
+void frame_rx_send_nacks(FrameRx *rx, int socket, const struct sockaddr_in *dst) {
+    uint64_t now = monotonic_ns();
+    for (int i = 0; i < REASSEMBLY_FRAMES; i++) {
+        send_frame_nacks(rx, &rx->frames[i], socket, dst, now);
+    }
+}
+
+// Begin a report interval at the current counters
+static void start_report_interval(FrameRx *rx, uint64_t now) {
+    FrameRxFeedback *fb = &rx->feedback;
+    fb->interval_start_ns = now;
+    fb->frames_received = rx->frames_received;
+    fb->frames_skipped = rx->frames_skipped;
+    fb->bytes_received = rx->bytes_received;
+    fb->chunks_expected = 0;
+    fb->chunks_lost = 0;
+    fb->queue_delay_sum_ns = 0;
+    fb->delay_samples = 0;
+    fb->probe_size = 0;
+}
+
+// Summarise the link for the server once per RECEIVER_REPORT_INTERVAL_MS
+void frame_rx_send_report(FrameRx *rx, int socket, const struct sockaddr_in *dst) {
+    FrameRxFeedback *fb = &rx->feedback;
+    uint64_t now = monotonic_ns();
+
+    // Nothing to say before the stream starts
+    if (rx->next_frame_id == 0) {
+        return;
+    }
+
+    if (fb->interval_start_ns == 0 ||
+        now - fb->interval_start_ns >= 10 * RECEIVER_REPORT_INTERVAL_MS * 1000000ull) {
+        // First interval, or the loop stalled: start afresh rather than report a stale average
+        start_report_interval(rx, now);
+        return;
+    }
+
+    uint64_t interval_ns = now - fb->interval_start_ns;
+    if (interval_ns < RECEIVER_REPORT_INTERVAL_MS * 1000000ull) {
+        return;
+    }
+
+    ReceiverReport report;
+    memset(&report, 0, sizeof(report));
+    report.msg_type = MSG_TYPE_RECEIVER_REPORT;
+    // Fixed point with the binary point at the left edge, as in RTCP (RFC 3550);
+    // total loss saturates at 255/256
+    uint64_t fraction = fb->chunks_expected ? ((uint64_t)fb->chunks_lost << 8) / fb->chunks_expected : 0;
+    report.fraction_lost = (uint8_t)(fraction > 255 ? 255 : fraction);
+    report.probe_size = (uint16_t)fb->probe_size;
+    report.last_frame_id = fb->newest_frame_id;
+    report.interval_us = (uint32_t)(interval_ns / 1000);
+    report.frames_completed = rx->frames_received - fb->frames_received;
+    report.frames_skipped = rx->frames_skipped - fb->frames_skipped;
+    report.receive_rate_kbps = (uint32_t)((rx->bytes_received - fb->bytes_received) * 8 * 1000000ull / interval_ns);
+    report.jitter_us = (uint32_t)(fb->jitter_ns / 1000);
+    report.queue_delay_us = fb->delay_samples
+        ? (uint32_t)(fb->queue_delay_sum_ns / fb->delay_samples / 1000)
+        : 0;
+
+    uint8_t wire[RECEIVER_REPORT_SIZE];
+    wire_encode_receiver_report(wire, &report);
+    sendto(socket, wire, sizeof(wire), 0, (const struct sockaddr*)dst, sizeof(*dst));
+    rx->reports_sent++;
+
+    start_report_interval(rx, now);
+}
+
+// Release every frame buffer in the window
+void frame_rx_free(FrameRx *rx) {
+    for (int i = 0; i < REASSEMBLY_FRAMES; i++) {
+        if (rx->frames[i].chunks_status) free(rx->frames[i].chunks_status);
+        if (rx->frames[i].frame_data) free(rx->frames[i].frame_data);
+        fec_groups_free(&rx->frames[i].fec);
+        rx->frames[i].chunks_status = NULL;
+        rx->frames[i].frame_data = NULL;
+    }
+}
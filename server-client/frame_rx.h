@@ -0,0 +1,152 @@
+#ifndef FRAME_RX_H
+#define FRAME_RX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "udp_batch.h"
+#include "fec.h"
+
+// Receiver side of the video protocol: validates chunk datagrams, assembles
+// a window of frames in flight (indexed by frame_id), rebuilds lost chunks
+// from FEC parity, NACKs what is still missing and releases frames in
+// frame_id order once complete or overdue. It also measures what the link
+// does to the stream (loss, jitter, queuing delay) for receiver reports.
+
+#define FRAME_BUFFER_PADDING 64               // Decoder overread slack (AV_INPUT_BUFFER_PADDING_SIZE)
+#define NACK_QUIET_MS 2                       // Frame silence before missing chunks are NACKed
+#define NACK_RETRY_MS 10                      // Minimum gap between NACKs for the same frame
+#define REASSEMBLY_FRAMES 8                   // Frames assembled concurrently, indexed by frame_id
+#define REASSEMBLY_RESYNC_FRAMES 64           // Jump back this far and the stream is treated as restarted
+#define RECEIVER_REPORT_INTERVAL_MS 100       // Feedback period for the server's rate controller
+#define DELAY_BASE_WINDOW_MS 10000            // Base one-way delay is the minimum over the last two windows
+
+// Frame management. The frame stream is the FrameInfo then the payload:
+// chunk 0 is kept whole in `head` (FEC needs it as sent) and the payload
+// is assembled in frame_data.
+typedef struct {
+    uint32_t frame_id;
+    uint32_t width;
+    uint32_t height;
+    uint32_t total_chunks;
+    uint32_t chunks_received;
+    uint32_t chunks_reached;               // Highest data chunk index in + 1
+    uint32_t chunks_nacked;                // Chunks below this index have been NACKed
+    uint32_t chunks_arrived;               // Data chunks in without being NACKed first (loss accounting)
+    uint32_t chunks_expected;              // Data chunks of the frame, kept after release until counted
+    uint32_t chunks_capacity;
+    uint8_t *chunks_status;
+    uint8_t *frame_data;
+    size_t data_capacity;                  // Bytes allocated at frame_data
+    uint32_t frame_size;                   // Payload bytes
+    uint32_t stream_size;                  // FrameInfo + payload, as chunked
+    uint32_t chunk_stride;
+    bool have_info;                        // FrameInfo received and valid
+    uint8_t head[MAX_DATAGRAM_SIZE];       // Chunk 0
+    uint8_t codec;
+    uint8_t flags;
+    FecGroups fec;
+    uint64_t first_chunk_ns;
+    uint64_t last_chunk_ns;
+    uint64_t reached_ns;                   // Arrival of the highest data chunk
+    uint64_t last_nack_ns;
+    bool complete;
+
+    // Timestamps: server clock from the FrameInfo, the rest receiver clock
+    uint64_t server_decode_ns;
+    uint32_t server_capture_us;           // 0 = file source
+    uint32_t server_scale_us;
+    uint32_t server_send_us;
+    uint32_t server_pacing_us;            // Chunks still missing past the highest in may be unsent until then
+    uint64_t complete_ns;
+    uint64_t present_ns;
+} FrameBuffer;
+
+// A validated chunk datagram: its decoded header and stream bytes
+typedef struct {
+    FrameChunkHeader header;
+    const uint8_t *data;                   // Points into the receive slot
+    uint32_t size;
+} FrameChunk;
+
+// Called for every complete frame, in frame_id order. The callee may take
+// the payload by swapping frame_data/data_capacity with a buffer of its own.
+typedef void (*FrameRxDeliver)(void *context, FrameBuffer *frame);
+
+// Link measurements since the last receiver report. Transit is arrival time
+// minus the server's send time; the clocks are not synchronised, so only
+// transit relative to its recent minimum (queuing delay) is reported.
+typedef struct {
+    uint64_t interval_start_ns;            // 0 = no report interval started
+    uint32_t chunks_expected;              // Data chunks of frames released this interval
+    uint32_t chunks_lost;                  // ... that had not arrived by the time they were NACKed
+    uint32_t frames_received;              // FrameRx counters at the interval start
+    uint32_t frames_skipped;
+    uint64_t bytes_received;
+    uint64_t queue_delay_sum_ns;
+    uint32_t delay_samples;
+    uint32_t newest_frame_id;
+    uint32_t probe_size;                   // Largest path MTU probe received
+
+    int64_t last_transit_ns;
+    bool have_transit;
+    double jitter_ns;                      // Smoothed |transit difference| of consecutive frames
+    int64_t transit_min_ns;                // Minimum in the current window
+    int64_t transit_base_ns;               // Minimum in the previous window
+    uint64_t window_start_ns;
+} FrameRxFeedback;
+
+typedef struct {
+    FrameBuffer frames[REASSEMBLY_FRAMES];
+    uint32_t next_frame_id;                // Next frame to release (0 = stream not started)
+    uint32_t playout_delay_ms;             // How long an incomplete frame may hold up later ones
+    FrameRxDeliver deliver;
+    void *context;
+
+    // Statistics
+    uint32_t frames_received;              // Completed
+    uint32_t frames_skipped;               // Released incomplete or never seen
+    uint32_t chunks_received;
+    uint32_t chunks_recovered;             // Rebuilt from FEC parity
+    uint32_t late_chunks;                  // For frames already released
+    uint32_t invalid_chunks;
+    uint32_t probes_received;              // Path MTU probes
+    uint32_t nacks_sent;
+    uint64_t bytes_received;               // Every valid datagram, header included
+    uint32_t reports_sent;
+
+    FrameRxFeedback feedback;
+} FrameRx;
+
+// Set up an empty window; payload buffers are allocated on first use
+void frame_rx_init(FrameRx *rx, uint32_t playout_delay_ms, FrameRxDeliver deliver, void *context);
+
+// Decode and validate the headers of a received batch in one pass,
+// collecting the chunks that are safe to apply into `valid` (`count`
+// entries). Path MTU probes are noted for the next receiver report.
+// Returns the number of valid chunks.
+int frame_rx_validate(FrameRx *rx, const UdpReceiver *receiver, int count, FrameChunk *valid);
+
+// Apply one validated chunk to its frame in the reassembly window
+void frame_rx_apply(FrameRx *rx, const FrameChunk *chunk);
+
+// Deliver frames that are complete, or skip overdue ones, in frame_id order
+void frame_rx_release(FrameRx *rx);
+
+// Whether a frame in the window is still waiting for chunks, i.e. NACK
+// and playout timers are running
+bool frame_rx_waiting(const FrameRx *rx);
+
+// NACK every frame in the window that is still waiting for chunks
+void frame_rx_send_nacks(FrameRx *rx, int socket, const struct sockaddr_in *dst);
+
+// Summarise the link for the server once per RECEIVER_REPORT_INTERVAL_MS
+void frame_rx_send_report(FrameRx *rx, int socket, const struct sockaddr_in *dst);
+
+// Release every frame buffer in the window
+void frame_rx_free(FrameRx *rx);
+
+#endif /* FRAME_RX_H */
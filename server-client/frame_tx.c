@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_tx.h"
+#include "fec.h"
+#include "wire.h"
+
+// Set up an empty cache of `cache_frames` frames, chunked at MAX_PACKET_SIZE
+bool frame_tx_init(FrameTx *tx, uint8_t fec_group_size, int cache_frames,
+                   FrameTxRelease release, void *release_context) {
+    memset(tx, 0, sizeof(*tx));
+    tx->fec_group_size = fec_group_size;
+    tx->datagram_size = MAX_PACKET_SIZE;
+    tx->cache_frames = cache_frames < 1 ? 1 : cache_frames > FRAME_TX_MAX_CACHE ? FRAME_TX_MAX_CACHE : cache_frames;
+    tx->release = release;
+    tx->release_context = release_context;
+    return true;
+}
+
+// Drop a cached frame, handing its payload back to the owner
+static void evict(FrameTx *tx, TxFrame *frame) {
+    if (frame->owner && tx->release) {
+        tx->release(tx->release_context, frame->owner);
+    }
+    frame->owner = NULL;
+    frame->num_chunks = 0;
+    frame->num_parity = 0;
+}
+
+// Make sure a transmit frame has a header for every datagram and room for its parity
+static bool ensure_tx_slots(TxFrame *frame, int num_datagrams, size_t parity_bytes) {
+    if (num_datagrams > frame->capacity) {
+        uint8_t *headers = (uint8_t *)realloc(frame->headers, (size_t)num_datagrams * CHUNK_HEADER_SIZE);
+        if (!headers) {
+            fprintf(stderr, "Failed to allocate transmit buffers\n");
+            return false;
+        }
+        frame->headers = headers;
+
+        UdpDatagram *datagrams = (UdpDatagram *)realloc(frame->datagrams, num_datagrams * sizeof(UdpDatagram));
+        if (!datagrams) {
+            fprintf(stderr, "Failed to allocate transmit buffers\n");
+            return false;
+        }
+        frame->datagrams = datagrams;
+        frame->capacity = num_datagrams;
+    }
+
+    // Parity is the only payload the sender generates itself
+    if (parity_bytes > frame->parity_capacity) {
+        uint8_t *parity = (uint8_t *)realloc(frame->parity, parity_bytes);
+        if (!parity) {
+            fprintf(stderr, "Failed to allocate transmit buffers\n");
+            return false;
+        }
+        frame->parity = parity;
+        frame->parity_capacity = parity_bytes;
+    }
+
+    return true;
+}
+
+// Size the chunk datagrams of the frames to come
+void frame_tx_set_datagram_size(FrameTx *tx, size_t datagram_size) {
+    if (datagram_size < MIN_PACKET_SIZE) datagram_size = MIN_PACKET_SIZE;
+    if (datagram_size > MAX_DATAGRAM_SIZE) datagram_size = MAX_DATAGRAM_SIZE;
+    tx->datagram_size = datagram_size;
+}
+
+// Bytes a payload of `size` puts on the wire, headers and parity included
+size_t frame_tx_wire_bytes(const FrameTx *tx, size_t size) {
+    size_t chunk_data_size = tx->datagram_size - CHUNK_HEADER_SIZE;
+    size_t stream_size = FRAME_INFO_SIZE + size;
+    int num_chunks = CALC_NUM_CHUNKS(stream_size, chunk_data_size);
+    int num_groups = fec_num_groups(num_chunks, tx->fec_group_size);
+    size_t stride = (stream_size < chunk_data_size) ? stream_size : chunk_data_size;
+    return (size_t)(num_chunks + num_groups) * CHUNK_HEADER_SIZE + stream_size + (size_t)num_groups * stride;
+}
+
+// Build one frame as data chunks plus FEC parity. The frame stream is its
+// FrameInfo followed by the payload; datagrams gather an encoded header and
+// a pointer into the payload, so the frame is never copied.
+TxFrame *frame_tx_prepare(FrameTx *tx, const FramePayload *payload) {
+    // Calculate number of chunks (data plus FEC parity)
+    uint32_t frame_id = ++tx->frames_sent;
+    size_t chunk_data_size = tx->datagram_size - CHUNK_HEADER_SIZE;
+    size_t stream_size = FRAME_INFO_SIZE + payload->size;
+    int num_chunks = CALC_NUM_CHUNKS(stream_size, chunk_data_size);
+    int num_groups = fec_num_groups(num_chunks, tx->fec_group_size);
+    TxFrame *frame = &tx->cache[frame_id % tx->cache_frames];
+
+    // The frame this slot cached can no longer be retransmitted
+    evict(tx, frame);
+
+    if (num_chunks > WIRE_MAX_CHUNKS) {
+        fprintf(stderr, "Frame of %zu bytes needs more than %d chunks\n", payload->size, WIRE_MAX_CHUNKS);
+    }
+    if (payload->size == 0 || num_chunks > WIRE_MAX_CHUNKS ||
+        !ensure_tx_slots(frame, num_chunks + num_groups, (size_t)num_groups * chunk_data_size)) {
+        if (payload->owner && tx->release) {
+            tx->release(tx->release_context, payload->owner);
+        }
+        return NULL;
+    }
+
+    // Build every datagram of the frame up front
+    FrameChunkHeader header = {
+        .msg_type = MSG_TYPE_FRAME_CHUNK,
+        .version = WIRE_VERSION,
+        .flags = 0,
+        .fec_group_size = tx->fec_group_size,
+        .frame_id = frame_id,
+        .frame_size = (uint32_t)stream_size,
+        .chunk_stride = (uint16_t)chunk_data_size,
+    };
+    for (int i = 0; i < num_chunks; i++) {
+        // Calculate chunk offset and size in the stream
+        size_t chunk_offset = (size_t)i * chunk_data_size;
+        size_t chunk_size = (chunk_offset + chunk_data_size <= stream_size)
+                          ? chunk_data_size
+                          : (stream_size - chunk_offset);
+
+        // Chunk 0 sends the FrameInfo from behind its header
+        header.chunk_index = i;
+        uint8_t *wire = (i == 0) ? frame->first : frame->headers + (size_t)i * CHUNK_HEADER_SIZE;
+        size_t info_size = (i == 0) ? FRAME_INFO_SIZE : 0;
+        wire_encode_chunk_header(wire, &header);
+
+        // Point at the payload instead of copying it
+        frame->datagrams[i].iov[0].iov_base = wire;
+        frame->datagrams[i].iov[0].iov_len = CHUNK_HEADER_SIZE + info_size;
+        frame->datagrams[i].iov[1].iov_base = (void *)(payload->data + chunk_offset + info_size - FRAME_INFO_SIZE);
+        frame->datagrams[i].iov[1].iov_len = chunk_size - info_size;
+    }
+
+    // Stamp the send time into the FrameInfo before parity covers it, just
+    // ahead of the first chunk leaving
+    uint64_t send_start = monotonic_ns();
+    FrameInfo info = {
+        .width = (uint16_t)payload->width,
+        .height = (uint16_t)payload->height,
+        .codec = payload->codec,
+        .flags = payload->flags,
+        .decode_ns = payload->decode_ns,
+        .scale_us = (uint32_t)((payload->scale_ns - payload->decode_ns) / 1000),
+        .send_us = (uint32_t)((send_start - payload->decode_ns) / 1000),
+        .capture_us = payload->capture_ns ? (uint32_t)((payload->decode_ns - payload->capture_ns) / 1000) : 0,
+        .pacing_us = (uint32_t)(payload->pacing_ns / 1000),
+    };
+    wire_encode_frame_info(frame->first + CHUNK_HEADER_SIZE, &info);
+
+    // Parity for interleaved groups: group g covers chunks g, g + G, g + 2G, ...
+    size_t stride = (stream_size < chunk_data_size) ? stream_size : chunk_data_size;
+    header.flags = CHUNK_FLAG_PARITY;
+    for (int g = 0; g < num_groups; g++) {
+        uint8_t *wire = frame->headers + (size_t)(num_chunks + g) * CHUNK_HEADER_SIZE;
+        header.chunk_index = g;
+        wire_encode_chunk_header(wire, &header);
+
+        // XOR the stream bytes of each member: anything sent behind its
+        // header (chunk 0's FrameInfo), then its payload
+        uint8_t *parity = frame->parity + (size_t)g * stride;
+        memset(parity, 0, stride);
+        for (int i = g; i < num_chunks; i += num_groups) {
+            const UdpDatagram *member = &frame->datagrams[i];
+            size_t head_size = member->iov[0].iov_len - CHUNK_HEADER_SIZE;
+            fec_xor(parity, (const uint8_t *)member->iov[0].iov_base + CHUNK_HEADER_SIZE, head_size);
+            fec_xor(parity + head_size, (const uint8_t *)member->iov[1].iov_base, member->iov[1].iov_len);
+        }
+
+        frame->datagrams[num_chunks + g].iov[0].iov_base = wire;
+        frame->datagrams[num_chunks + g].iov[0].iov_len = CHUNK_HEADER_SIZE;
+        frame->datagrams[num_chunks + g].iov[1].iov_base = parity;
+        frame->datagrams[num_chunks + g].iov[1].iov_len = stride;
+    }
+
+    tx->last_send_ns = send_start;
+    tx->last_send_duration_ns = 0;
+    tx->last_syscalls = 0;
+    tx->last_num_chunks = num_chunks;
+    tx->last_num_parity = num_groups;
+
+    // Keep the datagrams, and the payload they point into, around for NACKs
+    frame->owner = payload->owner;
+    frame->frame_id = frame_id;
+    frame->flags = payload->flags;
+    frame->sent_ns = send_start;
+    frame->num_chunks = num_chunks;
+    frame->num_parity = num_groups;
+    frame->bytes = frame_tx_wire_bytes(tx, payload->size);
+    return frame;
+}
+
+// Cached frame with this id, or NULL once it has been evicted
+TxFrame *frame_tx_lookup(FrameTx *tx, uint32_t frame_id) {
+    TxFrame *frame = &tx->cache[frame_id % tx->cache_frames];
+    if (frame->frame_id != frame_id || frame->num_chunks == 0) {
+        return NULL;
+    }
+    return frame;
+}
+
+// Prepare one frame and send it to `dst`
+int frame_tx_send(FrameTx *tx, UdpSender *sender, const struct sockaddr_in *dst,
+                  const FramePayload *payload) {
+    TxFrame *frame = frame_tx_prepare(tx, payload);
+    if (!frame) {
+        return -1;
+    }
+
+    // Send the whole frame in as few syscalls as the kernel allows
+    uint64_t syscalls_before = sender->syscalls;
+    int sent = udp_sender_send(sender, dst, frame->datagrams, tx_frame_datagrams(frame));
+
+    tx->last_send_duration_ns = monotonic_ns() - tx->last_send_ns;
+    tx->last_syscalls = sender->syscalls - syscalls_before;
+    if (sent > 0) {
+        tx->chunks_sent += sent;
+    }
+    return sent;
+}
+
+// Resend the chunks a NACK asks for, if the frame is still cached and fresh
+int frame_tx_nack(FrameTx *tx, UdpSender *sender, const struct sockaddr_in *dst,
+                  const NackMessage *nack, size_t length) {
+    TxFrame *frame = frame_tx_lookup(tx, nack->frame_id);
+    if (!frame || length < NACK_HEADER_SIZE) {
+        return 0;
+    }
+
+    // Past the deadline the client could not display the frame anyway
+    if (monotonic_ns() - frame->sent_ns > RETRANSMIT_DEADLINE_MS * 1000000ull) {
+        tx->expired_nack_count++;
+        return 0;
+    }
+
+    UdpDatagram resend[NACK_MAX_CHUNKS];
+    size_t count = 0;
+    size_t num_bits = (length - NACK_HEADER_SIZE) * 8;
+
+    for (size_t bit = 0; bit < num_bits; bit++) {
+        if (!(nack->bitmap[bit / 8] & (1u << (bit % 8)))) {
+            continue;
+        }
+
+        uint64_t chunk_index = (uint64_t)nack->base_chunk + bit;
+        if (chunk_index >= (uint64_t)frame->num_chunks) {
+            break;
+        }
+        resend[count++] = frame->datagrams[chunk_index];
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    int sent = udp_sender_send(sender, dst, resend, count);
+    if (sent <= 0) {
+        return 0;
+    }
+    tx->retransmit_count += sent;
+    return sent;
+}
+
+// Release every cached frame and the staging buffers
+void frame_tx_free(FrameTx *tx) {
+    for (int i = 0; i < FRAME_TX_MAX_CACHE; i++) {
+        TxFrame *frame = &tx->cache[i];
+        evict(tx, frame);
+        free(frame->headers);
+        free(frame->parity);
+        free(frame->datagrams);
+        frame->headers = NULL;
+        frame->parity = NULL;
+        frame->datagrams = NULL;
+        frame->capacity = 0;
+        frame->parity_capacity = 0;
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef FRAME_TX_H
+#define FRAME_TX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "udp_batch.h"
+
+// Sender side of the video protocol: splits a frame, its FrameInfo then
+// the payload, into chunk datagrams plus interleaved XOR parity and keeps the most recent frames
+// cached to answer NACKs. A prepared frame can be sent through any number
+// of UdpSenders without being rebuilt. Data datagrams point into the
+// caller's payload, so it must stay valid while the frame is cached;
+// `release` is called with its owner once it is not.
+
+#define FRAME_TX_MAX_CACHE 16         // Upper bound on cached frames
+
+typedef void (*FrameTxRelease)(void *context, void *owner);
+
+// One frame to send
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    uint8_t codec;                    // VIDEO_CODEC_*
+    uint8_t flags;                    // FRAME_FLAG_*
+    uint32_t width;
+    uint32_t height;
+    uint64_t capture_ns;              // Camera capture (monotonic, 0 = none)
+    uint64_t decode_ns;               // Frame decoded (monotonic)
+    uint64_t scale_ns;                // Frame scaled or encoded
+    uint64_t pacing_ns;               // Longest the data chunks are spread over (0 = one burst)
+    void *owner;                      // Handed to release once the frame leaves the cache
+} FramePayload;
+
+// Datagrams of one sent frame, kept for retransmission
+typedef struct {
+    uint32_t frame_id;
+    uint8_t flags;                    // FRAME_FLAG_* of the payload
+    uint64_t sent_ns;                 // When the frame went out
+    int num_chunks;                   // Data chunks (retransmittable)
+    int num_parity;                   // Parity datagrams after the data chunks
+    size_t bytes;                     // All datagrams, headers included
+    int capacity;                     // Datagram slots allocated
+    size_t parity_capacity;           // Parity bytes allocated
+    void *owner;                      // Owner of the payload the data datagrams point into
+    uint8_t *headers;                 // One encoded header per datagram (CHUNK_HEADER_SIZE bytes each)
+    uint8_t first[CHUNK_HEADER_SIZE + FRAME_INFO_SIZE]; // Chunk 0 header and the FrameInfo behind it
+    uint8_t *parity;                  // One chunk stride per parity group
+    UdpDatagram *datagrams;           // Header + payload pointer per datagram
+} TxFrame;
+
+typedef struct {
+    uint8_t fec_group_size;           // Data chunks per parity chunk (0 = FEC off)
+    size_t datagram_size;             // Chunk datagrams of the frames to come, header included
+    int cache_frames;                 // Recent frames kept for NACKs
+    TxFrame cache[FRAME_TX_MAX_CACHE];
+    FrameTxRelease release;
+    void *release_context;
+
+    // Statistics
+    uint32_t frames_sent;             // Also the id of the last frame prepared
+    uint64_t chunks_sent;             // Through frame_tx_send()
+    uint64_t retransmit_count;
+    uint64_t expired_nack_count;
+
+    // The last frame
+    uint64_t last_send_ns;            // Send time stamped into its FrameInfo
+    uint64_t last_send_duration_ns;   // First to last chunk (frame_tx_send() only)
+    uint64_t last_syscalls;
+    int last_num_chunks;
+    int last_num_parity;
+} FrameTx;
+
+static inline int tx_frame_datagrams(const TxFrame *frame) {
+    return frame->num_chunks + frame->num_parity;
+}
+
+// Set up an empty cache of `cache_frames` frames, chunked at MAX_PACKET_SIZE
+bool frame_tx_init(FrameTx *tx, uint8_t fec_group_size, int cache_frames,
+                   FrameTxRelease release, void *release_context);
+
+// Build and cache the datagrams of one frame without sending them, stamped
+// as sent now. The frame takes over one reference to payload->owner,
+// released through the callback (immediately on failure). Returns the
+// cached frame, or NULL on error (including a frame too large for
+// WIRE_MAX_CHUNKS chunks).
+TxFrame *frame_tx_prepare(FrameTx *tx, const FramePayload *payload);
+
+// Size the chunk datagrams of the frames to come (MIN_PACKET_SIZE to
+// MAX_DATAGRAM_SIZE). Cached frames keep theirs, so NACKs are answered
+// with the datagrams the receiver is assembling.
+void frame_tx_set_datagram_size(FrameTx *tx, size_t datagram_size);
+
+// Bytes a payload of `size` puts on the wire, headers and parity included
+size_t frame_tx_wire_bytes(const FrameTx *tx, size_t size);
+
+// Cached frame with this id, or NULL once it has been evicted
+TxFrame *frame_tx_lookup(FrameTx *tx, uint32_t frame_id);
+
+// Prepare one frame and send it to `dst`. Returns the number of datagrams
+// sent, or -1 on error.
+int frame_tx_send(FrameTx *tx, UdpSender *sender, const struct sockaddr_in *dst,
+                  const FramePayload *payload);
+
+// Resend the chunks a NACK asks for, if the frame is still cached and fresh.
+// `length` is the NACK's datagram length, which bounds the bitmap bits read.
+// Returns the number of datagrams resent.
+int frame_tx_nack(FrameTx *tx, UdpSender *sender, const struct sockaddr_in *dst,
+                  const NackMessage *nack, size_t length);
+
+// Release every cached frame and the staging buffers
+void frame_tx_free(FrameTx *tx);
+
+#endif /* FRAME_TX_H */
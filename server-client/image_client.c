@@ -3,12 +3,23 @@
 #include <string.h>
 #include <zmq.h>
 
-/* NOTE: Keep in mind to change the server ip */
-// #define SERVER_IP "192.168.1.246" // Replace with your server's IP
-#define SERVER_IP "127.0.0.1" // Replace with your server's IP
+#include "config.h"
+
 #define OUTPUT_IMAGE "received_image.jpg"
 
-int main() {
+void print_usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-c FILE] [--key value ...] (reads server_ip, image_port)\n", name);
+    config_print_usage(stderr);
+}
+
+int main(int argc, char *argv[]) {
+    // Settings: defaults, then the -c file, then --key options
+    Config config;
+    if (!config_parse_args(&config, argc, argv, "c:")) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
     // Initialize ZMQ context
     void *context = zmq_ctx_new();
 
@@ -17,7 +28,7 @@ int main() {
 
     // Connect to server
     char connection_string[100];
-    sprintf(connection_string, "tcp://%s:5555", SERVER_IP);
+    snprintf(connection_string, sizeof(connection_string), "tcp://%s:%d", config.server_ip, config.image_port);
     printf("Connecting to server at %s\n", connection_string);
 
     int rc = zmq_connect(requester, connection_string);
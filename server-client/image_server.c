@@ -4,11 +4,23 @@
 #include <unistd.h>
 #include <zmq.h>
 
-#define IMAGE_PATH "image2.jpg" // Path to your image file
+#include "config.h"
+
+void print_usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-c FILE] [--key value ...] (reads image_path, image_port)\n", name);
+    config_print_usage(stderr);
+}
+
+int main(int argc, char *argv[]) {
+    // Settings: defaults, then the -c file, then --key options
+    Config config;
+    if (!config_parse_args(&config, argc, argv, "c:")) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
 
-int main() {
     // Read the image file
-    FILE *file = fopen(IMAGE_PATH, "rb");
+    FILE *file = fopen(config.image_path, "rb");
     if (!file) {
         perror("Failed to open image file");
         return EXIT_FAILURE;
@@ -37,7 +49,7 @@ int main() {
         return EXIT_FAILURE;
     }
 
-    printf("Read image file: %s (%ld bytes)\n", IMAGE_PATH, file_size);
+    printf("Read image file: %s (%ld bytes)\n", config.image_path, file_size);
 
     // Initialize ZMQ context
     void *context = zmq_ctx_new();
@@ -46,7 +58,9 @@ int main() {
     void *responder = zmq_socket(context, ZMQ_REP);
 
     // Bind to TCP port
-    int rc = zmq_bind(responder, "tcp://*:5555");
+    char endpoint[32];
+    snprintf(endpoint, sizeof(endpoint), "tcp://*:%d", config.image_port);
+    int rc = zmq_bind(responder, endpoint);
     if (rc != 0) {
         fprintf(stderr, "Failed to bind socket: %s\n", zmq_strerror(zmq_errno()));
         free(image_data);
@@ -55,7 +69,7 @@ int main() {
         return EXIT_FAILURE;
     }
 
-    printf("Server started at tcp://*:5555\n");
+    printf("Server started at %s\n", endpoint);
     printf("Waiting for client requests...\n");
 
     while (1) {
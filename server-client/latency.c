@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "latency.h"
+
+// Bucket holding a value
+static uint32_t bucket_index(uint64_t us) {
+    if (us < LATENCY_SUB_BUCKETS) {
+        return (uint32_t)us;
+    }
+
+    uint32_t msb = 63 - __builtin_clzll(us);
+    if (msb >= LATENCY_MAX_BITS) {
+        return LATENCY_BUCKETS - 1;
+    }
+
+    uint32_t shift = msb - LATENCY_SUB_BUCKET_BITS;
+    uint32_t sub = (uint32_t)(us >> shift) & (LATENCY_SUB_BUCKETS - 1);
+    return (msb - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+// Midpoint of the values that map to a bucket
+static uint64_t bucket_value(uint32_t index) {
+    if (index < LATENCY_SUB_BUCKETS) {
+        return index;
+    }
+
+    uint32_t shift = index / LATENCY_SUB_BUCKETS - 1;
+    uint32_t sub = index % LATENCY_SUB_BUCKETS;
+    uint64_t floor = ((uint64_t)LATENCY_SUB_BUCKETS + sub) << shift;
+    return floor + ((1ull << shift) >> 1);
+}
+
+// Record one sample given in nanoseconds (negative samples count as zero)
+void latency_record_ns(LatencyHistogram *histogram, int64_t ns) {
+    uint64_t us = ns > 0 ? (uint64_t)ns / 1000 : 0;
+
+    histogram->buckets[bucket_index(us)]++;
+    histogram->count++;
+    histogram->sum_us += us;
+    if (us > histogram->max_us) {
+        histogram->max_us = us;
+    }
+}
+
+// Value below which a fraction `quantile` of the samples fall, in microseconds
+uint64_t latency_percentile_us(const LatencyHistogram *histogram, double quantile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(quantile * (double)histogram->count);
+    if (rank >= histogram->count) {
+        rank = histogram->count - 1;
+    }
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) {
+            uint64_t value = bucket_value(i);
+            return value < histogram->max_us ? value : histogram->max_us;
+        }
+    }
+
+    return histogram->max_us;
+}
+
+// Print count, mean, p50/p99/p999 and max on one line
+void latency_print(const LatencyHistogram *histogram, const char *name) {
+    if (histogram->count == 0) {
+        printf("  %-22s no samples\n", name);
+        return;
+    }
+
+    printf("  %-22s n=%-7llu mean=%8.3f p50=%8.3f p99=%8.3f p999=%8.3f max=%8.3f ms\n",
+           name, (unsigned long long)histogram->count,
+           histogram->sum_us / 1000.0 / histogram->count,
+           latency_percentile_us(histogram, 0.50) / 1000.0,
+           latency_percentile_us(histogram, 0.99) / 1000.0,
+           latency_percentile_us(histogram, 0.999) / 1000.0,
+           histogram->max_us / 1000.0);
+}
+
+// Forget all samples
+void latency_reset(LatencyHistogram *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+}
@@ -0,0 +1,34 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Log-linear latency histogram in microseconds: values below
+// LATENCY_SUB_BUCKETS are exact, above that every power of two is split
+// into LATENCY_SUB_BUCKETS linear buckets (~6% resolution). Recording is
+// a few instructions and never allocates, so it can sit on the hot path.
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_BITS 32           // Values up to ~71 minutes, larger ones are clamped
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint32_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+// Record one sample given in nanoseconds (negative samples count as zero)
+void latency_record_ns(LatencyHistogram *histogram, int64_t ns);
+
+// Value below which a fraction `quantile` (0..1) of the samples fall, in microseconds
+uint64_t latency_percentile_us(const LatencyHistogram *histogram, double quantile);
+
+// Print count, mean, p50/p99/p999 and max on one line
+void latency_print(const LatencyHistogram *histogram, const char *name);
+
+// Forget all samples
+void latency_reset(LatencyHistogram *histogram);
+
+#endif /* LATENCY_H */
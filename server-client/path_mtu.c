@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include "path_mtu.h"
+
+// The route's MTU as datagram bytes, capped at MAX_DATAGRAM_SIZE (0 = unknown)
+static size_t kernel_ceiling(const PathMtu *mtu) {
+#ifdef __linux__
+    int value = 0;
+    socklen_t length = sizeof(value);
+    if (getsockopt(mtu->socket, IPPROTO_IP, IP_MTU, &value, &length) < 0 ||
+        value < MIN_PACKET_SIZE + PATH_MTU_IP_UDP_OVERHEAD) {
+        return 0;
+    }
+    size_t size = (size_t)value - PATH_MTU_IP_UDP_OVERHEAD;
+    return size < MAX_DATAGRAM_SIZE ? size : MAX_DATAGRAM_SIZE;
+#else
+    (void)mtu;
+    return 0;
+#endif
+}
+
+// Start at `base_size` towards `dst`
+void path_mtu_init(PathMtu *mtu, const struct sockaddr_in *dst, size_t base_size) {
+    memset(mtu, 0, sizeof(*mtu));
+    mtu->socket = -1;
+    mtu->base_size = base_size;
+    mtu->datagram_size = base_size;
+    mtu->ceiling = base_size;
+
+#ifdef __linux__
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("Path MTU discovery unavailable");
+        return;
+    }
+
+    // Probe mode sets DF without refusing sends above a PMTU the kernel has
+    // learned, so probes past it still go out. IP_MTU needs a connected socket.
+    int discover = IP_PMTUDISC_PROBE;
+    if (setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover)) < 0 ||
+        connect(sock, (const struct sockaddr *)dst, sizeof(*dst)) < 0) {
+        perror("Path MTU discovery unavailable");
+        close(sock);
+        return;
+    }
+    mtu->socket = sock;
+#else
+    (void)dst;
+#endif
+}
+
+// Pick the next size to try between what is confirmed and the ceiling, or
+// end the search when they are close enough
+static void next_probe(PathMtu *mtu, uint64_t now_ns) {
+    mtu->probe_attempts = 0;
+    if (mtu->ceiling < mtu->datagram_size + PATH_MTU_SEARCH_STEP) {
+        mtu->probe_size = 0;
+        mtu->search_done_ns = now_ns;
+        return;
+    }
+    mtu->probe_size = mtu->datagram_size + (mtu->ceiling - mtu->datagram_size + 1) / 2;
+}
+
+// Size of the probe to send now, or 0 for none
+static size_t next_probe_size(PathMtu *mtu, uint64_t now_ns) {
+    if (mtu->socket < 0 || now_ns - mtu->last_probe_ns < PATH_MTU_PROBE_INTERVAL_MS * 1000000ull) {
+        return 0;
+    }
+    mtu->last_probe_ns = now_ns;
+
+    // ICMP may have taught the kernel a smaller MTU than the one confirmed
+    size_t kernel = kernel_ceiling(mtu);
+    if (kernel && kernel < mtu->datagram_size) {
+        mtu->datagram_size = kernel;
+        mtu->ceiling = kernel;
+        mtu->probe_size = 0;
+        mtu->search_done_ns = now_ns;
+    }
+
+    if (!mtu->probe_size) {
+        // Idle until it is time to look for a larger MTU again
+        if (mtu->search_done_ns && now_ns - mtu->search_done_ns < PATH_MTU_RAISE_MS * 1000000ull) {
+            return 0;
+        }
+
+        // Try the whole route first: a jumbo LAN usually takes it in one probe
+        mtu->ceiling = kernel ? kernel : mtu->datagram_size;
+        mtu->probe_size = mtu->ceiling;
+        mtu->probe_attempts = 0;
+        if (mtu->ceiling < mtu->datagram_size + PATH_MTU_SEARCH_STEP) {
+            mtu->probe_size = 0;
+            mtu->search_done_ns = now_ns;
+            return 0;
+        }
+    } else if (mtu->probe_attempts >= PATH_MTU_PROBE_ATTEMPTS) {
+        // Never acknowledged: too big for the path
+        mtu->ceiling = mtu->probe_size - 1;
+        next_probe(mtu, now_ns);
+        if (!mtu->probe_size) {
+            return 0;
+        }
+    }
+
+    mtu->probe_attempts++;
+    mtu->probes_sent++;
+    return mtu->probe_size;
+}
+
+// Send the next probe when one is due: type and version, zero padding.
+// Errors are ignored; an unsent probe is just never acknowledged.
+bool path_mtu_poll(PathMtu *mtu, uint64_t now_ns) {
+    size_t before = mtu->datagram_size;
+    size_t size = next_probe_size(mtu, now_ns);
+    if (size) {
+        uint8_t probe[MAX_DATAGRAM_SIZE];
+        memset(probe, 0, size);
+        probe[0] = MSG_TYPE_PATH_PROBE;
+        probe[1] = WIRE_VERSION;
+        send(mtu->socket, probe, size, 0);
+    }
+    return mtu->datagram_size != before;
+}
+
+// Fold in one receiver report: probe acknowledgement and loss
+bool path_mtu_report(PathMtu *mtu, const ReceiverReport *report, uint64_t now_ns) {
+    if (mtu->socket < 0) {
+        return false;
+    }
+    size_t before = mtu->datagram_size;
+
+    // The probe in flight, or a larger one, got through
+    if (mtu->probe_size && report->probe_size >= mtu->probe_size) {
+        mtu->datagram_size = mtu->probe_size;
+        next_probe(mtu, now_ns);
+    }
+
+    // Without ICMP, datagrams above the path MTU just vanish: sustained heavy
+    // loss after growing falls back to the safe size
+    if (report->fraction_lost / 256.0 >= PATH_MTU_BLACKHOLE_LOSS) {
+        mtu->lossy_reports++;
+    } else {
+        mtu->lossy_reports = 0;
+    }
+    if (mtu->lossy_reports >= PATH_MTU_BLACKHOLE_REPORTS && mtu->datagram_size > mtu->base_size) {
+        mtu->datagram_size = mtu->base_size;
+        mtu->probe_size = 0;
+        mtu->search_done_ns = now_ns;
+        mtu->lossy_reports = 0;
+        mtu->blackholes++;
+    }
+
+    return mtu->datagram_size != before;
+}
+
+// Close the probe socket
+void path_mtu_free(PathMtu *mtu) {
+    if (mtu->socket >= 0) close(mtu->socket);
+    mtu->socket = -1;
+}
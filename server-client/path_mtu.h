@@ -0,0 +1,69 @@
+#ifndef PATH_MTU_H
+#define PATH_MTU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "common.h"
+
+// Path MTU discovery for one viewer, after datagram PLPMTUD (RFC 8899).
+// Sizes here are UDP payload bytes, i.e. the link MTU minus IPv4 and UDP
+// headers. Chunks start at a base size that is safe on the tether (the
+// configured packet_size, MAX_PACKET_SIZE by default).
+//   ceiling  the kernel's view of the route (interface MTU, lowered by ICMP
+//            "fragmentation needed"), read with IP_MTU and capped at
+//            MAX_DATAGRAM_SIZE
+//   probes   padded datagrams with DF set, first at the ceiling, then by
+//            binary search. A size counts once the viewer's receiver report
+//            says a probe of it arrived; PATH_MTU_PROBE_ATTEMPTS unanswered
+//            probes lower the ceiling below it.
+// Probes go through a socket of their own, connected so IP_MTU works; the
+// kernel's PMTU cache is per destination, so it also learns from ICMP
+// about the video socket's datagrams. ICMP is often filtered, so heavy
+// reported loss for several reports in a row after growing drops back to
+// the base size. Every PATH_MTU_RAISE_MS the search runs again in case
+// the path got better. Without IP_MTU (not Linux) chunks stay at the
+// base size.
+
+#define PATH_MTU_IP_UDP_OVERHEAD 28       // IPv4 + UDP headers
+#define PATH_MTU_PROBE_INTERVAL_MS 200    // Time a probe has to show up in a report
+#define PATH_MTU_PROBE_ATTEMPTS 3         // Unanswered probes before a size counts as too big
+#define PATH_MTU_SEARCH_STEP 64           // Search ends when the ceiling is this close
+#define PATH_MTU_RAISE_MS 60000           // Search again after this long
+#define PATH_MTU_BLACKHOLE_LOSS 0.5       // Reported loss that suggests large datagrams vanish
+#define PATH_MTU_BLACKHOLE_REPORTS 3      // ... in this many reports in a row
+
+typedef struct {
+    int socket;                           // Probe socket, connected to the viewer (-1 = discovery off)
+    size_t base_size;                     // Safe size to start at and fall back to
+    size_t datagram_size;                 // Confirmed: chunk datagrams go out at this size
+    size_t ceiling;                       // Largest size that may still get through
+    size_t probe_size;                    // Size being tried (0 = not searching)
+    int probe_attempts;                   // Probes sent at probe_size
+    uint64_t last_probe_ns;
+    uint64_t search_done_ns;              // When the last search ended
+    int lossy_reports;                    // Consecutive reports above PATH_MTU_BLACKHOLE_LOSS
+
+    // Statistics
+    uint32_t probes_sent;
+    uint32_t blackholes;
+} PathMtu;
+
+// Start at `base_size` towards `dst`; discovery stays off when the probe
+// socket cannot be set up
+void path_mtu_init(PathMtu *mtu, const struct sockaddr_in *dst, size_t base_size);
+
+// Send the next probe when one is due. Returns true if datagram_size
+// changed (the kernel learned a smaller MTU).
+bool path_mtu_poll(PathMtu *mtu, uint64_t now_ns);
+
+// Fold in one receiver report: probe acknowledgement and loss.
+// Returns true if datagram_size changed.
+bool path_mtu_report(PathMtu *mtu, const ReceiverReport *report, uint64_t now_ns);
+
+// Close the probe socket
+void path_mtu_free(PathMtu *mtu);
+
+#endif /* PATH_MTU_H */
@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "pipeline.h"
+
+#define PIPELINE_BACKOFF_US 200       // Sleep while a neighbouring stage catches up
+
+// Allocate a queue holding at least `capacity` elements of `elem_size` bytes
+bool spsc_init(SpscQueue *queue, size_t capacity, size_t elem_size) {
+    size_t rounded = 1;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->capacity = rounded;
+    queue->mask = rounded - 1;
+    queue->elem_size = elem_size;
+    queue->slots = (uint8_t *)malloc(rounded * elem_size);
+    if (!queue->slots) {
+        fprintf(stderr, "Failed to allocate queue\n");
+        return false;
+    }
+    return true;
+}
+
+// Release queue storage
+void spsc_free(SpscQueue *queue) {
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+bool doorbell_init(Doorbell *bell) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("Failed to create doorbell pipe");
+        return false;
+    }
+
+    // Ringing must never block, and a full pipe already means "wake up"
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(fds[i], F_GETFL, 0);
+        fcntl(fds[i], F_SETFL, flags | O_NONBLOCK);
+    }
+
+    bell->read_fd = fds[0];
+    bell->write_fd = fds[1];
+    return true;
+}
+
+void doorbell_ring(Doorbell *bell) {
+    uint8_t byte = 1;
+    if (write(bell->write_fd, &byte, 1) < 0) {
+        // Pipe full: the sleeper has plenty of wake-ups pending
+    }
+}
+
+void doorbell_drain(Doorbell *bell) {
+    uint8_t buffer[64];
+    while (read(bell->read_fd, buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+void doorbell_free(Doorbell *bell) {
+    if (bell->read_fd >= 0) close(bell->read_fd);
+    if (bell->write_fd >= 0) close(bell->write_fd);
+    bell->read_fd = -1;
+    bell->write_fd = -1;
+}
+
+// Pin the calling thread to a core (cpu < 0 leaves it unpinned) and name it
+void pin_current_thread(int cpu, const char *name) {
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), name);
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            fprintf(stderr, "Could not pin %s thread to CPU %d\n", name, cpu);
+            return;
+        }
+        printf("Pinned %s thread to CPU %d\n", name, cpu);
+    }
+#else
+    // macOS only lets a thread name itself and has no hard affinity
+    pthread_setname_np(name);
+    if (cpu >= 0) {
+        fprintf(stderr, "Thread pinning not supported here, %s thread left unpinned\n", name);
+    }
+#endif
+}
+
+// Run the calling thread under SCHED_FIFO at `priority` (0 leaves it alone)
+void set_realtime_priority(int priority, const char *name) {
+    if (priority <= 0) {
+        return;
+    }
+
+    // Needs root, CAP_SYS_NICE or an rtprio limit (ulimit -r) on Linux
+    struct sched_param param = { .sched_priority = priority };
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0) {
+        fprintf(stderr, "Could not run %s thread SCHED_FIFO at priority %d: %s\n",
+                name, priority, strerror(error));
+        return;
+    }
+    printf("Running %s thread SCHED_FIFO at priority %d\n", name, priority);
+}
+
+// Short sleep for a stage waiting on a full or empty queue
+void pipeline_backoff(void) {
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = PIPELINE_BACKOFF_US * 1000 };
+    nanosleep(&ts, NULL);
+}
@@ -0,0 +1,138 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+// Lock-free single-producer/single-consumer ring of fixed size elements.
+// head and tail live on separate cache lines so the two threads never
+// write the same line.
+typedef struct {
+    _Alignas(64) atomic_size_t head;  // Next element to pop (consumer owned)
+    _Alignas(64) atomic_size_t tail;  // Next element to push (producer owned)
+    _Alignas(64) size_t capacity;     // Power of two
+    size_t mask;
+    size_t elem_size;
+    uint8_t *slots;
+} SpscQueue;
+
+// Allocate a queue holding at least `capacity` elements of `elem_size` bytes
+bool spsc_init(SpscQueue *queue, size_t capacity, size_t elem_size);
+
+// Release queue storage
+void spsc_free(SpscQueue *queue);
+
+// Copy an element in; false when full
+static inline bool spsc_push(SpscQueue *queue, const void *elem) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head == queue->capacity) {
+        return false;
+    }
+
+    memcpy(queue->slots + (tail & queue->mask) * queue->elem_size, elem, queue->elem_size);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// Copy an element out; false when empty
+static inline bool spsc_pop(SpscQueue *queue, void *elem) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+
+    memcpy(elem, queue->slots + (head & queue->mask) * queue->elem_size, queue->elem_size);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Single-writer seqlock over a small value the caller owns: the writer
+// never waits and readers retry while a write is in flight. The sequence
+// is odd during a write and moves on by two for every value.
+typedef struct {
+    _Alignas(64) atomic_uint sequence;
+} Seqlock;
+
+// Publish `size` bytes from `src` into `value`
+static inline void seqlock_write(Seqlock *lock, void *value, const void *src, size_t size) {
+    unsigned int sequence = atomic_load_explicit(&lock->sequence, memory_order_relaxed);
+    atomic_store_explicit(&lock->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(value, src, size);
+    atomic_store_explicit(&lock->sequence, sequence + 2, memory_order_release);
+}
+
+// Copy a consistent `value` into `dst`; returns its sequence (0 = never written)
+static inline unsigned int seqlock_read(Seqlock *lock, const void *value, void *dst, size_t size) {
+    while (1) {
+        unsigned int before = atomic_load_explicit(&lock->sequence, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+
+        memcpy(dst, value, size);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&lock->sequence, memory_order_relaxed) == before) {
+            return before;
+        }
+    }
+}
+
+// Lock-free triple buffer over three buffers the caller owns, by index: the
+// producer fills `back` and publishes it, the consumer takes the newest
+// published one as `front`. Neither waits; a buffer published again before
+// the consumer took it is simply replaced.
+#define TRIPLE_BUFFER_FRESH 4         // Set in `ready` until the consumer takes it
+
+typedef struct {
+    int back;                         // Producer owned
+    int front;                        // Consumer owned
+    _Alignas(64) atomic_int ready;    // Last published, | TRIPLE_BUFFER_FRESH
+} TripleBuffer;
+
+static inline void triple_buffer_init(TripleBuffer *buffer) {
+    buffer->back = 0;
+    buffer->front = 1;
+    atomic_init(&buffer->ready, 2);
+}
+
+// Hand `back` over and continue in the buffer it replaces
+static inline void triple_buffer_publish(TripleBuffer *buffer) {
+    buffer->back = atomic_exchange(&buffer->ready, buffer->back | TRIPLE_BUFFER_FRESH) & 3;
+}
+
+// Take the newest published buffer as `front`; false when nothing new
+static inline bool triple_buffer_take(TripleBuffer *buffer) {
+    if (!(atomic_load(&buffer->ready) & TRIPLE_BUFFER_FRESH)) {
+        return false;
+    }
+    buffer->front = atomic_exchange(&buffer->ready, buffer->front) & 3;
+    return true;
+}
+
+// Wake-up pipe for a thread that sleeps in select()
+typedef struct {
+    int read_fd;
+    int write_fd;
+} Doorbell;
+
+bool doorbell_init(Doorbell *bell);
+void doorbell_ring(Doorbell *bell);
+void doorbell_drain(Doorbell *bell);
+void doorbell_free(Doorbell *bell);
+
+// Pin the calling thread to a core (cpu < 0 leaves it unpinned) and name it
+void pin_current_thread(int cpu, const char *name);
+
+// Run the calling thread under SCHED_FIFO at `priority` (0 leaves it alone)
+void set_realtime_priority(int priority, const char *name);
+
+// Short sleep for a stage waiting on a full or empty queue
+void pipeline_backoff(void);
+
+#endif /* PIPELINE_H */
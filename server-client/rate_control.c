@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "rate_control.h"
+
+// Start at `initial_bps`, never leave [min_bps, max_bps]
+void rate_control_init(RateControl *rate, uint64_t initial_bps, uint64_t min_bps, uint64_t max_bps) {
+    memset(rate, 0, sizeof(*rate));
+    rate->min_bps = min_bps;
+    rate->max_bps = max_bps;
+    rate->delay_bps = (double)initial_bps;
+    rate->loss_bps = (double)initial_bps;
+    rate->target_bps = initial_bps;
+    rate->threshold_us = DELAY_THRESHOLD_INIT_US;
+}
+
+static double clamp_rate(const RateControl *rate, double bps) {
+    if (bps < (double)rate->min_bps) return (double)rate->min_bps;
+    if (bps > (double)rate->max_bps) return (double)rate->max_bps;
+    return bps;
+}
+
+// Classify the link from queuing delay and its trend, and let the threshold
+// follow the delay so a link with a permanently deeper queue is not read as
+// congested forever (and is not starved by competing TCP flows)
+static LinkUsage detect_usage(RateControl *rate, uint32_t queue_delay_us, double dt_ms) {
+    double delay = (double)queue_delay_us;
+    bool rising = queue_delay_us >= rate->queue_delay_us;
+
+    LinkUsage usage = LINK_NORMAL;
+    if (delay > rate->threshold_us) {
+        usage = rising ? LINK_OVERUSE : LINK_DRAINING;
+    }
+
+    // Spikes well above the threshold (route change, stall) do not move it
+    if (delay - rate->threshold_us < 15000.0) {
+        double gain = delay < rate->threshold_us ? DELAY_THRESHOLD_GAIN_DOWN : DELAY_THRESHOLD_GAIN_UP;
+        rate->threshold_us += dt_ms * gain * (delay - rate->threshold_us);
+        if (rate->threshold_us < DELAY_THRESHOLD_MIN_US) rate->threshold_us = DELAY_THRESHOLD_MIN_US;
+        if (rate->threshold_us > DELAY_THRESHOLD_MAX_US) rate->threshold_us = DELAY_THRESHOLD_MAX_US;
+    }
+
+    return usage;
+}
+
+// Fold in one receiver report; returns the new target in bits/s
+uint64_t rate_control_update(RateControl *rate, const ReceiverReport *report, uint32_t sent_frame_id,
+                             uint64_t now_ns) {
+    double dt_s = report->interval_us / 1e6;
+    if (dt_s <= 0.0 || dt_s > 1.0) {
+        dt_s = 1.0;
+    }
+
+    double receive_bps = report->receive_rate_kbps * 1000.0;
+    double loss = report->fraction_lost / 256.0;
+    bool may_decrease = now_ns - rate->last_decrease_ns >= RATE_DECREASE_INTERVAL_MS * 1000000ull;
+    bool decreased = false;
+
+    rate->usage = detect_usage(rate, report->queue_delay_us, dt_s * 1000.0);
+
+    // Nothing got through at all, although a frame sent before the last
+    // report has had a whole interval to arrive and was never seen: the link
+    // is down or buried under a queue. A sender with nothing to send (source
+    // stall, file loop, end of stream) leaves the receiver quiet too.
+    bool starved = report->receive_rate_kbps == 0 && report->frames_completed == 0 &&
+                   rate->sent_frame_id != 0 && (int32_t)(rate->sent_frame_id - report->last_frame_id) > 0;
+
+    // Delay-based estimate
+    if (starved || rate->usage == LINK_OVERUSE) {
+        if (may_decrease) {
+            double base = (!starved && receive_bps > 0.0 && receive_bps < rate->delay_bps)
+                        ? receive_bps : rate->delay_bps;
+            rate->delay_bps = base * (starved ? 0.5 : RATE_BACKOFF);
+            decreased = true;
+        }
+    } else if (rate->usage == LINK_NORMAL) {
+        rate->delay_bps *= 1.0 + RATE_INCREASE_PER_S * dt_s;
+    }
+
+    // Loss-based estimate
+    if (loss > RATE_LOSS_HIGH) {
+        if (may_decrease) {
+            rate->loss_bps *= 1.0 - 0.5 * loss;
+            decreased = true;
+        }
+    } else if (loss < RATE_LOSS_LOW) {
+        rate->loss_bps *= 1.0 + RATE_LOSS_INCREASE_PER_S * dt_s;
+    }
+
+    // Neither estimate may run away from the other or out of range
+    rate->delay_bps = clamp_rate(rate, rate->delay_bps);
+    rate->loss_bps = clamp_rate(rate, rate->loss_bps);
+
+    if (decreased) {
+        rate->last_decrease_ns = now_ns;
+        rate->backoffs++;
+    }
+
+    double target = rate->delay_bps < rate->loss_bps ? rate->delay_bps : rate->loss_bps;
+    rate->target_bps = (uint64_t)target;
+
+    rate->queue_delay_us = report->queue_delay_us;
+    rate->jitter_us = report->jitter_us;
+    rate->receive_rate_kbps = report->receive_rate_kbps;
+    rate->fraction_lost = loss;
+    rate->sent_frame_id = sent_frame_id;
+    rate->last_report_ns = now_ns;
+    rate->reports++;
+    return rate->target_bps;
+}
+
+// Short name of the link state for logs
+const char *rate_control_usage_name(LinkUsage usage) {
+    switch (usage) {
+        case LINK_OVERUSE:
+            return "overuse";
+        case LINK_DRAINING:
+            return "draining";
+        default:
+            return "normal";
+    }
+}
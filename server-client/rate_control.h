@@ -0,0 +1,70 @@
+#ifndef RATE_CONTROL_H
+#define RATE_CONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+// Sender-side congestion control driven by receiver reports, after Google
+// Congestion Control. Two estimates are kept and the target is the lower:
+//   delay-based  queuing delay above an adaptive threshold and still growing
+//                means a queue is building: back off to a fraction of what
+//                the receiver actually got. Otherwise grow slowly.
+//   loss-based   loss above RATE_LOSS_HIGH cuts in proportion to the loss,
+//                below RATE_LOSS_LOW it grows.
+// Backoffs are spaced so the queue can drain in between, which makes a
+// degrading link walk the rate down report by report instead of stalling.
+
+#define RATE_INCREASE_PER_S 0.08              // Multiplicative growth per second while the link keeps up
+#define RATE_LOSS_INCREASE_PER_S 0.05         // Growth of the loss-based estimate at low loss
+#define RATE_BACKOFF 0.85                     // Overuse: fraction of the measured receive rate to fall to
+#define RATE_LOSS_HIGH 0.10                   // Loss above this cuts the loss-based estimate
+#define RATE_LOSS_LOW 0.02                    // Loss below this lets it grow
+#define RATE_DECREASE_INTERVAL_MS 200         // Minimum time between backoffs
+#define DELAY_THRESHOLD_INIT_US 12500         // Initial overuse threshold on queuing delay
+#define DELAY_THRESHOLD_MIN_US 6000
+#define DELAY_THRESHOLD_MAX_US 600000
+#define DELAY_THRESHOLD_GAIN_UP 0.01          // Threshold adaptation per ms when delay is above it
+#define DELAY_THRESHOLD_GAIN_DOWN 0.00018     // ... and when delay is below it
+
+// What the last report said about the link
+typedef enum {
+    LINK_NORMAL,                              // Delay low: room to grow
+    LINK_DRAINING,                            // Delay high but falling: hold
+    LINK_OVERUSE                              // Delay high and growing: back off
+} LinkUsage;
+
+typedef struct {
+    uint64_t min_bps;
+    uint64_t max_bps;
+    double delay_bps;                         // Delay-based estimate
+    double loss_bps;                          // Loss-based estimate
+    uint64_t target_bps;                      // min(delay_bps, loss_bps), clamped
+    double threshold_us;                      // Adaptive overuse threshold
+    LinkUsage usage;
+    uint32_t sent_frame_id;                   // Newest frame sent as of the last report (0 = none)
+    uint64_t last_report_ns;                  // 0 = no report yet
+    uint64_t last_decrease_ns;
+
+    // Last report, for statistics
+    uint32_t queue_delay_us;
+    uint32_t jitter_us;
+    uint32_t receive_rate_kbps;
+    double fraction_lost;
+    uint32_t reports;
+    uint32_t backoffs;
+} RateControl;
+
+// Start at `initial_bps`, never leave [min_bps, max_bps]
+void rate_control_init(RateControl *rate, uint64_t initial_bps, uint64_t min_bps, uint64_t max_bps);
+
+// Fold in one receiver report; `sent_frame_id` is the newest frame sent to
+// this receiver so far (0 = none). Returns the new target in bits/s.
+uint64_t rate_control_update(RateControl *rate, const ReceiverReport *report, uint32_t sent_frame_id,
+                             uint64_t now_ns);
+
+// Short name of the link state for logs
+const char *rate_control_usage_name(LinkUsage usage);
+
+#endif /* RATE_CONTROL_H */
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "recorder.h"
+
+// File extension, or "" when there is none
+static const char *path_extension(const char *path) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    if (!dot || (slash && dot < slash)) {
+        return "";
+    }
+    return dot + 1;
+}
+
+// Pick the output format from the extension and open Y4M/raw files
+bool recorder_open(Recorder *recorder, const char *path) {
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->path = path;
+    recorder->waiting_for_keyframe = true;
+
+    const char *extension = path_extension(path);
+    if (strcasecmp(extension, "y4m") == 0) {
+        recorder->format = RECORD_Y4M;
+    } else if (strcasecmp(extension, "rgb") == 0 || strcasecmp(extension, "raw") == 0) {
+        recorder->format = RECORD_RAW;
+    } else {
+        // The container is created once the first keyframe shows the codec
+        recorder->format = RECORD_MUX;
+        printf("Recording: remuxing received packets into %s\n", path);
+        return true;
+    }
+
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file) {
+        perror("Failed to open recording file");
+        return false;
+    }
+
+    printf("Recording: writing %s frames to %s\n",
+           recorder->format == RECORD_Y4M ? "Y4M" : "raw RGB24", path);
+    return true;
+}
+
+// True when frames are written decoded (Y4M/raw) rather than remuxed
+bool recorder_wants_rgb(const Recorder *recorder) {
+    return recorder->format != RECORD_MUX;
+}
+
+// Y4M: the first frame fixes the size for the whole file
+static bool write_y4m(Recorder *recorder, const uint8_t *rgb, uint32_t width, uint32_t height) {
+    if (!recorder->yuv) {
+        // 4:2:0 needs even dimensions
+        recorder->width = width & ~1u;
+        recorder->height = height & ~1u;
+        size_t luma = (size_t)recorder->width * recorder->height;
+        recorder->yuv = (uint8_t *)malloc(luma + luma / 2);
+        if (!recorder->yuv) {
+            fprintf(stderr, "Failed to allocate Y4M frame buffer\n");
+            return false;
+        }
+
+        fprintf(recorder->file, "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C420jpeg\n",
+                recorder->width, recorder->height, RECORD_FPS);
+    }
+
+    if ((width & ~1u) != recorder->width || (height & ~1u) != recorder->height) {
+        recorder->frames_dropped++;
+        return false;
+    }
+
+    recorder->yuv_sws_context = sws_getCachedContext(recorder->yuv_sws_context,
+        recorder->width, recorder->height, AV_PIX_FMT_RGB24,
+        recorder->width, recorder->height, AV_PIX_FMT_YUVJ420P,
+        SWS_POINT, NULL, NULL, NULL);
+    if (!recorder->yuv_sws_context) {
+        fprintf(stderr, "Could not initialize the Y4M conversion context\n");
+        return false;
+    }
+
+    size_t luma = (size_t)recorder->width * recorder->height;
+    const uint8_t *src_data[4] = {rgb, NULL, NULL, NULL};
+    int src_linesize[4] = {(int)width * 3, 0, 0, 0};
+    uint8_t *dst_data[4] = {recorder->yuv, recorder->yuv + luma, recorder->yuv + luma + luma / 4, NULL};
+    int dst_linesize[4] = {(int)recorder->width, (int)recorder->width / 2, (int)recorder->width / 2, 0};
+    sws_scale(recorder->yuv_sws_context, src_data, src_linesize, 0, recorder->height,
+              dst_data, dst_linesize);
+
+    size_t size = luma + luma / 2;
+    fputs("FRAME\n", recorder->file);
+    if (fwrite(recorder->yuv, 1, size, recorder->file) != size) {
+        perror("Failed to write Y4M frame");
+        return false;
+    }
+
+    recorder->bytes_written += size + 6;
+    return true;
+}
+
+// Write one decoded RGB24 frame (Y4M and raw output)
+bool recorder_write_rgb(Recorder *recorder, const uint8_t *rgb, uint32_t width, uint32_t height) {
+    if (recorder->format == RECORD_Y4M) {
+        if (!write_y4m(recorder, rgb, width, height)) {
+            return false;
+        }
+    } else {
+        size_t size = (size_t)width * height * 3;
+        if (fwrite(rgb, 1, size, recorder->file) != size) {
+            perror("Failed to write raw frame");
+            return false;
+        }
+        recorder->bytes_written += size;
+    }
+
+    recorder->frames_written++;
+    return true;
+}
+
+// Create the container around the codec of the first keyframe
+static bool open_muxer(Recorder *recorder, const FrameBuffer *frame) {
+    if (avformat_alloc_output_context2(&recorder->mux_context, NULL, NULL, recorder->path) < 0 ||
+        !recorder->mux_context) {
+        fprintf(stderr, "Could not pick a container for %s\n", recorder->path);
+        return false;
+    }
+
+    recorder->stream = avformat_new_stream(recorder->mux_context, NULL);
+    recorder->packet = av_packet_alloc();
+    if (!recorder->stream || !recorder->packet) {
+        fprintf(stderr, "Could not allocate output stream\n");
+        return false;
+    }
+
+    AVCodecParameters *par = recorder->stream->codecpar;
+    par->codec_type = AVMEDIA_TYPE_VIDEO;
+    par->width = frame->width;
+    par->height = frame->height;
+    switch (frame->codec) {
+        case VIDEO_CODEC_H264:
+            par->codec_id = AV_CODEC_ID_H264;
+            break;
+        case VIDEO_CODEC_MJPEG:
+            par->codec_id = AV_CODEC_ID_MJPEG;
+            break;
+        case VIDEO_CODEC_RAW_YUV420:
+            par->codec_id = AV_CODEC_ID_RAWVIDEO;
+            par->format = AV_PIX_FMT_YUV420P;
+            break;
+        default:
+            // Most containers (not MP4) take raw frames, e.g. .mkv or .nut
+            par->codec_id = AV_CODEC_ID_RAWVIDEO;
+            par->format = AV_PIX_FMT_RGB24;
+            break;
+    }
+
+    // Packets are stamped with the server's decode time in microseconds
+    recorder->stream->time_base = (AVRational){1, 1000000};
+
+    if (!(recorder->mux_context->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&recorder->mux_context->pb, recorder->path, AVIO_FLAG_WRITE) < 0) {
+        fprintf(stderr, "Could not open %s\n", recorder->path);
+        return false;
+    }
+
+    // H.264 SPS/PPS are in-band on every keyframe; the muxer builds avcC from the first one
+    if (avformat_write_header(recorder->mux_context, NULL) < 0) {
+        fprintf(stderr, "Could not write the container header for %s\n", recorder->path);
+        return false;
+    }
+
+    recorder->first_decode_ns = frame->server_decode_ns;
+    return true;
+}
+
+// Write one assembled frame as a packet (remux output)
+bool recorder_write_packet(Recorder *recorder, const FrameBuffer *frame) {
+    if (recorder->failed) {
+        return false;
+    }
+
+    // After a gap, dependent frames would not decode: resume on the next keyframe
+    bool keyframe = (frame->flags & FRAME_FLAG_KEYFRAME) != 0;
+    if (frame->frame_id != recorder->last_frame_id + 1) {
+        recorder->waiting_for_keyframe = true;
+    }
+    recorder->last_frame_id = frame->frame_id;
+
+    if (recorder->waiting_for_keyframe) {
+        if (!keyframe) {
+            recorder->frames_dropped++;
+            return false;
+        }
+        recorder->waiting_for_keyframe = false;
+    }
+
+    if (!recorder->mux_context && !open_muxer(recorder, frame)) {
+        recorder->failed = true;
+        return false;
+    }
+
+    // The muxer only reads the payload during the call, so no copy is needed
+    int64_t pts_us = (int64_t)(frame->server_decode_ns - recorder->first_decode_ns) / 1000;
+    AVPacket *packet = recorder->packet;
+    packet->data = frame->frame_data;
+    packet->size = frame->frame_size;
+    packet->stream_index = recorder->stream->index;
+    packet->flags = keyframe ? AV_PKT_FLAG_KEY : 0;
+    packet->pts = av_rescale_q(pts_us, (AVRational){1, 1000000}, recorder->stream->time_base);
+    packet->dts = packet->pts;
+
+    if (av_write_frame(recorder->mux_context, packet) < 0) {
+        fprintf(stderr, "Error writing frame %u to %s\n", frame->frame_id, recorder->path);
+        return false;
+    }
+
+    recorder->frames_written++;
+    recorder->bytes_written += frame->frame_size;
+    return true;
+}
+
+// Finish the file (container trailer) and release everything
+void recorder_close(Recorder *recorder) {
+    if (recorder->mux_context) {
+        // A failed open never got as far as a header, so there is no trailer to write
+        if (!recorder->failed) {
+            av_write_trailer(recorder->mux_context);
+        }
+        if (!(recorder->mux_context->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&recorder->mux_context->pb);
+        }
+        avformat_free_context(recorder->mux_context);
+        recorder->mux_context = NULL;
+    }
+    if (recorder->packet) av_packet_free(&recorder->packet);
+    if (recorder->file) fclose(recorder->file);
+    if (recorder->yuv) free(recorder->yuv);
+    if (recorder->yuv_sws_context) sws_freeContext(recorder->yuv_sws_context);
+    recorder->file = NULL;
+    recorder->yuv = NULL;
+    recorder->yuv_sws_context = NULL;
+
+    if (recorder->path) {
+        printf("Recording: %u frames (%.1f MB) written to %s, %u dropped\n",
+               recorder->frames_written, recorder->bytes_written / 1e6,
+               recorder->path, recorder->frames_dropped);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+
+#include "frame_rx.h"
+
+// Writes received frames to disk for the headless client. The format
+// follows the file extension:
+//   .y4m          decoded frames as YUV4MPEG2 (4:2:0), playable by ffplay/mpv
+//   .rgb / .raw   decoded frames as bare RGB24, back to back
+//   anything else the assembled packets remuxed as-is through libavformat
+//                 (e.g. .mp4, .mkv), no decode or re-encode
+
+#define RECORD_FPS 30                 // Nominal frame rate written to Y4M headers
+
+typedef enum {
+    RECORD_Y4M,
+    RECORD_RAW,
+    RECORD_MUX
+} RecordFormat;
+
+typedef struct {
+    RecordFormat format;
+    const char *path;
+    FILE *file;                       // Y4M and raw output
+
+    // Y4M: fixed size, 4:2:0 planes converted from RGB24
+    uint32_t width;
+    uint32_t height;
+    uint8_t *yuv;
+    struct SwsContext *yuv_sws_context;
+
+    // Remux: the container is opened on the first keyframe
+    AVFormatContext *mux_context;
+    AVStream *stream;
+    AVPacket *packet;
+    uint64_t first_decode_ns;         // Server clock of the first frame written
+    uint32_t last_frame_id;
+    bool waiting_for_keyframe;
+    bool failed;                      // Stop trying after a fatal muxer error
+
+    // Statistics
+    uint32_t frames_written;
+    uint32_t frames_dropped;          // Wrong size for Y4M, or dependent frames after a gap
+    uint64_t bytes_written;
+} Recorder;
+
+// Pick the output format from the extension and open Y4M/raw files
+bool recorder_open(Recorder *recorder, const char *path);
+
+// True when frames are written decoded (Y4M/raw) rather than remuxed
+bool recorder_wants_rgb(const Recorder *recorder);
+
+// Write one decoded RGB24 frame (Y4M and raw output)
+bool recorder_write_rgb(Recorder *recorder, const uint8_t *rgb, uint32_t width, uint32_t height);
+
+// Write one assembled frame as a packet (remux output)
+bool recorder_write_packet(Recorder *recorder, const FrameBuffer *frame);
+
+// Finish the file (container trailer) and release everything
+void recorder_close(Recorder *recorder);
+
+#endif /* RECORDER_H */
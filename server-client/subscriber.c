@@ -0,0 +1,483 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "subscriber.h"
+
+// Set up an empty table
+void subscribers_init(SubscriberTable *table, uint16_t video_port, size_t packet_size,
+                      uint64_t pacing_rate_bps, int send_buffer_size) {
+    memset(table, 0, sizeof(*table));
+    table->video_port = video_port;
+    table->packet_size = packet_size;
+    table->pacing_rate_bps = pacing_rate_bps;
+    table->send_buffer_size = send_buffer_size;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        table->subscribers[i].socket = -1;
+    }
+    table->group.socket = -1;
+}
+
+// Bounds for the rate controllers of subscribers that join from now on
+void subscribers_set_bitrate_range(SubscriberTable *table, uint64_t min_bps, uint64_t max_bps) {
+    table->min_bitrate_bps = min_bps;
+    table->max_bitrate_bps = max_bps;
+}
+
+// Leave the spacing of paced bursts to the qdisc
+void subscribers_enable_txtime(SubscriberTable *table) {
+    table->txtime = true;
+}
+
+// Socket with the table's send buffer size
+static int open_send_socket(const SubscriberTable *table) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("Failed to create subscriber socket");
+        return -1;
+    }
+
+    int sndbuf = table->send_buffer_size;
+    if (sndbuf > 0 && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0) {
+        perror("Failed to set subscriber send buffer");
+    }
+    return sock;
+}
+
+// Publish frames to a multicast group instead of each subscriber
+bool subscribers_enable_multicast(SubscriberTable *table, const char *group_ip, uint16_t port,
+                                  int ttl, const char *interface_ip) {
+    Subscriber *group = &table->group;
+    memset(group, 0, sizeof(*group));
+    group->socket = -1;
+    group->video_addr.sin_family = AF_INET;
+    group->video_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, group_ip, &group->video_addr.sin_addr) != 1 ||
+        !IN_MULTICAST(ntohl(group->video_addr.sin_addr.s_addr))) {
+        fprintf(stderr, "Invalid multicast group: %s\n", group_ip);
+        return false;
+    }
+
+    struct in_addr interface;
+    if (inet_pton(AF_INET, interface_ip, &interface) != 1) {
+        fprintf(stderr, "Invalid multicast interface: %s\n", interface_ip);
+        return false;
+    }
+
+    int sock = open_send_socket(table);
+    if (sock < 0) {
+        return false;
+    }
+
+    // Loopback keeps a client on the server host working
+    unsigned char multicast_ttl = (unsigned char)ttl;
+    unsigned char loop = 1;
+    if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &multicast_ttl, sizeof(multicast_ttl)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface)) < 0) {
+        perror("Failed to configure multicast socket");
+        close(sock);
+        return false;
+    }
+
+    group->active = true;
+    group->socket = sock;
+    group->control_addr = group->video_addr;
+    udp_sender_init(&group->sender, sock, table->pacing_rate_bps);
+    if (table->txtime) {
+        udp_sender_enable_txtime(&group->sender);
+    }
+    table->multicast = true;
+
+    printf("Publishing video to multicast group %s:%u (ttl %d)\n", group_ip, port, ttl);
+    return true;
+}
+
+static Subscriber *find_subscriber(SubscriberTable *table, const struct sockaddr_in *control_addr) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        Subscriber *sub = &table->subscribers[i];
+        if (sub->active && subscriber_addr_equal(&sub->control_addr, control_addr)) {
+            return sub;
+        }
+    }
+    return NULL;
+}
+
+// Note a control message from `control_addr`, adding the subscriber if it is new
+Subscriber *subscribers_touch(SubscriberTable *table, const struct sockaddr_in *control_addr, uint64_t now_ns) {
+    Subscriber *sub = find_subscriber(table, control_addr);
+    if (sub) {
+        sub->last_seen_ns = now_ns;
+        return sub;
+    }
+
+    for (int i = 0; i < MAX_SUBSCRIBERS && !sub; i++) {
+        if (!table->subscribers[i].active) {
+            sub = &table->subscribers[i];
+        }
+    }
+    if (!sub) {
+        return NULL;
+    }
+
+    // Each subscriber sends through its own socket so pacing and buffering
+    // are per viewer (in multicast mode it only carries retransmissions)
+    int sock = open_send_socket(table);
+    if (sock < 0) {
+        return NULL;
+    }
+
+    memset(sub, 0, sizeof(*sub));
+    sub->active = true;
+    sub->socket = sock;
+    sub->control_addr = *control_addr;
+    sub->video_addr = *control_addr;
+    sub->video_addr.sin_port = htons(table->video_port);
+    sub->last_seen_ns = now_ns;
+    udp_sender_init(&sub->sender, sock, table->pacing_rate_bps);
+    if (table->txtime) {
+        udp_sender_enable_txtime(&sub->sender);
+    }
+
+    // A newcomer starts at full rate and backs off once its reports say so
+    rate_control_init(&sub->rate, table->max_bitrate_bps, table->min_bitrate_bps, table->max_bitrate_bps);
+
+    // ... and at the safe datagram size until probes show more gets through
+    path_mtu_init(&sub->mtu, &sub->video_addr, table->packet_size);
+
+    // Dependent frames are useless to a viewer that has not seen a keyframe yet
+    sub->waiting_for_keyframe = true;
+
+    table->count++;
+    printf("Subscriber %s:%u joined (%d watching)\n",
+           inet_ntoa(control_addr->sin_addr), ntohs(control_addr->sin_port), table->count);
+    return sub;
+}
+
+static void remove_subscriber(SubscriberTable *table, Subscriber *sub) {
+    if (sub->socket >= 0) close(sub->socket);
+    path_mtu_free(&sub->mtu);
+    sub->socket = -1;
+    sub->active = false;
+    table->count--;
+}
+
+// Drop subscribers that have gone quiet
+void subscribers_expire(SubscriberTable *table, uint64_t now_ns) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        Subscriber *sub = &table->subscribers[i];
+        if (sub->active && now_ns - sub->last_seen_ns > SUBSCRIBER_TIMEOUT_MS * 1000000ull) {
+            remove_subscriber(table, sub);
+            printf("Subscriber %s:%u timed out (%d watching)\n",
+                   inet_ntoa(sub->control_addr.sin_addr), ntohs(sub->control_addr.sin_port), table->count);
+        }
+    }
+}
+
+static void pop_queued(Subscriber *sub) {
+    sub->queue_head = (sub->queue_head + 1) % FRAME_TX_MAX_CACHE;
+    sub->queue_count--;
+}
+
+static void enqueue_frame(Subscriber *sub, const TxFrame *frame, bool keyframe, uint64_t spread_ns) {
+    // A full queue only holds frames the cache has already evicted
+    if (sub->queue_count == FRAME_TX_MAX_CACHE) {
+        pop_queued(sub);
+        sub->frames_skipped++;
+        sub->waiting_for_keyframe = true;
+    }
+
+    if (sub->waiting_for_keyframe) {
+        if (!keyframe) {
+            sub->frames_skipped++;
+            return;
+        }
+        sub->waiting_for_keyframe = false;
+    }
+
+    int tail = (sub->queue_head + sub->queue_count) % FRAME_TX_MAX_CACHE;
+    sub->queue[tail].frame_id = frame->frame_id;
+    sub->queue[tail].next_datagram = 0;
+    sub->queue[tail].spread_ns = spread_ns;
+    sub->queue_count++;
+}
+
+// Queue a prepared frame for every subscriber (or once for the group)
+void subscribers_enqueue(SubscriberTable *table, const TxFrame *frame, bool keyframe, uint64_t spread_ns) {
+    if (table->multicast) {
+        enqueue_frame(&table->group, frame, keyframe, spread_ns);
+        return;
+    }
+
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (table->subscribers[i].active) {
+            enqueue_frame(&table->subscribers[i], frame, keyframe, spread_ns);
+        }
+    }
+}
+
+// Rate for a frame about to start: fast enough to finish within its spread
+// and to keep up with the rate target, capped by the table's ceiling
+static void pace_frame(const SubscriberTable *table, Subscriber *sub, const TxFrame *frame,
+                       uint64_t spread_ns) {
+    uint64_t rate_bps = spread_ns ? (uint64_t)frame->bytes * 8ull * 1000000000ull / spread_ns : 0;
+    if (spread_ns && sub->rate.reports > 0) {
+        uint64_t floor_bps = (uint64_t)(sub->rate.target_bps * SUBSCRIBER_PACING_FACTOR);
+        if (rate_bps < floor_bps) {
+            rate_bps = floor_bps;
+        }
+    }
+    if (table->pacing_rate_bps && (rate_bps == 0 || rate_bps > table->pacing_rate_bps)) {
+        rate_bps = table->pacing_rate_bps;
+    }
+    udp_sender_set_rate(&sub->sender, rate_bps);
+}
+
+// Longest a subscriber takes to send a frame: pace_frame() only ever goes
+// faster than the spread, except under the table's ceiling
+uint64_t subscribers_pacing_span(const SubscriberTable *table, size_t bytes, uint64_t spread_ns) {
+    if (table->pacing_rate_bps) {
+        uint64_t ceiling_ns = (uint64_t)bytes * 8ull * 1000000000ull / table->pacing_rate_bps;
+        if (ceiling_ns > spread_ns) {
+            return ceiling_ns;
+        }
+    }
+    return spread_ns;
+}
+
+// Work through one subscriber's queue as far as its pacing allows
+static uint64_t pump_subscriber(const SubscriberTable *table, Subscriber *sub, FrameTx *tx,
+                                uint64_t now_ns) {
+    while (sub->queue_count > 0) {
+        QueuedFrame *queued = &sub->queue[sub->queue_head];
+        TxFrame *frame = frame_tx_lookup(tx, queued->frame_id);
+        if (!frame) {
+            // Evicted before this subscriber got to it; later frames may not
+            // decode without it
+            sub->frames_skipped++;
+            sub->waiting_for_keyframe = true;
+            pop_queued(sub);
+            continue;
+        }
+
+        // Behind a gap only a keyframe is worth sending
+        if (sub->waiting_for_keyframe && queued->next_datagram == 0) {
+            if (!(frame->flags & FRAME_FLAG_KEYFRAME)) {
+                sub->frames_skipped++;
+                pop_queued(sub);
+                continue;
+            }
+            sub->waiting_for_keyframe = false;
+        }
+
+        if (queued->next_datagram == 0) {
+            pace_frame(table, sub, frame, queued->spread_ns);
+        }
+
+        uint64_t ready_ns = udp_sender_next_send_ns(&sub->sender, now_ns);
+        if (ready_ns > now_ns) {
+            return ready_ns;
+        }
+
+        int total = tx_frame_datagrams(frame);
+        int count = total - queued->next_datagram;
+        const UdpDatagram *datagrams = frame->datagrams + queued->next_datagram;
+
+        // Paced: one burst at a time, so the other subscribers are not held up
+        if (sub->sender.pacing_rate_bps) {
+            size_t bytes = 0;
+            int burst = 0;
+            while (burst < count) {
+                size_t length = udp_datagram_length(&datagrams[burst]);
+                if (burst > 0 && bytes + length > udp_sender_burst_bytes(&sub->sender)) {
+                    break;
+                }
+                bytes += length;
+                burst++;
+            }
+            count = burst;
+        }
+
+        // Failed sends are not retried; the client NACKs what it misses
+        int sent = udp_sender_send(&sub->sender, &sub->video_addr, datagrams, count);
+        if (sent > 0) {
+            sub->chunks_sent += sent;
+        }
+
+        queued->next_datagram += count;
+        if (queued->next_datagram >= total) {
+            sub->frames_sent++;
+            sub->last_sent_frame_id = frame->frame_id;
+            pop_queued(sub);
+        }
+        now_ns = monotonic_ns();
+    }
+
+    return 0;
+}
+
+// Log a subscriber's new chunk datagram size
+static void print_datagram_size(const Subscriber *sub) {
+    printf("Subscriber %s:%u: %zu byte datagrams (path MTU %zu)\n",
+           inet_ntoa(sub->control_addr.sin_addr), ntohs(sub->control_addr.sin_port),
+           sub->mtu.datagram_size, sub->mtu.datagram_size + PATH_MTU_IP_UDP_OVERHEAD);
+}
+
+// Send the path MTU probes that are due. Probes are not paced: there is
+// one per subscriber every PATH_MTU_PROBE_INTERVAL_MS at most.
+static void send_probes(SubscriberTable *table, uint64_t now_ns) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        Subscriber *sub = &table->subscribers[i];
+        if (sub->active && path_mtu_poll(&sub->mtu, now_ns)) {
+            print_datagram_size(sub);
+        }
+    }
+}
+
+// Send whatever the subscribers' pacing allows right now
+uint64_t subscribers_pump(SubscriberTable *table, FrameTx *tx, uint64_t now_ns) {
+    send_probes(table, now_ns);
+
+    if (table->multicast) {
+        return table->group.queue_count > 0 ? pump_subscriber(table, &table->group, tx, now_ns) : 0;
+    }
+
+    uint64_t next_ns = 0;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        Subscriber *sub = &table->subscribers[i];
+        if (!sub->active || sub->queue_count == 0) {
+            continue;
+        }
+
+        uint64_t resume_ns = pump_subscriber(table, sub, tx, now_ns);
+        if (resume_ns && (!next_ns || resume_ns < next_ns)) {
+            next_ns = resume_ns;
+        }
+    }
+    return next_ns;
+}
+
+// Datagrams of a frame a sender has handed to the kernel so far: all of
+// them once it has left the send queue
+static int datagrams_sent(const Subscriber *sender, uint32_t frame_id) {
+    for (int i = 0; i < sender->queue_count; i++) {
+        const QueuedFrame *queued = &sender->queue[(sender->queue_head + i) % FRAME_TX_MAX_CACHE];
+        if (queued->frame_id == frame_id) {
+            return queued->next_datagram;
+        }
+    }
+    return INT_MAX;
+}
+
+// Resend what a subscriber NACKed. Chunks still waiting behind the pacing
+// are dropped from the request: they are on their way, and resending them
+// early would only send them twice.
+void subscribers_nack(SubscriberTable *table, FrameTx *tx, const struct sockaddr_in *from,
+                      const NackMessage *nack, size_t length) {
+    Subscriber *sub = find_subscriber(table, from);
+    if (!sub) {
+        return;
+    }
+
+    // In multicast mode the group sent the frame
+    int sent = datagrams_sent(table->multicast ? &table->group : sub, nack->frame_id);
+    if (sent <= (int64_t)nack->base_chunk) {
+        return;
+    }
+
+    NackMessage due = *nack;
+    for (int64_t bit = sent - (int64_t)nack->base_chunk; bit < NACK_MAX_CHUNKS; bit++) {
+        due.bitmap[bit / 8] &= (uint8_t)~(1u << (bit % 8));
+    }
+    sub->retransmit_count += frame_tx_nack(tx, &sub->sender, &sub->video_addr, &due, length);
+}
+
+// Feed a receiver report to its subscriber's rate controller
+bool subscribers_report(SubscriberTable *table, const struct sockaddr_in *from,
+                        const ReceiverReport *report, uint64_t now_ns) {
+    Subscriber *sub = find_subscriber(table, from);
+    if (!sub) {
+        return false;
+    }
+    if (path_mtu_report(&sub->mtu, report, now_ns)) {
+        print_datagram_size(sub);
+    }
+
+    // In multicast mode frames reach the viewer through the group
+    uint32_t sent_frame_id = table->multicast ? table->group.last_sent_frame_id : sub->last_sent_frame_id;
+    uint64_t before = sub->rate.target_bps;
+    return rate_control_update(&sub->rate, report, sent_frame_id, now_ns) != before;
+}
+
+// Lowest target among subscribers that have reported (0 = none has)
+uint64_t subscribers_target_bitrate(const SubscriberTable *table) {
+    uint64_t target = 0;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        const Subscriber *sub = &table->subscribers[i];
+        if (sub->active && sub->rate.reports > 0 && (!target || sub->rate.target_bps < target)) {
+            target = sub->rate.target_bps;
+        }
+    }
+    return target;
+}
+
+// Smallest confirmed path MTU among the subscribers
+size_t subscribers_datagram_size(const SubscriberTable *table) {
+    size_t size = 0;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        const Subscriber *sub = &table->subscribers[i];
+        if (sub->active && (!size || sub->mtu.datagram_size < size)) {
+            size = sub->mtu.datagram_size;
+        }
+    }
+    return size ? size : table->packet_size;
+}
+
+// One line of statistics per subscriber
+void subscribers_print(const SubscriberTable *table) {
+    printf("Subscribers (%d watching):\n", table->count);
+    if (table->multicast) {
+        const Subscriber *group = &table->group;
+        printf("  group %s:%u  frames=%llu skipped=%llu chunks=%llu syscalls=%llu\n",
+               inet_ntoa(group->video_addr.sin_addr), ntohs(group->video_addr.sin_port),
+               (unsigned long long)group->frames_sent, (unsigned long long)group->frames_skipped,
+               (unsigned long long)group->chunks_sent, (unsigned long long)group->sender.syscalls);
+    }
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        const Subscriber *sub = &table->subscribers[i];
+        if (!sub->active) {
+            continue;
+        }
+        printf("  %s:%u  frames=%llu skipped=%llu chunks=%llu retransmitted=%llu syscalls=%llu\n",
+               inet_ntoa(sub->control_addr.sin_addr), ntohs(sub->control_addr.sin_port),
+               (unsigned long long)sub->frames_sent, (unsigned long long)sub->frames_skipped,
+               (unsigned long long)sub->chunks_sent, (unsigned long long)sub->retransmit_count,
+               (unsigned long long)sub->sender.syscalls);
+        if (sub->rate.reports > 0) {
+            printf("    target %.0f kbit/s (received %u kbit/s), %s, queue delay %.1f ms, "
+                   "jitter %.1f ms, loss %.1f%%, %u backoffs\n",
+                   sub->rate.target_bps / 1e3, sub->rate.receive_rate_kbps,
+                   rate_control_usage_name(sub->rate.usage), sub->rate.queue_delay_us / 1e3,
+                   sub->rate.jitter_us / 1e3, sub->rate.fraction_lost * 100.0, sub->rate.backoffs);
+        }
+        printf("    %zu byte datagrams, %u path MTU probes, %u black holes\n",
+               sub->mtu.datagram_size, sub->mtu.probes_sent, sub->mtu.blackholes);
+    }
+}
+
+// Close every subscriber socket
+void subscribers_free(SubscriberTable *table) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (table->subscribers[i].active) {
+            remove_subscriber(table, &table->subscribers[i]);
+        }
+    }
+    if (table->group.socket >= 0) close(table->group.socket);
+    table->group.socket = -1;
+    table->group.active = false;
+    table->multicast = false;
+}
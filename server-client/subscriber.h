@@ -0,0 +1,155 @@
+#ifndef SUBSCRIBER_H
+#define SUBSCRIBER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "udp_batch.h"
+#include "frame_tx.h"
+#include "rate_control.h"
+#include "path_mtu.h"
+
+// Fan-out of one stream to several viewers. Every frame is chunked once by
+// FrameTx; a subscriber only queues frame ids and its position within the
+// current frame, and sends the shared datagrams through its own socket. A
+// viewer therefore costs syscalls, not encoding or copies. Each subscriber
+// is paced on its own and, when it falls behind the retransmit cache,
+// skips ahead to the next keyframe instead of holding the others up.
+//
+// In multicast mode the table's `group` entry is the only one that queues
+// frames: every frame goes out once to the group address. Viewers are still
+// tracked from their control messages, and their NACKs are answered unicast
+// through their own sockets so one lossy viewer does not cost the rest.
+//
+// Every subscriber runs its own rate controller on its receiver reports.
+// There is one encoder, so the stream follows the slowest viewer. Likewise
+// each subscriber discovers its path MTU (path_mtu.h) and frames are
+// chunked once, for the smallest of them.
+//
+// Each subscriber's sender is a token bucket re-rated per frame: a frame is
+// spread over the share of its frame interval it is given on enqueue, and
+// never sent slower than SUBSCRIBER_PACING_FACTOR times the viewer's rate
+// target, so small frames and retransmissions are not held back.
+
+#define MAX_SUBSCRIBERS 8                 // Viewers served at once
+#define SUBSCRIBER_TIMEOUT_MS 3000        // Dropped after this long without a control message
+#define SUBSCRIBER_PACING_FACTOR 2.5      // Pace at least this multiple of the rate target
+
+// A frame in a subscriber's send queue
+typedef struct {
+    uint32_t frame_id;
+    int next_datagram;                    // First datagram not yet sent
+    uint64_t spread_ns;                   // Time to spread the frame over (0 = table ceiling only)
+} QueuedFrame;
+
+typedef struct {
+    bool active;
+    struct sockaddr_in control_addr;      // Source of its control messages (matches NACKs)
+    struct sockaddr_in video_addr;        // Same host, the table's video port
+    int socket;                           // Own socket: kernel pacing and buffering per viewer
+    UdpSender sender;
+    uint64_t last_seen_ns;
+
+    // Send queue, oldest first
+    QueuedFrame queue[FRAME_TX_MAX_CACHE];
+    int queue_head;
+    int queue_count;
+    bool waiting_for_keyframe;            // Fell behind: resume at the next keyframe
+
+    // Statistics
+    uint64_t frames_sent;
+    uint32_t last_sent_frame_id;          // Newest frame sent in full (0 = none)
+    uint64_t frames_skipped;
+    uint64_t chunks_sent;
+    uint64_t retransmit_count;
+
+    // Congestion control from this viewer's receiver reports
+    RateControl rate;
+
+    // Largest datagram that reaches this viewer
+    PathMtu mtu;
+} Subscriber;
+
+typedef struct {
+    Subscriber subscribers[MAX_SUBSCRIBERS];
+    int count;
+    bool multicast;                       // Frames go to `group` instead of each subscriber
+    Subscriber group;                     // The multicast destination, never expires
+    uint16_t video_port;                  // Where viewers receive the stream
+    size_t packet_size;                   // Chunk datagram size before path MTU discovery
+    uint64_t pacing_rate_bps;             // Pacing ceiling per subscriber (0 = none)
+    bool txtime;                          // Stamp paced bursts with SO_TXTIME
+    int send_buffer_size;                 // SO_SNDBUF of each subscriber socket (0 = kernel default)
+    uint64_t min_bitrate_bps;             // Range of each subscriber's rate controller
+    uint64_t max_bitrate_bps;
+} SubscriberTable;
+
+static inline bool subscriber_addr_equal(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+// Set up an empty table for viewers receiving on `video_port`, chunked at
+// `packet_size` until their path MTU is known
+void subscribers_init(SubscriberTable *table, uint16_t video_port, size_t packet_size,
+                      uint64_t pacing_rate_bps, int send_buffer_size);
+
+// Bounds for the rate controllers of subscribers that join from now on
+void subscribers_set_bitrate_range(SubscriberTable *table, uint64_t min_bps, uint64_t max_bps);
+
+// Leave the spacing of paced bursts to the qdisc (SO_TXTIME) for
+// subscribers that join from now on
+void subscribers_enable_txtime(SubscriberTable *table);
+
+// Publish frames to a multicast group instead of each subscriber.
+// `interface_ip` selects the outgoing interface ("0.0.0.0" = default route).
+bool subscribers_enable_multicast(SubscriberTable *table, const char *group_ip, uint16_t port,
+                                  int ttl, const char *interface_ip);
+
+// Note a control message from `control_addr`, adding the subscriber if it is new.
+// Returns NULL when the table is full.
+Subscriber *subscribers_touch(SubscriberTable *table, const struct sockaddr_in *control_addr, uint64_t now_ns);
+
+// Drop subscribers that have gone quiet
+void subscribers_expire(SubscriberTable *table, uint64_t now_ns);
+
+// Queue a prepared frame for every subscriber (or once for the multicast
+// group), to be paced out over `spread_ns` (0 = at the ceiling, if any)
+void subscribers_enqueue(SubscriberTable *table, const TxFrame *frame, bool keyframe, uint64_t spread_ns);
+
+// Longest a subscriber takes to send a frame of `bytes` on the wire
+// enqueued with `spread_ns`: the spread, or longer under the ceiling
+uint64_t subscribers_pacing_span(const SubscriberTable *table, size_t bytes, uint64_t spread_ns);
+
+// Send whatever the subscribers' pacing allows right now, and any path MTU
+// probes due. Returns when the next paced subscriber may continue, or 0
+// when every queue is empty.
+uint64_t subscribers_pump(SubscriberTable *table, FrameTx *tx, uint64_t now_ns);
+
+// Resend what a subscriber NACKed, as far as it has been sent to it; NACKs
+// from unknown addresses are ignored
+void subscribers_nack(SubscriberTable *table, FrameTx *tx, const struct sockaddr_in *from,
+                      const NackMessage *nack, size_t length);
+
+// Feed a receiver report to its subscriber's rate controller and path MTU
+// search; reports from unknown addresses are ignored. Returns true if the target changed.
+bool subscribers_report(SubscriberTable *table, const struct sockaddr_in *from,
+                        const ReceiverReport *report, uint64_t now_ns);
+
+// Bitrate every subscriber can take: the lowest target among those that
+// have reported, or 0 when none has
+uint64_t subscribers_target_bitrate(const SubscriberTable *table);
+
+// Chunk datagram size every subscriber can take: the smallest confirmed
+// path MTU, or the table's packet_size when nobody is watching
+size_t subscribers_datagram_size(const SubscriberTable *table);
+
+// One line of statistics per subscriber
+void subscribers_print(const SubscriberTable *table);
+
+// Close every subscriber socket
+void subscribers_free(SubscriberTable *table);
+
+#endif /* SUBSCRIBER_H */
@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile_delta.h"
+#include "wire.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TILE_X86 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define TILE_NEON 1
+#endif
+
+// Sum of absolute differences of two byte runs
+static inline uint32_t sad_scalar(const uint8_t *a, const uint8_t *b, size_t len) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += (uint32_t)(a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]);
+    }
+    return sum;
+}
+
+// Row kernels: add the SAD of each `segment` bytes of a row (the last one
+// may be shorter) to consecutive entries of `sums`, one per tile column
+
+static void sad_row_scalar(const uint8_t *a, const uint8_t *b, size_t len, size_t segment,
+                           uint32_t *sums) {
+    for (size_t start = 0; start < len; start += segment, sums++) {
+        size_t n = len - start < segment ? len - start : segment;
+        *sums += sad_scalar(a + start, b + start, n);
+    }
+}
+
+#ifdef TILE_X86
+static inline uint32_t sad_sse2(const uint8_t *a, const uint8_t *b, size_t len) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(x, y));
+    }
+    uint32_t sum = (uint32_t)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+    return sum + sad_scalar(a + i, b + i, len - i);
+}
+
+static void sad_row_sse2(const uint8_t *a, const uint8_t *b, size_t len, size_t segment,
+                         uint32_t *sums) {
+    for (size_t start = 0; start < len; start += segment, sums++) {
+        size_t n = len - start < segment ? len - start : segment;
+        *sums += sad_sse2(a + start, b + start, n);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t sad_avx2(const uint8_t *a, const uint8_t *b, size_t len) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(x, y));
+    }
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    uint32_t sum = (uint32_t)(_mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_srli_si128(half, 8)));
+    return sum + sad_sse2(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void sad_row_avx2(const uint8_t *a, const uint8_t *b, size_t len, size_t segment,
+                         uint32_t *sums) {
+    for (size_t start = 0; start < len; start += segment, sums++) {
+        size_t n = len - start < segment ? len - start : segment;
+        *sums += sad_avx2(a + start, b + start, n);
+    }
+}
+#endif
+
+#ifdef TILE_NEON
+static inline uint32_t sad_neon(const uint8_t *a, const uint8_t *b, size_t len) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        acc = vpadalq_u16(acc, vpaddlq_u8(diff));
+    }
+    uint64x2_t pairs = vpaddlq_u32(acc);
+    uint32_t sum = (uint32_t)(vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1));
+    return sum + sad_scalar(a + i, b + i, len - i);
+}
+
+static void sad_row_neon(const uint8_t *a, const uint8_t *b, size_t len, size_t segment,
+                         uint32_t *sums) {
+    for (size_t start = 0; start < len; start += segment, sums++) {
+        size_t n = len - start < segment ? len - start : segment;
+        *sums += sad_neon(a + start, b + start, n);
+    }
+}
+#endif
+
+typedef void (*SadRowKernel)(const uint8_t *a, const uint8_t *b, size_t len, size_t segment,
+                             uint32_t *sums);
+
+static SadRowKernel sad_row_kernel = NULL;
+static const char *sad_row_kernel_name = "scalar";
+
+// Pick the widest difference kernel this CPU supports
+static void select_sad_kernel(void) {
+    sad_row_kernel = sad_row_scalar;
+#if defined(TILE_X86)
+    sad_row_kernel = sad_row_sse2;
+    sad_row_kernel_name = "sse2";
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        sad_row_kernel = sad_row_avx2;
+        sad_row_kernel_name = "avx2";
+    }
+#elif defined(TILE_NEON)
+    sad_row_kernel = sad_row_neon;
+    sad_row_kernel_name = "neon";
+#endif
+}
+
+// Name of the difference kernel selected for this CPU
+const char *tile_diff_backend(void) {
+    if (!sad_row_kernel) {
+        select_sad_kernel();
+    }
+    return sad_row_kernel_name;
+}
+
+static void set_plane(TilePlane *plane, size_t offset, size_t row_bytes, uint32_t rows,
+                      size_t tile_bytes, uint32_t tile_rows) {
+    plane->offset = offset;
+    plane->row_bytes = row_bytes;
+    plane->rows = rows;
+    plane->tile_bytes = tile_bytes;
+    plane->tile_rows = tile_rows;
+}
+
+// Work out the tile grid; false for a codec without one or a bad tile size
+bool tile_layout_init(TileLayout *layout, uint8_t codec, uint32_t width, uint32_t height,
+                      uint32_t tile_size) {
+    memset(layout, 0, sizeof(*layout));
+    if (tile_size < 2 || tile_size > UINT16_MAX || (tile_size & 1) || width == 0 || height == 0) {
+        return false;
+    }
+
+    layout->codec = codec;
+    layout->width = width;
+    layout->height = height;
+    layout->tile_size = tile_size;
+    layout->tiles_x = (width + tile_size - 1) / tile_size;
+    layout->tiles_y = (height + tile_size - 1) / tile_size;
+    layout->num_tiles = layout->tiles_x * layout->tiles_y;
+    layout->bitmap_bytes = (layout->num_tiles + 7) / 8;
+
+    if (codec == VIDEO_CODEC_RAW_RGB24) {
+        layout->num_planes = 1;
+        set_plane(&layout->planes[0], 0, (size_t)width * 3, height, (size_t)tile_size * 3, tile_size);
+    } else if (codec == VIDEO_CODEC_RAW_YUV420) {
+        // Chroma tiles are half the size, so the grid is the same in every plane
+        size_t luma = (size_t)width * height;
+        size_t chroma_width = (width + 1) / 2;
+        uint32_t chroma_height = (height + 1) / 2;
+        layout->num_planes = 3;
+        set_plane(&layout->planes[0], 0, width, height, tile_size, tile_size);
+        set_plane(&layout->planes[1], luma, chroma_width, chroma_height, tile_size / 2, tile_size / 2);
+        set_plane(&layout->planes[2], luma + chroma_width * chroma_height, chroma_width, chroma_height,
+                  tile_size / 2, tile_size / 2);
+    } else {
+        return false;
+    }
+
+    for (int p = 0; p < layout->num_planes; p++) {
+        layout->frame_size += layout->planes[p].row_bytes * layout->planes[p].rows;
+    }
+    return true;
+}
+
+// The part of a plane a tile covers: bytes [*x, *x + *w) of rows [*y, *y + *h)
+static void tile_extent(const TileLayout *layout, const TilePlane *plane, uint32_t tile,
+                        size_t *x, size_t *w, uint32_t *y, uint32_t *h) {
+    *x = (tile % layout->tiles_x) * plane->tile_bytes;
+    *y = (tile / layout->tiles_x) * plane->tile_rows;
+    *w = plane->row_bytes - *x < plane->tile_bytes ? plane->row_bytes - *x : plane->tile_bytes;
+    *h = plane->rows - *y < plane->tile_rows ? plane->rows - *y : plane->tile_rows;
+}
+
+// Bytes a tile takes in a delta payload (edge tiles are cut short)
+static size_t tile_bytes(const TileLayout *layout, uint32_t tile) {
+    size_t bytes = 0;
+    for (int p = 0; p < layout->num_planes; p++) {
+        size_t x, w;
+        uint32_t y, h;
+        tile_extent(layout, &layout->planes[p], tile, &x, &w, &y, &h);
+        bytes += w * h;
+    }
+    return bytes;
+}
+
+// Append one tile of `src` to `out` and copy it into `reference` in place
+static uint8_t *copy_tile_out(const TileLayout *layout, uint32_t tile, const uint8_t *src,
+                              uint8_t *reference, uint8_t *out) {
+    for (int p = 0; p < layout->num_planes; p++) {
+        const TilePlane *plane = &layout->planes[p];
+        size_t x, w;
+        uint32_t y, h;
+        tile_extent(layout, plane, tile, &x, &w, &y, &h);
+        for (uint32_t row = y; row < y + h; row++) {
+            size_t at = plane->offset + row * plane->row_bytes + x;
+            memcpy(out, src + at, w);
+            memcpy(reference + at, src + at, w);
+            out += w;
+        }
+    }
+    return out;
+}
+
+// Set the format and size of the frames to come
+bool tile_encoder_configure(TileEncoder *encoder, uint8_t codec, uint32_t width, uint32_t height,
+                            uint32_t tile_size, double threshold) {
+    encoder->threshold = threshold;
+    const TileLayout *current = &encoder->layout;
+    if (encoder->frame && current->codec == codec && current->width == width &&
+        current->height == height && current->tile_size == tile_size) {
+        return true;
+    }
+
+    TileLayout layout;
+    if (!tile_layout_init(&layout, codec, width, height, tile_size)) {
+        fprintf(stderr, "No tile grid of %u pixels for codec %d at %ux%u\n", tile_size, codec, width, height);
+        return false;
+    }
+
+    free(encoder->frame);
+    free(encoder->reference);
+    free(encoder->sad);
+    encoder->frame = (uint8_t *)malloc(layout.frame_size);
+    encoder->reference = (uint8_t *)malloc(layout.frame_size);
+    encoder->sad = (uint32_t *)malloc(layout.num_tiles * sizeof(uint32_t));
+    if (!encoder->frame || !encoder->reference || !encoder->sad) {
+        fprintf(stderr, "Failed to allocate tile delta buffers\n");
+        tile_encoder_free(encoder);
+        return false;
+    }
+
+    encoder->layout = layout;
+    encoder->have_reference = false;
+    return true;
+}
+
+// Difference of every tile against the reference
+static void compare_tiles(TileEncoder *encoder) {
+    const TileLayout *layout = &encoder->layout;
+    if (!sad_row_kernel) {
+        select_sad_kernel();
+    }
+
+    memset(encoder->sad, 0, layout->num_tiles * sizeof(uint32_t));
+    for (int p = 0; p < layout->num_planes; p++) {
+        const TilePlane *plane = &layout->planes[p];
+        for (uint32_t row = 0; row < plane->rows; row++) {
+            size_t at = plane->offset + row * plane->row_bytes;
+            sad_row_kernel(encoder->frame + at, encoder->reference + at, plane->row_bytes,
+                           plane->tile_bytes, encoder->sad + (row / plane->tile_rows) * layout->tiles_x);
+        }
+    }
+}
+
+// Build a delta payload in `out`; 0 when it would not be smaller than the frame
+static size_t encode_delta(TileEncoder *encoder, uint8_t *out) {
+    const TileLayout *layout = &encoder->layout;
+    compare_tiles(encoder);
+
+    // Pick the tiles and size the payload before copying anything
+    uint8_t *bitmap = out + TILE_DELTA_HEADER_SIZE;
+    memset(bitmap, 0, layout->bitmap_bytes);
+    size_t size = TILE_DELTA_HEADER_SIZE + layout->bitmap_bytes;
+    uint32_t changed = 0;
+    for (uint32_t tile = 0; tile < layout->num_tiles; tile++) {
+        size_t bytes = tile_bytes(layout, tile);
+        if ((double)encoder->sad[tile] > encoder->threshold * (double)bytes) {
+            bitmap[tile / 8] |= (uint8_t)(1u << (tile % 8));
+            size += bytes;
+            changed++;
+        }
+    }
+    if (size >= layout->frame_size) {
+        return 0;
+    }
+
+    TileDeltaHeader header = {
+        .tile_size = (uint16_t)layout->tile_size,
+        .tiles_changed = changed
+    };
+    wire_encode_tile_delta_header(out, &header);
+
+    // Sent tiles are what the receivers will hold from now on
+    uint8_t *data = bitmap + layout->bitmap_bytes;
+    for (uint32_t tile = 0; tile < layout->num_tiles; tile++) {
+        if (bitmap[tile / 8] & (1u << (tile % 8))) {
+            data = copy_tile_out(layout, tile, encoder->frame, encoder->reference, data);
+        }
+    }
+
+    encoder->tiles_sent += changed;
+    encoder->tiles_compared += layout->num_tiles;
+    return size;
+}
+
+// Encode the current frame as a delta or in full
+size_t tile_encoder_encode(TileEncoder *encoder, bool force_full, uint8_t *out, bool *delta) {
+    if (!force_full && encoder->have_reference) {
+        size_t size = encode_delta(encoder, out);
+        if (size > 0) {
+            encoder->delta_frames++;
+            encoder->frames_since_full++;
+            *delta = true;
+            return size;
+        }
+    }
+
+    // A full frame becomes the reference as it is
+    size_t size = encoder->layout.frame_size;
+    memcpy(out, encoder->frame, size);
+    uint8_t *reference = encoder->reference;
+    encoder->reference = encoder->frame;
+    encoder->frame = reference;
+    encoder->have_reference = true;
+    encoder->frames_since_full = 0;
+    encoder->full_frames++;
+    *delta = false;
+    return size;
+}
+
+void tile_encoder_free(TileEncoder *encoder) {
+    free(encoder->frame);
+    free(encoder->reference);
+    free(encoder->sad);
+    encoder->frame = NULL;
+    encoder->reference = NULL;
+    encoder->sad = NULL;
+    encoder->have_reference = false;
+}
+
+// Patch a delta payload into the full frame it was made against
+bool tile_delta_apply(uint8_t *frame, uint8_t codec, uint32_t width, uint32_t height,
+                      const uint8_t *payload, size_t size) {
+    TileDeltaHeader header;
+    if (size < TILE_DELTA_HEADER_SIZE || !wire_decode_tile_delta_header(payload, &header)) {
+        return false;
+    }
+
+    TileLayout layout;
+    if (!tile_layout_init(&layout, codec, width, height, header.tile_size) ||
+        size < TILE_DELTA_HEADER_SIZE + layout.bitmap_bytes) {
+        return false;
+    }
+
+    // The bitmap must account for every byte that follows it
+    const uint8_t *bitmap = payload + TILE_DELTA_HEADER_SIZE;
+    size_t expected = TILE_DELTA_HEADER_SIZE + layout.bitmap_bytes;
+    uint32_t changed = 0;
+    for (uint32_t tile = 0; tile < layout.num_tiles; tile++) {
+        if (bitmap[tile / 8] & (1u << (tile % 8))) {
+            expected += tile_bytes(&layout, tile);
+            changed++;
+        }
+    }
+    if (changed != header.tiles_changed || expected != size) {
+        return false;
+    }
+
+    const uint8_t *data = bitmap + layout.bitmap_bytes;
+    for (uint32_t tile = 0; tile < layout.num_tiles; tile++) {
+        if (!(bitmap[tile / 8] & (1u << (tile % 8)))) {
+            continue;
+        }
+        for (int p = 0; p < layout.num_planes; p++) {
+            const TilePlane *plane = &layout.planes[p];
+            size_t x, w;
+            uint32_t y, h;
+            tile_extent(&layout, plane, tile, &x, &w, &y, &h);
+            for (uint32_t row = y; row < y + h; row++) {
+                memcpy(frame + plane->offset + row * plane->row_bytes + x, data, w);
+                data += w;
+            }
+        }
+    }
+    return true;
+}
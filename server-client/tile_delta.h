@@ -0,0 +1,98 @@
+#ifndef TILE_DELTA_H
+#define TILE_DELTA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+
+// Tile deltas for the raw transports (RGB24, YUV 4:2:0). The frame is cut
+// into square tiles of luma pixels; a tile covers the matching rectangle
+// of every plane. The sender compares each tile with what the receivers
+// hold (sum of absolute differences, SIMD where available) and sends only
+// the tiles that changed as a delta frame:
+//
+//   TileDeltaHeader (wire.h) | bitmap, one bit per tile | changed tiles' bytes
+//
+// Tiles are numbered row-major, bit i of the bitmap is byte i / 8, bit
+// i % 8. Each tile's bytes run plane by plane, row by row. A delta only
+// applies on top of the frame sent right before it; anything else needs
+// a full frame (a keyframe) first.
+
+#define TILE_DELTA_MAX_PLANES 3
+
+// Where one plane of a packed raw frame lies, and its share of a tile
+typedef struct {
+    size_t offset;                    // First byte of the plane in the frame
+    size_t row_bytes;                 // Bytes per row
+    uint32_t rows;
+    size_t tile_bytes;                // Bytes of one tile row in this plane
+    uint32_t tile_rows;               // Rows of one tile in this plane
+} TilePlane;
+
+// Tile grid of one raw format and size
+typedef struct {
+    uint8_t codec;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_size;               // Tile edge in luma pixels (even)
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint32_t num_tiles;
+    size_t frame_size;                // Bytes of a full frame
+    size_t bitmap_bytes;
+    int num_planes;
+    TilePlane planes[TILE_DELTA_MAX_PLANES];
+} TileLayout;
+
+// Sender side: the next frame is scaled into `frame`, then encoded against
+// `reference`, the receivers' copy
+typedef struct {
+    TileLayout layout;
+    double threshold;                 // A tile is resent when its mean |difference| per byte exceeds this
+    uint8_t *frame;                   // Current frame, written by the caller
+    uint8_t *reference;               // What the receivers hold
+    bool have_reference;
+    uint32_t *sad;                    // Per tile, for the current frame
+    uint32_t frames_since_full;
+
+    // Statistics
+    uint64_t full_frames;
+    uint64_t delta_frames;
+    uint64_t tiles_sent;              // In delta frames
+    uint64_t tiles_compared;
+} TileEncoder;
+
+// Work out the tile grid; false for a codec without one or a bad tile size
+bool tile_layout_init(TileLayout *layout, uint8_t codec, uint32_t width, uint32_t height,
+                      uint32_t tile_size);
+
+// Largest payload encoding a frame of this layout can produce
+static inline size_t tile_delta_max_size(const TileLayout *layout) {
+    return TILE_DELTA_HEADER_SIZE + layout->bitmap_bytes + layout->frame_size;
+}
+
+// Set the format and size of the frames to come. Buffers are (re)allocated
+// and the reference dropped when either changes, so the next frame is full.
+bool tile_encoder_configure(TileEncoder *encoder, uint8_t codec, uint32_t width, uint32_t height,
+                            uint32_t tile_size, double threshold);
+
+// Encode `frame` into `out` (tile_delta_max_size() bytes) and make it the
+// receivers' copy. Sends the whole frame when forced, when there is no
+// reference yet, or when the delta would be no smaller. Returns the payload
+// size; `*delta` tells which of the two it is.
+size_t tile_encoder_encode(TileEncoder *encoder, bool force_full, uint8_t *out, bool *delta);
+
+void tile_encoder_free(TileEncoder *encoder);
+
+// Receiver side: patch a delta payload into `frame`, the full frame it was
+// made against. Returns false (leaving `frame` untouched) when the payload
+// does not match the format and size.
+bool tile_delta_apply(uint8_t *frame, uint8_t codec, uint32_t width, uint32_t height,
+                      const uint8_t *payload, size_t size);
+
+// Name of the difference kernel selected for this CPU
+const char *tile_diff_backend(void);
+
+#endif /* TILE_DELTA_H */
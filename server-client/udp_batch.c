@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <linux/net_tstamp.h>
+#endif
+
+#include "udp_batch.h"
+
+#ifdef __linux__
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103               // linux/udp.h, missing from older libc headers
+#endif
+#ifndef SO_TXTIME
+#define SO_TXTIME 61                  // asm-generic/socket.h, Linux 4.19
+#define SCM_TXTIME SO_TXTIME
+#endif
+#endif
+
+// A run of datagrams is handed to the kernel as one flat iovec array
+_Static_assert(sizeof(UdpDatagram) == 2 * sizeof(struct iovec), "UdpDatagram must be two packed iovecs");
+
+// Monotonic clock in nanoseconds
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Mark a socket's datagrams with a DSCP
+void udp_set_dscp(int socket, int dscp) {
+    if (dscp <= 0) {
+        return;
+    }
+
+    // DSCP is the upper six bits of the TOS byte
+    int tos = dscp << 2;
+    if (setsockopt(socket, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0) {
+        perror("Failed to set IP_TOS");
+    }
+
+#ifdef __linux__
+    // The default pfifo_fast/fq qdiscs pick their band from the socket priority,
+    // not the TOS byte; 6 (interactive) is the highest without CAP_NET_ADMIN
+    int priority = 6;
+    setsockopt(socket, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+#endif
+}
+
+// Sleep until an absolute monotonic deadline
+static void sleep_until_ns(uint64_t deadline_ns) {
+#ifdef __linux__
+    struct timespec ts = {
+        .tv_sec = deadline_ns / 1000000000ull,
+        .tv_nsec = deadline_ns % 1000000000ull
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+#else
+    uint64_t now = monotonic_ns();
+    if (deadline_ns > now) {
+        uint64_t delta = deadline_ns - now;
+        struct timespec ts = { .tv_sec = delta / 1000000000ull, .tv_nsec = delta % 1000000000ull };
+        nanosleep(&ts, NULL);
+    }
+#endif
+}
+
+// Bucket depth at `rate_bps`: UDP_PACING_BURST_US of wire time
+static size_t pacing_burst_bytes(uint64_t rate_bps) {
+    uint64_t bytes = rate_bps / 8 * UDP_PACING_BURST_US / 1000000;
+    if (bytes < UDP_PACING_MIN_BURST) return UDP_PACING_MIN_BURST;
+    if (bytes > UDP_PACING_BURST_BYTES) return UDP_PACING_BURST_BYTES;
+    return (size_t)bytes;
+}
+
+// Credit the bucket for the time since the last refill, up to its depth
+static void refill_tokens(UdpSender *sender, uint64_t now) {
+    if (now <= sender->refill_ns) {
+        return;
+    }
+
+    sender->tokens += (double)(now - sender->refill_ns) * sender->pacing_rate_bps / 8e9;
+    if (sender->tokens > (double)sender->burst_bytes) {
+        sender->tokens = (double)sender->burst_bytes;
+    }
+    sender->refill_ns = now;
+}
+
+// When the bucket is out of debt and the next burst may leave
+static uint64_t departure_ns(UdpSender *sender, uint64_t now) {
+    refill_tokens(sender, now);
+    if (sender->tokens >= 0.0) {
+        return now;
+    }
+    return sender->refill_ns + (uint64_t)(-sender->tokens * 8e9 / sender->pacing_rate_bps);
+}
+
+// Wait for the bucket before releasing a burst. Returns the departure time
+// to stamp on it with SO_TXTIME (0 = unpaced).
+static uint64_t pace_before_burst(UdpSender *sender) {
+    if (sender->pacing_rate_bps == 0) {
+        return 0;
+    }
+
+    uint64_t now = monotonic_ns();
+    uint64_t departure = departure_ns(sender, now);
+    if (departure > now && !sender->use_txtime) {
+        sleep_until_ns(departure);
+        refill_tokens(sender, departure);
+    }
+    return departure;
+}
+
+// Take the burst just sent out of the bucket
+static void pace_after_burst(UdpSender *sender, size_t bytes) {
+    if (sender->pacing_rate_bps == 0) {
+        return;
+    }
+    sender->tokens -= (double)bytes;
+}
+
+// Change the pacing rate, keeping the credit earned at the old one
+void udp_sender_set_rate(UdpSender *sender, uint64_t pacing_rate_bps) {
+    if (pacing_rate_bps == sender->pacing_rate_bps) {
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    if (sender->pacing_rate_bps) {
+        refill_tokens(sender, now);
+    } else {
+        // Coming out of unpaced mode with a full bucket
+        sender->tokens = (double)pacing_burst_bytes(pacing_rate_bps);
+        sender->refill_ns = now;
+    }
+
+    sender->pacing_rate_bps = pacing_rate_bps;
+    sender->burst_bytes = pacing_burst_bytes(pacing_rate_bps);
+    if (sender->tokens > (double)sender->burst_bytes) {
+        sender->tokens = (double)sender->burst_bytes;
+    }
+
+#ifdef __linux__
+    // Let the fq qdisc pace at packet granularity when it is installed
+    unsigned int rate_bytes = (pacing_rate_bps == 0 || pacing_rate_bps / 8 > 0xffffffffull)
+                            ? 0xffffffffu : (unsigned int)(pacing_rate_bps / 8);
+    setsockopt(sender->socket, SOL_SOCKET, SO_MAX_PACING_RATE, &rate_bytes, sizeof(rate_bytes));
+#endif
+}
+
+// Have the kernel hold paced bursts until their departure time
+bool udp_sender_enable_txtime(UdpSender *sender) {
+#ifdef __linux__
+    // fq only takes CLOCK_MONOTONIC departure times
+    struct sock_txtime txtime = { .clockid = CLOCK_MONOTONIC, .flags = 0 };
+    if (setsockopt(sender->socket, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == 0) {
+        sender->use_txtime = true;
+        printf("UDP pacing: SO_TXTIME on, bursts handed to the qdisc %d us ahead\n", UDP_TXTIME_LEAD_US);
+        return true;
+    }
+    perror("SO_TXTIME unavailable, pacing in user space");
+#endif
+    return false;
+}
+
+// When the next burst may be handed over without sleeping
+uint64_t udp_sender_next_send_ns(UdpSender *sender, uint64_t now_ns) {
+    if (sender->pacing_rate_bps == 0) {
+        return now_ns;
+    }
+
+    uint64_t departure = departure_ns(sender, now_ns);
+    if (sender->use_txtime) {
+        // The qdisc waits for us
+        uint64_t lead = UDP_TXTIME_LEAD_US * 1000ull;
+        return departure > now_ns + lead ? departure - lead : now_ns;
+    }
+    return departure;
+}
+
+// Tighten the calling thread's timer slack for paced bursts
+void udp_pacing_thread_init(void) {
+#ifdef __linux__
+    if (prctl(PR_SET_TIMERSLACK, UDP_TIMER_SLACK_NS) != 0) {
+        perror("Failed to set timer slack");
+    }
+#endif
+}
+
+// Probe kernel support and set up pacing for an already created socket
+bool udp_sender_init(UdpSender *sender, int socket, uint64_t pacing_rate_bps) {
+    memset(sender, 0, sizeof(*sender));
+    sender->socket = socket;
+
+#ifdef __linux__
+    sender->use_mmsg = true;
+
+    // UDP_SEGMENT is readable on every kernel that accepts it as a cmsg
+    int gso_size = 0;
+    socklen_t opt_len = sizeof(gso_size);
+    sender->use_gso = getsockopt(socket, SOL_UDP, UDP_SEGMENT, &gso_size, &opt_len) == 0;
+#endif
+
+    if (pacing_rate_bps > 0) {
+        udp_sender_set_rate(sender, pacing_rate_bps);
+    }
+
+    printf("Batched UDP sender: sendmmsg=%s, GSO=%s, pacing=%s\n",
+           sender->use_mmsg ? "yes" : "no",
+           sender->use_gso ? "yes" : "no",
+           pacing_rate_bps ? "on" : "off");
+    return true;
+}
+
+#ifdef __linux__
+// Send one burst with sendmmsg(), coalescing runs of equal sized datagrams
+// into GSO super-datagrams when enabled. Returns datagrams sent or -1.
+static int send_burst_mmsg(UdpSender *sender, const struct sockaddr_in *dst,
+                           const UdpDatagram *datagrams, size_t count) {
+    struct mmsghdr msgs[UDP_BATCH_MAX_MSGS];
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr align;
+    } control[UDP_BATCH_MAX_MSGS];
+    size_t segments[UDP_BATCH_MAX_MSGS];
+    size_t num_msgs = 0;
+    size_t used = 0;
+    size_t burst_bytes = 0;
+    size_t burst_limit = udp_sender_burst_bytes(sender);
+
+    memset(msgs, 0, sizeof(msgs));
+
+    // The whole burst leaves at once: now, or at its stamped departure time
+    uint64_t departure = pace_before_burst(sender);
+    bool stamp = sender->use_txtime && departure != 0;
+
+    while (used < count && num_msgs < UDP_BATCH_MAX_MSGS) {
+        size_t seg_size = udp_datagram_length(&datagrams[used]);
+        size_t num_segs = 1;
+        size_t bytes = seg_size;
+
+        // All segments share seg_size except an optional shorter last one
+        if (sender->use_gso && seg_size > 0) {
+            size_t max_segs = UDP_GSO_MAX_BYTES / seg_size;
+            if (max_segs > UDP_GSO_MAX_SEGMENTS) max_segs = UDP_GSO_MAX_SEGMENTS;
+            if (sender->pacing_rate_bps && max_segs > burst_limit / seg_size) {
+                max_segs = burst_limit / seg_size > 0 ? burst_limit / seg_size : 1;
+            }
+
+            while (used + num_segs < count && num_segs < max_segs) {
+                size_t len = udp_datagram_length(&datagrams[used + num_segs]);
+                if (len > seg_size || len == 0) break;
+                num_segs++;
+                bytes += len;
+                if (len < seg_size) break;
+            }
+        }
+
+        if (num_msgs > 0 && burst_bytes + bytes > burst_limit) {
+            break;
+        }
+
+        struct msghdr *hdr = &msgs[num_msgs].msg_hdr;
+        hdr->msg_name = (void *)dst;
+        hdr->msg_namelen = sizeof(*dst);
+        hdr->msg_iov = (struct iovec *)datagrams[used].iov;
+        hdr->msg_iovlen = num_segs * 2;
+
+        size_t control_len = (num_segs > 1 ? CMSG_SPACE(sizeof(uint16_t)) : 0)
+                           + (stamp ? CMSG_SPACE(sizeof(uint64_t)) : 0);
+        if (control_len > 0) {
+            memset(control[num_msgs].buf, 0, control_len);
+            hdr->msg_control = control[num_msgs].buf;
+            hdr->msg_controllen = control_len;
+
+            struct cmsghdr *cm = CMSG_FIRSTHDR(hdr);
+            if (num_segs > 1) {
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t gso_size = (uint16_t)seg_size;
+                memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+                cm = CMSG_NXTHDR(hdr, cm);
+            }
+
+            if (stamp) {
+                cm->cmsg_level = SOL_SOCKET;
+                cm->cmsg_type = SCM_TXTIME;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+                memcpy(CMSG_DATA(cm), &departure, sizeof(departure));
+            }
+        }
+
+        segments[num_msgs] = num_segs;
+        used += num_segs;
+        burst_bytes += bytes;
+        num_msgs++;
+    }
+
+    int sent_msgs = sendmmsg(sender->socket, msgs, num_msgs, 0);
+    sender->syscalls++;
+    if (sent_msgs <= 0) {
+        if (sent_msgs == 0) errno = EAGAIN;
+        return -1;
+    }
+
+    size_t sent_dgrams = 0;
+    size_t sent_bytes = 0;
+    for (int i = 0; i < sent_msgs; i++) {
+        sent_dgrams += segments[i];
+        sent_bytes += msgs[i].msg_len;
+    }
+
+    pace_after_burst(sender, sent_bytes);
+    return (int)sent_dgrams;
+}
+#endif
+
+// Send a single datagram with sendmsg()
+static int send_single(UdpSender *sender, const struct sockaddr_in *dst,
+                       const UdpDatagram *datagram) {
+    pace_before_burst(sender);
+
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = (void *)dst;
+    hdr.msg_namelen = sizeof(*dst);
+    hdr.msg_iov = (struct iovec *)datagram->iov;
+    hdr.msg_iovlen = 2;
+
+    ssize_t ret = sendmsg(sender->socket, &hdr, 0);
+    sender->syscalls++;
+    if (ret < 0) {
+        return -1;
+    }
+
+    pace_after_burst(sender, (size_t)ret);
+    return 1;
+}
+
+// Send `count` datagrams to `dst`, batching as far as the kernel allows
+int udp_sender_send(UdpSender *sender, const struct sockaddr_in *dst,
+                    const UdpDatagram *datagrams, size_t count) {
+    size_t sent = 0;
+
+    while (sent < count) {
+        int ret;
+#ifdef __linux__
+        if (sender->use_mmsg) {
+            ret = send_burst_mmsg(sender, dst, datagrams + sent, count - sent);
+        } else
+#endif
+        {
+            ret = send_single(sender, dst, &datagrams[sent]);
+        }
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // Devices without checksum offload reject GSO at send time
+            if (sender->use_gso &&
+                (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+                fprintf(stderr, "UDP GSO rejected (%s), falling back to sendmmsg\n", strerror(errno));
+                sender->use_gso = false;
+                continue;
+            }
+
+            if (sender->use_mmsg && errno == ENOSYS) {
+                fprintf(stderr, "sendmmsg unavailable, falling back to sendmsg\n");
+                sender->use_mmsg = false;
+                sender->use_txtime = false;       // sendmsg() bursts are not stamped
+                continue;
+            }
+
+            perror("Failed to send video datagrams");
+            return sent > 0 ? (int)sent : -1;
+        }
+
+        sent += ret;
+        sender->datagrams += ret;
+    }
+
+    return (int)sent;
+}
+
+// Allocate the slot ring for an already created (non-blocking) socket
+bool udp_receiver_init(UdpReceiver *receiver, int socket, size_t num_slots, size_t slot_size) {
+    memset(receiver, 0, sizeof(*receiver));
+    receiver->socket = socket;
+    receiver->num_slots = num_slots;
+    receiver->slot_size = slot_size;
+
+    receiver->slots = (uint8_t *)malloc(num_slots * slot_size);
+    receiver->iov = (struct iovec *)calloc(num_slots, sizeof(struct iovec));
+    receiver->lengths = (size_t *)calloc(num_slots, sizeof(size_t));
+    if (!receiver->slots || !receiver->iov || !receiver->lengths) {
+        fprintf(stderr, "Failed to allocate receive slots\n");
+        udp_receiver_free(receiver);
+        return false;
+    }
+
+    for (size_t i = 0; i < num_slots; i++) {
+        receiver->iov[i].iov_base = receiver->slots + i * slot_size;
+        receiver->iov[i].iov_len = slot_size;
+    }
+
+#ifdef __linux__
+    // Headers point at fixed slots, so they are built once and reused
+    struct mmsghdr *msgs = (struct mmsghdr *)calloc(num_slots, sizeof(struct mmsghdr));
+    if (!msgs) {
+        fprintf(stderr, "Failed to allocate receive headers\n");
+        udp_receiver_free(receiver);
+        return false;
+    }
+
+    for (size_t i = 0; i < num_slots; i++) {
+        msgs[i].msg_hdr.msg_iov = &receiver->iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    receiver->msgs = msgs;
+    receiver->use_mmsg = true;
+#endif
+
+    printf("Batched UDP receiver: recvmmsg=%s, %zu slots of %zu bytes\n",
+           receiver->use_mmsg ? "yes" : "no", num_slots, slot_size);
+    return true;
+}
+
+// Pull up to num_slots pending datagrams into slots 0..n-1
+int udp_receiver_recv(UdpReceiver *receiver) {
+#ifdef __linux__
+    if (receiver->use_mmsg) {
+        struct mmsghdr *msgs = (struct mmsghdr *)receiver->msgs;
+
+        int count = recvmmsg(receiver->socket, msgs, receiver->num_slots, MSG_DONTWAIT, NULL);
+        receiver->syscalls++;
+        if (count < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 0;
+            }
+            if (errno == ENOSYS) {
+                fprintf(stderr, "recvmmsg unavailable, falling back to recvfrom\n");
+                receiver->use_mmsg = false;
+                return udp_receiver_recv(receiver);
+            }
+            return -1;
+        }
+
+        for (int i = 0; i < count; i++) {
+            receiver->lengths[i] = msgs[i].msg_len;
+        }
+
+        receiver->datagrams += count;
+        return count;
+    }
+#endif
+
+    // Portable path: drain with one recvfrom() per slot
+    size_t count = 0;
+    while (count < receiver->num_slots) {
+        ssize_t len = recvfrom(receiver->socket, receiver->iov[count].iov_base, receiver->slot_size,
+                               MSG_DONTWAIT, NULL, NULL);
+        receiver->syscalls++;
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+            return count > 0 ? (int)count : -1;
+        }
+        receiver->lengths[count++] = (size_t)len;
+    }
+
+    receiver->datagrams += count;
+    return (int)count;
+}
+
+// Release the slot ring
+void udp_receiver_free(UdpReceiver *receiver) {
+    free(receiver->slots);
+    free(receiver->iov);
+    free(receiver->lengths);
+    free(receiver->msgs);
+    receiver->slots = NULL;
+    receiver->iov = NULL;
+    receiver->lengths = NULL;
+    receiver->msgs = NULL;
+}
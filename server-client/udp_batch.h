@@ -0,0 +1,124 @@
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+// Batch limits
+#define UDP_BATCH_MAX_MSGS 64         // Messages handed to one sendmmsg() call
+#define UDP_GSO_MAX_SEGMENTS 64       // Kernel limit on segments per GSO super-datagram
+#define UDP_GSO_MAX_BYTES 65000       // Keep GSO super-datagrams below the 64 KB IP limit
+#define UDP_PACING_BURST_BYTES 65536  // Largest burst released at once when pacing
+#define UDP_PACING_BURST_US 500       // Bucket depth in time at the current rate
+#define UDP_PACING_MIN_BURST 3000     // ... but never less than about two datagrams
+#define UDP_TXTIME_LEAD_US 2000       // With SO_TXTIME, bursts are handed to the qdisc this far ahead
+#define UDP_TIMER_SLACK_NS 1000       // Timer slack of a pacing thread (Linux default is 50 us)
+
+// One datagram as header + payload. Both parts are gathered by the kernel,
+// so payloads are sent straight from the frame they belong to.
+typedef struct {
+    struct iovec iov[2];              // [0] header, [1] payload (may be empty)
+} UdpDatagram;
+
+static inline size_t udp_datagram_length(const UdpDatagram *datagram) {
+    return datagram->iov[0].iov_len + datagram->iov[1].iov_len;
+}
+
+// Batched UDP sender (sendmmsg + UDP_SEGMENT, with sendmsg() fallback)
+typedef struct {
+    int socket;
+    bool use_mmsg;                    // sendmmsg() available
+    bool use_gso;                     // UDP_SEGMENT super-datagrams available
+
+    // Pacing: token bucket refilled at pacing_rate_bps. A burst may leave
+    // while the bucket is not in debt and takes its bytes out, so bursts
+    // are spaced by their wire time at the pacing rate.
+    uint64_t pacing_rate_bps;         // Egress rate in bits/s (0 = unpaced)
+    size_t burst_bytes;               // Bucket depth
+    double tokens;                    // Bytes that may leave now; negative = in debt
+    uint64_t refill_ns;               // Tokens last brought up to date
+    bool use_txtime;                  // Bursts carry SCM_TXTIME; the fq qdisc holds them until due
+
+    // Statistics
+    uint64_t syscalls;                // Send syscalls issued
+    uint64_t datagrams;               // Datagrams put on the wire
+} UdpSender;
+
+// Batched UDP receiver: recvmmsg() into a ring of slots allocated once
+typedef struct {
+    int socket;
+    bool use_mmsg;                    // recvmmsg() available
+
+    // Slot ring
+    size_t num_slots;                 // Datagrams pulled per call at most
+    size_t slot_size;                 // Bytes per slot (largest accepted datagram)
+    uint8_t *slots;                   // num_slots * slot_size bytes
+    struct iovec *iov;                // One iovec per slot
+    void *msgs;                       // Prebuilt struct mmsghdr array (Linux)
+    size_t *lengths;                  // Received length per slot
+
+    // Statistics
+    uint64_t syscalls;                // Receive syscalls issued
+    uint64_t datagrams;               // Datagrams received
+} UdpReceiver;
+
+// Monotonic clock in nanoseconds
+uint64_t monotonic_ns(void);
+
+// Mark a socket's datagrams with a DSCP so routers and the local qdisc
+// put them ahead of bulk traffic (0 leaves the socket unmarked)
+void udp_set_dscp(int socket, int dscp);
+
+// Probe kernel support and set up pacing for an already created socket
+bool udp_sender_init(UdpSender *sender, int socket, uint64_t pacing_rate_bps);
+
+// Change the pacing rate (0 = unpaced). Credit earned at the old rate is kept.
+void udp_sender_set_rate(UdpSender *sender, uint64_t pacing_rate_bps);
+
+// Let the kernel release paced bursts at their departure time (SO_TXTIME)
+// instead of sleeping for each one. Needs the fq qdisc on the egress
+// interface; without it bursts leave as soon as they are sent. Returns
+// false when the kernel does not support it.
+bool udp_sender_enable_txtime(UdpSender *sender);
+
+// When the next burst may be handed to udp_sender_send() without it
+// sleeping; at or before `now_ns` when it may go right away
+uint64_t udp_sender_next_send_ns(UdpSender *sender, uint64_t now_ns);
+
+// Largest burst udp_sender_send() releases at once at the current rate
+static inline size_t udp_sender_burst_bytes(const UdpSender *sender) {
+    return sender->pacing_rate_bps ? sender->burst_bytes : SIZE_MAX;
+}
+
+// Wake up for paced bursts within microseconds instead of the default
+// timer slack. Applies to the calling thread.
+void udp_pacing_thread_init(void);
+
+// Send `count` datagrams to `dst`, batching as far as the kernel allows.
+// Returns the number of datagrams sent, or -1 on error.
+int udp_sender_send(UdpSender *sender, const struct sockaddr_in *dst,
+                    const UdpDatagram *datagrams, size_t count);
+
+// Allocate the slot ring for an already created (non-blocking) socket
+bool udp_receiver_init(UdpReceiver *receiver, int socket, size_t num_slots, size_t slot_size);
+
+// Pull up to num_slots pending datagrams into slots 0..n-1. Returns n,
+// 0 when nothing is pending, or -1 on error.
+int udp_receiver_recv(UdpReceiver *receiver);
+
+// Release the slot ring
+void udp_receiver_free(UdpReceiver *receiver);
+
+// Access a received slot
+static inline uint8_t *udp_receiver_slot(const UdpReceiver *receiver, size_t index) {
+    return receiver->slots + index * receiver->slot_size;
+}
+
+static inline size_t udp_receiver_length(const UdpReceiver *receiver, size_t index) {
+    return receiver->lengths[index];
+}
+
+#endif /* UDP_BATCH_H */
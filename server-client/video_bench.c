@@ -0,0 +1,929 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include "common.h"
+#include "config.h"
+#include "udp_batch.h"
+#include "fec.h"
+#include "frame_tx.h"
+#include "frame_rx.h"
+#include "rate_control.h"
+#include "latency.h"
+#include "yuv.h"
+#include "tile_delta.h"
+#include "wire.h"
+
+// Headless loopback benchmark of the video protocol. Three threads run the
+// real sender (FrameTx) and receiver (FrameRx) code over UDP on localhost:
+//
+//   sender --video--> impairment shim --video--> receiver
+//     ^                                              |
+//     +----------- NACKs, receiver reports ----------+
+//
+// The sender emits synthetic raw RGB24 (or, with -y, YUV 4:2:0) frames at
+// a fixed rate; the receiver converts YUV frames to RGB like the client.
+// With -t only the tiles that changed are sent and the receiver patches
+// them into its copy of the frame. The shim
+// drops, delays, jitters and reorders datagrams on the video path, and can
+// squeeze them through a bottleneck of fixed capacity. The receiver records
+// end-to-end latency on the shared monotonic clock. With -a the sender
+// sizes its frames to the rate controller's target, like an encoder would.
+
+// Defaults (all overridable on the command line), the server's where it has one
+#define BENCH_WIDTH FRAME_WIDTH
+#define BENCH_HEIGHT FRAME_HEIGHT
+#define BENCH_FPS TARGET_FPS
+#define BENCH_SECONDS 10
+#define BENCH_FEC_GROUP_SIZE 8
+#define BENCH_RETRANSMIT_FRAMES 4
+#define BENCH_PLAYOUT_DELAY_MS 40
+#define BENCH_PACING_MBPS PACING_RATE_MBPS
+#define BENCH_PACING_SPREAD PACING_SPREAD
+#define BENCH_BASE_PORT 6555               // Sender control, shim and receiver use base..base+2
+#define BENCH_DRAIN_MS 200                 // Time given to the last frames after the sender stops
+#define BENCH_TILE_THRESHOLD 0.0           // Tile deltas resend any change, so the receiver's copy is exact
+
+// Socket and batching configuration
+#define BENCH_SOCKET_BUFFER (8 * 1024 * 1024)
+#define BENCH_RECV_SLOTS 64
+#define SHIM_QUEUE_SLOTS 16384             // Datagrams held back by the shim at most
+#define SHIM_FORWARD_BATCH 256             // Due datagrams forwarded per send call
+#define SHIM_BOTTLENECK_QUEUE_MS 200       // Bottleneck queue depth; datagrams beyond it are dropped
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t fps;
+    uint32_t seconds;
+    uint32_t fec_group_size;
+    uint32_t playout_delay_ms;
+    uint32_t pacing_mbps;
+    double spread;                         // Share of the frame interval a frame is paced over (0 = off)
+    uint16_t base_port;
+    bool adaptive;                         // Frame size follows the rate controller
+    bool yuv;                              // Send YUV 4:2:0 and convert it on the receiver
+    uint32_t tile_size;                    // Send tile deltas with tiles this big (0 = full frames)
+    uint32_t datagram_size;                // Chunk datagram size, as path MTU discovery would pick
+
+    // Impairments on the video path
+    double loss;                           // Probability a datagram starts a loss burst
+    double burst;                          // Probability the next datagram of a burst is lost too
+    double reorder;                        // Probability a datagram is held back
+    uint32_t delay_us;                     // Fixed one-way delay
+    uint32_t jitter_us;                    // Uniform extra delay 0..jitter
+    uint32_t reorder_us;                   // Extra delay for held back datagrams
+    uint64_t capacity_bps;                 // Bottleneck rate (0 = unlimited)
+} BenchConfig;
+
+// One datagram waiting in the shim
+typedef struct {
+    uint64_t release_ns;
+    uint32_t length;
+    uint8_t *data;                         // Its slot in the queue's buffer
+} ShimPacket;
+
+// Synthetic frame buffer, busy while FrameTx caches datagrams pointing into it
+typedef struct {
+    uint8_t *data;
+    bool busy;
+} SynthFrame;
+
+typedef struct {
+    BenchConfig config;
+    atomic_bool sender_running;
+    atomic_bool running;
+
+    struct sockaddr_in sender_control_addr;
+    struct sockaddr_in shim_addr;
+    struct sockaddr_in receiver_addr;
+
+    // Sender
+    SynthFrame synth[FRAME_TX_MAX_CACHE + 1];
+    uint64_t frame_bytes_sent;
+    uint64_t sender_cpu_ns;
+    uint32_t frames_sent;
+    uint64_t chunks_sent;
+    uint64_t datagrams_sent;
+    uint64_t retransmit_count;
+    uint64_t send_syscalls;
+    RateControl rate;
+    double target_sum_bps;                 // Per frame, for the mean target
+    uint64_t send_duration_sum_ns;         // First to last datagram, summed over frames
+    TileEncoder tiles;                     // -t: the receiver's copy as the sender knows it
+
+    // Shim
+    uint64_t shim_forwarded;
+    uint64_t shim_dropped;
+    uint64_t shim_reordered;
+    uint64_t shim_overflow;
+    uint64_t shim_queue_drops;             // Bottleneck queue full
+
+    // Receiver
+    FrameRx assembler;
+    LatencyHistogram latency;              // Frame generated -> frame released in order
+    LatencyHistogram complete_latency;     // Frame generated -> last chunk in
+    uint64_t frame_bytes_received;
+    uint64_t corrupt_frames;
+    uint64_t receiver_cpu_ns;
+    uint64_t first_delivery_ns;
+    uint64_t last_delivery_ns;
+    uint32_t frames_delivered;
+    uint8_t *rgb;                          // Conversion target for YUV frames
+    uint8_t *copy;                         // -t: full frame with the deltas patched in
+    uint32_t copy_frame_id;
+    bool copy_valid;                       // Cleared by a lost frame until the next full one
+    uint32_t unusable_deltas;              // Deltas that arrived with the copy stale
+    uint64_t convert_ns;                   // Time spent converting, summed over frames
+    uint32_t frames_converted;
+
+    // Host
+    uint64_t steal_ns;                     // CPU time the hypervisor took during the run
+} BenchState;
+
+// Per-thread CPU time in nanoseconds
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// CPU time a hypervisor has given to other guests since boot ("steal" in
+// /proc/stat), or 0 where the kernel does not report it. A stalled vCPU
+// holds up the sender mid-frame, which the receiver cannot tell from loss.
+static uint64_t host_steal_ns(void) {
+    FILE *file = fopen("/proc/stat", "r");
+    if (!file) {
+        return 0;
+    }
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+    int fields = fscanf(file, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+                        &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal);
+    fclose(file);
+
+    long ticks_per_second = sysconf(_SC_CLK_TCK);
+    if (fields != 8 || ticks_per_second <= 0) {
+        return 0;
+    }
+    return (uint64_t)steal * 1000000000ull / (uint64_t)ticks_per_second;
+}
+
+// xorshift64* generator for the shim; deterministic for a given seed
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static double rng_uniform(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Loopback address on a port
+static struct sockaddr_in loopback_addr(uint16_t port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    return addr;
+}
+
+// Create a UDP socket with large buffers, bound to `port` when non-zero
+static int open_socket(uint16_t port, bool nonblocking) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("Failed to create socket");
+        return -1;
+    }
+
+    int size = BENCH_SOCKET_BUFFER;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    if (port != 0) {
+        struct sockaddr_in addr = loopback_addr(port);
+        if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "Failed to bind port %u\n", port);
+            close(sock);
+            return -1;
+        }
+    }
+
+    if (nonblocking) {
+        int flags = fcntl(sock, F_GETFL, 0);
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    }
+    return sock;
+}
+
+// Wait until `fd` is readable or `timeout_ns` passes
+static void wait_readable(int fd, uint64_t timeout_ns) {
+    struct timeval timeout = {
+        .tv_sec = timeout_ns / 1000000000ull,
+        .tv_usec = (timeout_ns % 1000000000ull) / 1000
+    };
+
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(fd, &read_fds);
+    select(fd + 1, &read_fds, NULL, NULL, &timeout);
+}
+
+// FrameTx callback: the frame left the retransmit cache
+static void release_synth_frame(void *context, void *owner) {
+    (void)context;
+    ((SynthFrame *)owner)->busy = false;
+}
+
+// Answer retransmit requests and fold in receiver reports
+static void serve_sender_control(BenchState *state, int control_socket, FrameTx *tx, UdpSender *sender) {
+    uint8_t message[NACK_MESSAGE_SIZE];
+    NackMessage nack;
+    ReceiverReport report;
+
+    ssize_t recv_size;
+    while ((recv_size = recv(control_socket, message, sizeof(message), 0)) > 0) {
+        if (wire_decode_nack(message, (size_t)recv_size, &nack)) {
+            frame_tx_nack(tx, sender, &state->shim_addr, &nack, (size_t)recv_size);
+        } else if (recv_size == RECEIVER_REPORT_SIZE && wire_decode_receiver_report(message, &report)) {
+            rate_control_update(&state->rate, &report, tx->frames_sent, monotonic_ns());
+        }
+    }
+}
+
+// Sender: synthetic frames at a fixed rate, NACKs served in between
+static void *sender_thread(void *arg) {
+    BenchState *state = (BenchState *)arg;
+    const BenchConfig *config = &state->config;
+    uint8_t codec = config->yuv ? VIDEO_CODEC_RAW_YUV420 : VIDEO_CODEC_RAW_RGB24;
+    size_t row_bytes = config->yuv ? config->width : (size_t)config->width * 3;
+    size_t frame_size = config->yuv ? yuv420_frame_size(config->width, config->height)
+                                    : (size_t)config->width * config->height * 3;
+
+    int video_socket = open_socket(0, false);
+    int control_socket = open_socket(config->base_port, true);
+    if (video_socket < 0 || control_socket < 0) {
+        atomic_store(&state->running, false);
+        return NULL;
+    }
+
+    UdpSender sender;
+    udp_sender_init(&sender, video_socket, (uint64_t)config->pacing_mbps * 1000000ull);
+
+    FrameTx tx;
+    frame_tx_init(&tx, (uint8_t)config->fec_group_size, BENCH_RETRANSMIT_FRAMES,
+                  release_synth_frame, state);
+    frame_tx_set_datagram_size(&tx, config->datagram_size);
+
+    // Full size frames are the ceiling; a 1/64 frame the floor
+    uint64_t full_rate_bps = (uint64_t)frame_size * 8 * config->fps;
+    rate_control_init(&state->rate, full_rate_bps, full_rate_bps / 64, full_rate_bps);
+
+    // A gradient that changes a little every frame, like a real source would.
+    // With tile deltas it is drawn into the tile encoder's source frame and
+    // the buffers take the encoded payloads.
+    size_t buffer_size = frame_size;
+    if (config->tile_size > 0) {
+        if (!tile_encoder_configure(&state->tiles, codec, config->width, config->height,
+                                    config->tile_size, BENCH_TILE_THRESHOLD)) {
+            atomic_store(&state->running, false);
+            return NULL;
+        }
+        buffer_size = tile_delta_max_size(&state->tiles.layout);
+    }
+    uint8_t *source = (uint8_t *)malloc(frame_size);
+    for (size_t j = 0; j < frame_size; j++) {
+        source[j] = (uint8_t)(j * 7);
+    }
+    for (int i = 0; i < FRAME_TX_MAX_CACHE + 1; i++) {
+        state->synth[i].data = (uint8_t *)malloc(buffer_size);
+        state->synth[i].busy = false;
+        memcpy(state->synth[i].data, source, frame_size);
+    }
+
+    const uint64_t frame_interval_ns = 1000000000ull / config->fps;
+    const uint64_t stop_ns = monotonic_ns() + (uint64_t)config->seconds * 1000000000ull;
+    uint64_t next_frame_ns = monotonic_ns();
+    uint64_t cpu_start = thread_cpu_ns();
+    udp_pacing_thread_init();
+
+    while (atomic_load(&state->sender_running) && atomic_load(&state->running)) {
+        // Answer retransmit requests first; they are the most urgent traffic
+        serve_sender_control(state, control_socket, &tx, &sender);
+
+        uint64_t now = monotonic_ns();
+        if (now >= stop_ns) {
+            break;
+        }
+
+        if (now < next_frame_ns) {
+            wait_readable(control_socket, next_frame_ns - now);
+            continue;
+        }
+
+        SynthFrame *frame = NULL;
+        for (int i = 0; i < FRAME_TX_MAX_CACHE + 1 && !frame; i++) {
+            if (!state->synth[i].busy) {
+                frame = &state->synth[i];
+            }
+        }
+        if (!frame) {
+            fprintf(stderr, "No free synthetic frame buffer\n");
+            break;
+        }
+
+        // An encoder would hit the target on average; the synthetic one hits it exactly
+        size_t payload_size = frame_size;
+        if (config->adaptive) {
+            payload_size = (size_t)(state->rate.target_bps / 8 / config->fps);
+            if (payload_size > frame_size) payload_size = frame_size;
+            if (payload_size < 2 * sizeof(uint32_t)) payload_size = 2 * sizeof(uint32_t);
+        }
+        state->target_sum_bps += (double)state->rate.target_bps;
+
+        // Touch one row band and stamp the frame id at both ends for the receiver to check
+        uint32_t frame_id = tx.frames_sent + 1;
+        uint8_t *picture = config->tile_size > 0 ? source : frame->data;
+        size_t row = (frame_id % config->height) * row_bytes;
+        memset(picture + row, (int)(frame_id & 0xff), row_bytes);
+        memcpy(picture, &frame_id, sizeof(frame_id));
+        memcpy(picture + payload_size - sizeof(frame_id), &frame_id, sizeof(frame_id));
+        frame->busy = true;
+
+        // Tile deltas, with a full frame once a second
+        uint8_t flags = FRAME_FLAG_KEYFRAME;
+        if (config->tile_size > 0) {
+            bool delta;
+            memcpy(state->tiles.frame, source, frame_size);
+            payload_size = tile_encoder_encode(&state->tiles, state->tiles.frames_since_full + 1 >= config->fps,
+                                               frame->data, &delta);
+            flags = delta ? FRAME_FLAG_DELTA : FRAME_FLAG_KEYFRAME;
+        }
+
+        FramePayload payload = {
+            .data = frame->data,
+            .size = payload_size,
+            .codec = codec,
+            .flags = flags,
+            .width = config->width,
+            .height = config->height,
+            .decode_ns = now,
+            .scale_ns = now,
+            .owner = frame
+        };
+        // Spread the frame over its share of the interval, never slower than
+        // -m, and tell the receiver how long that takes at most
+        size_t wire_bytes = frame_tx_wire_bytes(&tx, payload_size);
+        if (config->spread > 0.0) {
+            payload.pacing_ns = (uint64_t)(config->spread * frame_interval_ns);
+            uint64_t rate_bps = (uint64_t)(wire_bytes * 8.0 / (payload.pacing_ns / 1e9));
+            if (rate_bps < (uint64_t)config->pacing_mbps * 1000000ull) {
+                rate_bps = (uint64_t)config->pacing_mbps * 1000000ull;
+            }
+            udp_sender_set_rate(&sender, rate_bps);
+        } else if (config->pacing_mbps) {
+            payload.pacing_ns = (uint64_t)wire_bytes * 8000ull / config->pacing_mbps;
+        }
+
+        if (frame_tx_send(&tx, &sender, &state->shim_addr, &payload) > 0) {
+            state->frame_bytes_sent += payload_size;
+            state->send_duration_sum_ns += tx.last_send_duration_ns;
+        }
+
+        // Absolute schedule; after a stall, restart from now instead of bursting
+        next_frame_ns += frame_interval_ns;
+        if (next_frame_ns < now) {
+            next_frame_ns = now;
+        }
+    }
+
+    state->sender_cpu_ns = thread_cpu_ns() - cpu_start;
+    state->frames_sent = tx.frames_sent;
+    state->chunks_sent = tx.chunks_sent;
+    state->retransmit_count = tx.retransmit_count;
+
+    // Keep answering NACKs for the frames still in flight
+    while (atomic_load(&state->running)) {
+        wait_readable(control_socket, 1000000ull);
+        serve_sender_control(state, control_socket, &tx, &sender);
+    }
+
+    state->retransmit_count = tx.retransmit_count;
+    state->datagrams_sent = sender.datagrams;
+    state->send_syscalls = sender.syscalls;
+
+    frame_tx_free(&tx);
+    tile_encoder_free(&state->tiles);
+    for (int i = 0; i < FRAME_TX_MAX_CACHE + 1; i++) {
+        free(state->synth[i].data);
+    }
+    free(source);
+    close(video_socket);
+    close(control_socket);
+    return NULL;
+}
+
+// Min-heap of held back datagrams, ordered by release time
+typedef struct {
+    ShimPacket *packets;                   // SHIM_QUEUE_SLOTS packets
+    uint8_t *buffer;                       // Their data, one datagram size each
+    uint32_t *heap;                        // Indices into packets
+    uint32_t *free_slots;                  // Stack of unused indices
+    uint32_t count;
+    uint32_t num_free;
+} ShimQueue;
+
+static bool shim_queue_init(ShimQueue *queue, size_t datagram_size) {
+    queue->packets = (ShimPacket *)malloc(SHIM_QUEUE_SLOTS * sizeof(ShimPacket));
+    queue->buffer = (uint8_t *)malloc(SHIM_QUEUE_SLOTS * datagram_size);
+    queue->heap = (uint32_t *)malloc(SHIM_QUEUE_SLOTS * sizeof(uint32_t));
+    queue->free_slots = (uint32_t *)malloc(SHIM_QUEUE_SLOTS * sizeof(uint32_t));
+    if (!queue->packets || !queue->buffer || !queue->heap || !queue->free_slots) {
+        fprintf(stderr, "Failed to allocate shim queue\n");
+        return false;
+    }
+
+    queue->count = 0;
+    queue->num_free = SHIM_QUEUE_SLOTS;
+    for (uint32_t i = 0; i < SHIM_QUEUE_SLOTS; i++) {
+        queue->packets[i].data = queue->buffer + (size_t)i * datagram_size;
+        queue->free_slots[i] = SHIM_QUEUE_SLOTS - 1 - i;
+    }
+    return true;
+}
+
+static void shim_queue_free(ShimQueue *queue) {
+    free(queue->packets);
+    free(queue->buffer);
+    free(queue->heap);
+    free(queue->free_slots);
+}
+
+static uint64_t shim_release_ns(const ShimQueue *queue, uint32_t position) {
+    return queue->packets[queue->heap[position]].release_ns;
+}
+
+static void shim_queue_push(ShimQueue *queue, uint32_t slot) {
+    uint32_t position = queue->count++;
+    queue->heap[position] = slot;
+    while (position > 0) {
+        uint32_t parent = (position - 1) / 2;
+        if (shim_release_ns(queue, parent) <= shim_release_ns(queue, position)) {
+            break;
+        }
+        uint32_t tmp = queue->heap[parent];
+        queue->heap[parent] = queue->heap[position];
+        queue->heap[position] = tmp;
+        position = parent;
+    }
+}
+
+static uint32_t shim_queue_pop(ShimQueue *queue) {
+    uint32_t top = queue->heap[0];
+    queue->heap[0] = queue->heap[--queue->count];
+
+    uint32_t position = 0;
+    while (1) {
+        uint32_t smallest = position;
+        uint32_t left = position * 2 + 1;
+        uint32_t right = left + 1;
+        if (left < queue->count && shim_release_ns(queue, left) < shim_release_ns(queue, smallest)) {
+            smallest = left;
+        }
+        if (right < queue->count && shim_release_ns(queue, right) < shim_release_ns(queue, smallest)) {
+            smallest = right;
+        }
+        if (smallest == position) {
+            break;
+        }
+        uint32_t tmp = queue->heap[smallest];
+        queue->heap[smallest] = queue->heap[position];
+        queue->heap[position] = tmp;
+        position = smallest;
+    }
+    return top;
+}
+
+// Impairment shim: loss (with bursts), bottleneck, delay, jitter and reordering
+static void *shim_thread(void *arg) {
+    BenchState *state = (BenchState *)arg;
+    const BenchConfig *config = &state->config;
+
+    int in_socket = open_socket(config->base_port + 1, true);
+    int out_socket = open_socket(0, false);
+    ShimQueue queue;
+    UdpReceiver receiver;
+    if (in_socket < 0 || out_socket < 0 || !shim_queue_init(&queue, config->datagram_size) ||
+        !udp_receiver_init(&receiver, in_socket, BENCH_RECV_SLOTS, config->datagram_size)) {
+        atomic_store(&state->running, false);
+        return NULL;
+    }
+
+    // Forward with the same batching as the sender so the shim is not the bottleneck
+    UdpSender sender;
+    udp_sender_init(&sender, out_socket, 0);
+    UdpDatagram batch[SHIM_FORWARD_BATCH];
+    uint32_t batch_slots[SHIM_FORWARD_BATCH];
+
+    bool in_burst = false;
+    uint64_t link_free_ns = 0;             // When the bottleneck has sent everything queued
+
+    while (atomic_load(&state->running)) {
+        int count = udp_receiver_recv(&receiver);
+        uint64_t now = monotonic_ns();
+
+        for (int i = 0; i < count; i++) {
+            // Gilbert style loss: a loss starts a burst that continues with probability `burst`
+            bool lost = rng_uniform() < (in_burst ? config->burst : config->loss);
+            in_burst = lost;
+            if (lost) {
+                state->shim_dropped++;
+                continue;
+            }
+
+            if (queue.num_free == 0) {
+                state->shim_overflow++;
+                continue;
+            }
+
+            // Bottleneck: datagrams leave one after another at the link rate, and a
+            // full queue drops them, like a router on a slow tether would
+            uint32_t length = (uint32_t)udp_receiver_length(&receiver, i);
+            uint64_t depart_ns = now;
+            if (config->capacity_bps) {
+                if (link_free_ns < now) {
+                    link_free_ns = now;
+                }
+                if (link_free_ns - now > SHIM_BOTTLENECK_QUEUE_MS * 1000000ull) {
+                    state->shim_queue_drops++;
+                    continue;
+                }
+                link_free_ns += (uint64_t)length * 8 * 1000000000ull / config->capacity_bps;
+                depart_ns = link_free_ns;
+            }
+
+            uint32_t slot = queue.free_slots[--queue.num_free];
+            ShimPacket *packet = &queue.packets[slot];
+            packet->length = length;
+            memcpy(packet->data, udp_receiver_slot(&receiver, i), packet->length);
+
+            uint64_t delay_us = config->delay_us + (uint64_t)(rng_uniform() * config->jitter_us);
+            if (config->reorder > 0 && rng_uniform() < config->reorder) {
+                delay_us += config->reorder_us;
+                state->shim_reordered++;
+            }
+            packet->release_ns = depart_ns + delay_us * 1000ull;
+            shim_queue_push(&queue, slot);
+        }
+
+        // Forward everything that is due, in release order
+        while (queue.count > 0 && shim_release_ns(&queue, 0) <= now) {
+            size_t num_due = 0;
+            while (num_due < SHIM_FORWARD_BATCH && queue.count > 0 &&
+                   shim_release_ns(&queue, 0) <= now) {
+                uint32_t slot = shim_queue_pop(&queue);
+                batch_slots[num_due] = slot;
+                batch[num_due].iov[0].iov_base = queue.packets[slot].data;
+                batch[num_due].iov[0].iov_len = queue.packets[slot].length;
+                batch[num_due].iov[1].iov_base = NULL;
+                batch[num_due].iov[1].iov_len = 0;
+                num_due++;
+            }
+
+            udp_sender_send(&sender, &state->receiver_addr, batch, num_due);
+            for (size_t i = 0; i < num_due; i++) {
+                queue.free_slots[queue.num_free++] = batch_slots[i];
+            }
+            state->shim_forwarded += num_due;
+        }
+
+        // Sleep until the next datagram arrives or is due
+        if (count <= 0) {
+            uint64_t wait_ns = 1000000ull;
+            if (queue.count > 0) {
+                uint64_t due = shim_release_ns(&queue, 0);
+                wait_ns = due > now ? due - now : 0;
+                if (wait_ns > 1000000ull) {
+                    wait_ns = 1000000ull;
+                }
+            }
+            if (wait_ns > 0) {
+                wait_readable(in_socket, wait_ns);
+            }
+        }
+    }
+
+    udp_receiver_free(&receiver);
+    shim_queue_free(&queue);
+    close(in_socket);
+    close(out_socket);
+    return NULL;
+}
+
+// -t: bring the receiver's copy up to date like the client does; NULL
+// while a lost frame leaves it stale
+static const uint8_t *patch_tile_copy(BenchState *state, const FrameBuffer *frame) {
+    if (!(frame->flags & FRAME_FLAG_DELTA)) {
+        memcpy(state->copy, frame->frame_data, frame->frame_size);
+        state->copy_valid = true;
+    } else if (!state->copy_valid || frame->frame_id != state->copy_frame_id + 1 ||
+               !tile_delta_apply(state->copy, frame->codec, frame->width, frame->height,
+                                 frame->frame_data, frame->frame_size)) {
+        state->copy_valid = false;
+        state->unusable_deltas++;
+    }
+    state->copy_frame_id = frame->frame_id;
+    return state->copy_valid ? state->copy : NULL;
+}
+
+// FrameRx callback: check and time each frame released in order
+static void deliver_frame(void *context, FrameBuffer *frame) {
+    BenchState *state = (BenchState *)context;
+    uint64_t now = monotonic_ns();
+
+    // Deltas are checked on the frame they rebuild
+    const uint8_t *data = frame->frame_data;
+    size_t size = frame->frame_size;
+    if (state->config.tile_size > 0) {
+        data = patch_tile_copy(state, frame);
+        size = frame->codec == VIDEO_CODEC_RAW_YUV420 ? yuv420_frame_size(frame->width, frame->height)
+                                                      : (size_t)frame->width * frame->height * 3;
+    }
+
+    if (data) {
+        uint32_t head, tail;
+        memcpy(&head, data, sizeof(head));
+        memcpy(&tail, data + size - sizeof(tail), sizeof(tail));
+        if (head != frame->frame_id || tail != frame->frame_id) {
+            state->corrupt_frames++;
+        }
+    }
+
+    // Full size YUV frames get the client's conversion (-a shrinks them to arbitrary sizes)
+    if (data && frame->codec == VIDEO_CODEC_RAW_YUV420 &&
+        size == yuv420_frame_size(frame->width, frame->height)) {
+        yuv420_to_rgb24(data, frame->width, frame->height, state->rgb);
+        state->convert_ns += monotonic_ns() - now;
+        state->frames_converted++;
+    }
+
+    latency_record_ns(&state->latency, (int64_t)(now - frame->server_decode_ns));
+    latency_record_ns(&state->complete_latency, (int64_t)(frame->complete_ns - frame->server_decode_ns));
+
+    if (state->frames_delivered == 0) {
+        state->first_delivery_ns = now;
+    }
+    state->last_delivery_ns = now;
+    state->frames_delivered++;
+    state->frame_bytes_received += frame->frame_size;
+}
+
+// Receiver: the client's reassembly path without decode or display
+static void *receiver_thread(void *arg) {
+    BenchState *state = (BenchState *)arg;
+    const BenchConfig *config = &state->config;
+
+    int video_socket = open_socket(config->base_port + 2, true);
+    int control_socket = open_socket(0, false);
+    UdpReceiver receiver;
+    if (video_socket < 0 || control_socket < 0 ||
+        !udp_receiver_init(&receiver, video_socket, BENCH_RECV_SLOTS, config->datagram_size)) {
+        atomic_store(&state->running, false);
+        return NULL;
+    }
+
+    frame_rx_init(&state->assembler, config->playout_delay_ms, deliver_frame, state);
+    state->rgb = (uint8_t *)malloc((size_t)config->width * config->height * 3);
+    state->copy = (uint8_t *)malloc((size_t)config->width * config->height * 3);
+
+    FrameChunk valid[BENCH_RECV_SLOTS];
+    uint64_t cpu_start = thread_cpu_ns();
+
+    while (atomic_load(&state->running)) {
+        int count;
+        while ((count = udp_receiver_recv(&receiver)) > 0) {
+            int num_valid = frame_rx_validate(&state->assembler, &receiver, count, valid);
+            for (int i = 0; i < num_valid; i++) {
+                frame_rx_apply(&state->assembler, &valid[i]);
+            }
+        }
+
+        frame_rx_release(&state->assembler);
+        frame_rx_send_nacks(&state->assembler, control_socket, &state->sender_control_addr);
+        frame_rx_send_report(&state->assembler, control_socket, &state->sender_control_addr);
+
+        wait_readable(video_socket, 1000000ull);
+    }
+
+    state->receiver_cpu_ns = thread_cpu_ns() - cpu_start;
+
+    frame_rx_free(&state->assembler);
+    free(state->rgb);
+    free(state->copy);
+    udp_receiver_free(&receiver);
+    close(video_socket);
+    close(control_socket);
+    return NULL;
+}
+
+// Print the benchmark results
+static void print_report(const BenchState *state, uint64_t elapsed_ns) {
+    const BenchConfig *config = &state->config;
+    const FrameRx *rx = &state->assembler;
+    double seconds = (double)elapsed_ns / 1e9;
+    uint32_t frames = state->frames_sent > 0 ? state->frames_sent : 1;
+    uint32_t delivered = state->frames_delivered > 0 ? state->frames_delivered : 1;
+
+    printf("\nVideo protocol benchmark: %ux%u raw %s @ %u fps for %u s, %u byte datagrams, FEC group %u, %s XOR, "
+           "pacing spread %.2g\n",
+           config->width, config->height, config->yuv ? "YUV 4:2:0" : "RGB24", config->fps,
+           config->seconds, config->datagram_size, config->fec_group_size, fec_xor_backend(), config->spread);
+    printf("Impairment: loss %.2f%% (burst %.2f), delay %.1f ms, jitter %.1f ms, reorder %.2f%% (+%.1f ms)\n",
+           config->loss * 100.0, config->burst, config->delay_us / 1000.0, config->jitter_us / 1000.0,
+           config->reorder * 100.0, config->reorder_us / 1000.0);
+    if (config->capacity_bps) {
+        printf("Bottleneck: %.1f Mbit/s, %d ms queue\n", config->capacity_bps / 1e6, SHIM_BOTTLENECK_QUEUE_MS);
+    }
+
+    // Without loss or a bottleneck to cause them, retransmits and backoffs
+    // point at the protocol, or at a host that stalled the threads
+    const RateControl *rate = &state->rate;
+    bool unprovoked = config->loss == 0.0 && config->capacity_bps == 0 &&
+                      (state->retransmit_count > 0 || rate->backoffs > 0);
+    printf("Recovery:   %lu retransmits, %u rate backoffs, %.1f ms CPU steal%s\n",
+           (unsigned long)state->retransmit_count, rate->backoffs, state->steal_ns / 1e6,
+           unprovoked ? "  <-- WARNING: no loss configured" : "");
+
+    printf("Throughput:  %.1f frames/s sent, %.1f frames/s delivered, %.1f Mbit/s goodput\n",
+           state->frames_sent / seconds, state->frames_delivered / seconds,
+           state->frame_bytes_received * 8.0 / seconds / 1e6);
+    printf("Completed:   %u/%u frames (%.2f%%), %u skipped, %lu corrupt\n",
+           rx->frames_received, state->frames_sent, 100.0 * rx->frames_received / frames,
+           rx->frames_skipped, (unsigned long)state->corrupt_frames);
+    printf("Sender:      %lu chunks, %lu datagrams in %lu syscalls, %lu retransmits, %.1f us CPU/frame, "
+           "%.2f ms first -> last datagram\n",
+           (unsigned long)state->chunks_sent, (unsigned long)state->datagrams_sent,
+           (unsigned long)state->send_syscalls, (unsigned long)state->retransmit_count,
+           state->sender_cpu_ns / 1000.0 / frames, state->send_duration_sum_ns / 1e6 / frames);
+    printf("Receiver:    %u chunks, %u FEC recovered, %u late, %u invalid, %u NACKs, %.1f us CPU/frame\n",
+           rx->chunks_received, rx->chunks_recovered, rx->late_chunks, rx->invalid_chunks,
+           rx->nacks_sent, state->receiver_cpu_ns / 1000.0 / delivered);
+    if (config->tile_size > 0) {
+        const TileEncoder *tiles = &state->tiles;
+        printf("Tiles:       %ux%u, %lu full and %lu delta frames, %.1f%% of tiles sent in deltas (%s), "
+               "%u deltas unusable after loss\n",
+               config->tile_size, config->tile_size, (unsigned long)tiles->full_frames,
+               (unsigned long)tiles->delta_frames,
+               tiles->tiles_compared ? 100.0 * tiles->tiles_sent / tiles->tiles_compared : 0.0,
+               tile_diff_backend(), state->unusable_deltas);
+    }
+    if (state->frames_converted > 0) {
+        printf("Convert:     %u YUV frames to RGB24, %.1f us/frame (%s)\n", state->frames_converted,
+               state->convert_ns / 1000.0 / state->frames_converted, yuv_convert_backend());
+    }
+    printf("Shim:        %lu forwarded, %lu dropped, %lu reordered, %lu overflowed, %lu queue drops\n",
+           (unsigned long)state->shim_forwarded, (unsigned long)state->shim_dropped,
+           (unsigned long)state->shim_reordered, (unsigned long)state->shim_overflow,
+           (unsigned long)state->shim_queue_drops);
+    printf("Rate:        %s, mean target %.1f Mbit/s, final %.1f Mbit/s, %u reports, %u backoffs, "
+           "last queue delay %.1f ms, jitter %.1f ms\n",
+           config->adaptive ? "adaptive" : "fixed (reports only)",
+           state->target_sum_bps / frames / 1e6, rate->target_bps / 1e6, rate->reports, rate->backoffs,
+           rate->queue_delay_us / 1000.0, rate->jitter_us / 1000.0);
+    latency_print(&state->complete_latency, "send -> complete");
+    latency_print(&state->latency, "send -> released");
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -w WIDTH      frame width (%d)\n"
+            "  -h HEIGHT     frame height (%d)\n"
+            "  -f FPS        frames per second (%d)\n"
+            "  -s SECONDS    run time (%d)\n"
+            "  -k GROUP      data chunks per FEC parity chunk, 0 = off (%d)\n"
+            "  -M BYTES      chunk datagram size, up to %d for 9000-byte jumbo frames (%d)\n"
+            "  -P MS         receiver playout delay (%d)\n"
+            "  -m MBPS       sender pacing rate, 0 = unpaced (%d)\n"
+            "  -S FRACTION   pace each frame over this share of its interval, 0 = off (%.2g)\n"
+            "  -p PORT       first of three loopback ports (%d)\n"
+            "  -l PERCENT    datagram loss\n"
+            "  -b FRACTION   probability a loss continues as a burst (0..1)\n"
+            "  -d MS         one-way delay\n"
+            "  -j MS         uniform jitter on top of the delay\n"
+            "  -r PERCENT    datagrams held back to arrive out of order\n"
+            "  -R MS         how long reordered datagrams are held back (2)\n"
+            "  -c MBPS       bottleneck capacity on the video path, 0 = unlimited (0)\n"
+            "  -a            size frames to the rate controller's target\n"
+            "  -y            send YUV 4:2:0 frames, converted to RGB24 on the receiver\n"
+            "  -t SIZE       send only the SIZE x SIZE tiles that changed, 0 = full frames (0)\n",
+            name, BENCH_WIDTH, BENCH_HEIGHT, BENCH_FPS, BENCH_SECONDS,
+            BENCH_FEC_GROUP_SIZE, MAX_DATAGRAM_SIZE, MAX_PACKET_SIZE, BENCH_PLAYOUT_DELAY_MS,
+            (int)BENCH_PACING_MBPS, BENCH_PACING_SPREAD, BENCH_BASE_PORT);
+}
+
+int main(int argc, char *argv[]) {
+    static BenchState state;
+    BenchConfig *config = &state.config;
+
+    config->width = BENCH_WIDTH;
+    config->height = BENCH_HEIGHT;
+    config->fps = BENCH_FPS;
+    config->seconds = BENCH_SECONDS;
+    config->fec_group_size = BENCH_FEC_GROUP_SIZE;
+    config->datagram_size = MAX_PACKET_SIZE;
+    config->playout_delay_ms = BENCH_PLAYOUT_DELAY_MS;
+    config->pacing_mbps = (uint32_t)BENCH_PACING_MBPS;
+    config->spread = BENCH_PACING_SPREAD;
+    config->base_port = BENCH_BASE_PORT;
+    config->reorder_us = 2000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:h:f:s:k:M:P:m:S:p:l:b:d:j:r:R:c:ayt:")) != -1) {
+        switch (opt) {
+            case 'w': config->width = (uint32_t)atoi(optarg); break;
+            case 'h': config->height = (uint32_t)atoi(optarg); break;
+            case 'f': config->fps = (uint32_t)atoi(optarg); break;
+            case 's': config->seconds = (uint32_t)atoi(optarg); break;
+            case 'k': config->fec_group_size = (uint32_t)atoi(optarg); break;
+            case 'M': config->datagram_size = (uint32_t)atoi(optarg); break;
+            case 'P': config->playout_delay_ms = (uint32_t)atoi(optarg); break;
+            case 'm': config->pacing_mbps = (uint32_t)atoi(optarg); break;
+            case 'S': config->spread = atof(optarg); break;
+            case 'p': config->base_port = (uint16_t)atoi(optarg); break;
+            case 'l': config->loss = atof(optarg) / 100.0; break;
+            case 'b': config->burst = atof(optarg); break;
+            case 'd': config->delay_us = (uint32_t)(atof(optarg) * 1000.0); break;
+            case 'j': config->jitter_us = (uint32_t)(atof(optarg) * 1000.0); break;
+            case 'r': config->reorder = atof(optarg) / 100.0; break;
+            case 'R': config->reorder_us = (uint32_t)(atof(optarg) * 1000.0); break;
+            case 'c': config->capacity_bps = (uint64_t)(atof(optarg) * 1e6); break;
+            case 'a': config->adaptive = true; break;
+            case 'y': config->yuv = true; break;
+            case 't': config->tile_size = (uint32_t)atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (config->width == 0 || config->height == 0 || config->fps == 0 ||
+        config->width > MAX_FRAME_DIMENSION || config->height > MAX_FRAME_DIMENSION ||
+        config->fec_group_size > FEC_MAX_GROUP_SIZE) {
+        fprintf(stderr, "Invalid frame size, frame rate or FEC group size\n");
+        return 1;
+    }
+    if (config->datagram_size < MIN_PACKET_SIZE || config->datagram_size > MAX_DATAGRAM_SIZE) {
+        fprintf(stderr, "Datagram size must be %d to %d bytes\n", MIN_PACKET_SIZE, MAX_DATAGRAM_SIZE);
+        return 1;
+    }
+    if (config->tile_size > 0 && config->adaptive) {
+        fprintf(stderr, "Tile deltas (-t) and rate-sized frames (-a) do not mix\n");
+        return 1;
+    }
+
+    state.sender_control_addr = loopback_addr(config->base_port);
+    state.shim_addr = loopback_addr(config->base_port + 1);
+    state.receiver_addr = loopback_addr(config->base_port + 2);
+    atomic_store(&state.sender_running, true);
+    atomic_store(&state.running, true);
+
+    // Receiver and shim first, so the first frames have somewhere to go
+    pthread_t receiver, shim, sender;
+    pthread_create(&receiver, NULL, receiver_thread, &state);
+    pthread_create(&shim, NULL, shim_thread, &state);
+    usleep(50000);
+
+    uint64_t start_ns = monotonic_ns();
+    uint64_t steal_start_ns = host_steal_ns();
+    pthread_create(&sender, NULL, sender_thread, &state);
+
+    // Wait for the sender to run its course, then let the last frames drain
+    uint64_t stop_ns = start_ns + (uint64_t)config->seconds * 1000000000ull;
+    while (atomic_load(&state.running) && monotonic_ns() < stop_ns) {
+        usleep(10000);
+    }
+    atomic_store(&state.sender_running, false);
+    usleep((BENCH_DRAIN_MS + config->playout_delay_ms) * 1000);
+    atomic_store(&state.running, false);
+
+    pthread_join(sender, NULL);
+    pthread_join(shim, NULL);
+    pthread_join(receiver, NULL);
+    state.steal_ns = host_steal_ns() - steal_start_ns;
+
+    print_report(&state, stop_ns - start_ns);
+    return 0;
+}
@@ -1,63 +1,189 @@
 #define GL_SILENCE_DEPRECATION
+#define GL_GLEXT_PROTOTYPES                   // Buffer object entry points on Linux
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/select.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #include <GLFW/glfw3.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
 
 #include "common.h"
-
-// Frame management
+#include "udp_batch.h"
+#include "fec.h"
+#include "frame_rx.h"
+#include "latency.h"
+#include "recorder.h"
+#include "yuv.h"
+#include "tile_delta.h"
+#include "pipeline.h"
+#include "wire.h"
+#include "config.h"
+
+// Receive configuration
+#define RECV_BATCH_SLOTS 64                   // Datagrams pulled per recvmmsg() call
+#define PLAYOUT_DELAY_MS 40                   // How long an incomplete frame may hold up later ones
+#define NETWORK_POLL_MS 1                     // Longest network sleep while a frame is incomplete (NACK/playout timers)
+#define NETWORK_IDLE_MS 20                    // Longest network sleep otherwise (report and clock probe timers)
+#define CONTROL_INTERVAL_MS 20                // Control input period (50 Hz)
+#define KEYFRAME_REQUEST_INTERVAL_MS 200      // Repeat period of keyframe requests while out of sync
+
+// Texture upload
+#define PBO_COUNT 3                           // Pixel unpack buffers in the upload ring, one per display slot
+
+// Latency measurement
+#define CLOCK_SYNC_INTERVAL_MS 1000           // Clock offset probe period
+#define CLOCK_SYNC_SAMPLES 8                  // Probes kept; the lowest RTT one sets the offset
+
+// libswscale flags of each resize filter (config.h)
+static const int scaler_flags[] = {
+    [SCALER_BILINEAR] = SWS_BILINEAR,
+    [SCALER_FAST_BILINEAR] = SWS_FAST_BILINEAR,
+    [SCALER_POINT] = SWS_POINT,
+    [SCALER_BICUBIC] = SWS_BICUBIC,
+    [SCALER_AREA] = SWS_AREA,
+};
+
+// One clock offset probe result
 typedef struct {
-    uint32_t frame_id;
-    uint32_t width;
-    uint32_t height;
-    uint32_t total_chunks;
-    uint32_t chunks_received;
-    uint8_t *chunks_status;
-    uint8_t *frame_data;
-    bool complete;
-} FrameBuffer;
+    int64_t offset_ns;                     // Server clock minus client clock
+    uint64_t rtt_ns;
+} ClockSample;
 
 // Client state
 typedef struct {
     // UDP sockets
     int video_socket;
     int control_socket;
+    int network_epoll;                     // Both sockets (Linux)
     struct sockaddr_in server_video_addr;
     struct sockaddr_in server_control_addr;
+    UdpReceiver video_receiver;
 
     // OpenGL/GLFW
     GLFWwindow *window;
     GLuint texture_id;
-
-    // Frame management
-    FrameBuffer current_frame;
-    FrameBuffer display_frame;
+    uint32_t texture_width;                // Allocated texture storage
+    uint32_t texture_height;
+
+    // Upload ring: each display slot has a pixel unpack buffer, mapped by
+    // the render thread. The mapping travels with its slot through the
+    // triple buffer, so the network thread decodes or converts straight into
+    // it, and the render thread only unmaps it and queues the copy to the
+    // texture, which the driver performs asynchronously.
+    bool use_pbo;                          // Fixed before the network thread starts
+    GLuint pbo_ids[PBO_COUNT];
+    uint8_t *pbo_mapped[PBO_COUNT];        // Slot's buffer while mapped (NULL = not mapped)
+    size_t pbo_size[PBO_COUNT];            // Its storage
+    bool pbo_filled[PBO_COUNT];            // The slot's frame is in its buffer, not in frame_data
+
+    // Windowed: the network thread decodes into the back RGB24 frame and
+    // publishes it; the render thread uploads the newest one (front).
+    // Without the upload ring, raw RGB24 frames are swapped in rather than
+    // copied.
+    FrameBuffer display_frames[PBO_COUNT];
+    TripleBuffer display_buffers;
+    int display_published;                 // Last slot published: nobody writes it until the next publish
+
+    // Headless mode: no window, frames are discarded or recorded
+    bool headless;
+    bool recording;
+    Recorder recorder;
+
+    // Frame management: a window of frames in flight, released to the display
+    // in frame_id order. Raw frames move out by swapping buffers: to a
+    // display slot, or to display_frame when headless. All of it belongs to
+    // the network thread.
+    FrameRx assembler;
+    FrameBuffer display_frame;             // Headless RGB24 output, raw RGB24 copy with the upload ring
+
+    // Raw transport: the latest full frame with any tile deltas patched in,
+    // kept in display_frame (headless or upload ring RGB24), the last
+    // published display slot (other windowed RGB24) or yuv_frame (YUV 4:2:0)
+    uint8_t *yuv_frame;
+    size_t yuv_capacity;
+    uint8_t raw_codec;
+    uint32_t raw_width;
+    uint32_t raw_height;
+    uint32_t raw_frame_id;                 // Newest frame the copy reflects
+    bool raw_valid;
+    bool raw_waiting_for_keyframe;         // A delta could not be applied
+
+    // Decoder (created on the first encoded frame)
+    AVCodecContext *decoder_context;
+    uint8_t decoder_codec;
+    AVPacket *decode_packet;
+    AVFrame *decoded_frame;
+    struct SwsContext *rgb_sws_context;
+    uint32_t last_decoded_frame_id;
+    bool waiting_for_keyframe;
+    uint64_t last_keyframe_request_ns;
 
     // Control state
     ControlMessage control_msg;
 
-    // Statistics
-    uint32_t frames_received;
-    uint32_t frames_displayed;
-    uint32_t chunks_received;
+    // Statistics (reassembly counters live in the assembler)
+    atomic_uint frames_displayed;
+
+    // Clock offset to the server, kept by the network thread
+    ClockSample clock_samples[CLOCK_SYNC_SAMPLES];
+    atomic_uint clock_sample_count;
+    _Atomic int64_t clock_offset_ns;       // Server clock minus client clock
+    uint64_t last_clock_sync_ns;
+
+    // Per-stage latency of displayed frames (render thread when windowed)
+    bool swap_pending;                     // Uploaded frame not yet on screen
+    uint64_t upload_ns;
+    LatencyHistogram server_capture;       // Camera capture -> server decode (live sources only)
+    LatencyHistogram server_scale;         // Server decode -> scale/encode
+    LatencyHistogram server_queue;         // Server scale -> first chunk sent
+    LatencyHistogram network;              // First chunk sent -> first chunk received
+    LatencyHistogram assembly;             // First chunk -> frame complete
+    LatencyHistogram playout;              // Complete -> presented (jitter buffer, decode)
+    LatencyHistogram upload;               // Presented -> texture uploaded
+    LatencyHistogram swap;                 // Uploaded -> buffers swapped
+    LatencyHistogram end_to_end;           // Server decode -> buffers swapped
+    LatencyHistogram capture_to_glass;     // Camera capture -> buffers swapped (live sources only)
+    bool report_key_down;
 
     // Timing
     struct timeval last_control_time;
     struct timeval last_stats_time;
 } ClientState;
 
+// Cleared by SIGINT/SIGTERM to leave the main loop
+static atomic_bool client_running = true;
+
+// Runtime settings, parsed in main before any thread starts and read-only after
+static Config config;
+
+// Set by SIGUSR1; headless clients have no L key
+static atomic_bool latency_report_requested = false;
+
+// Set when the window contents were lost (resize, expose) and need a redraw
+static bool redraw_requested = false;
+
 // Forward declare callback functions
 void error_callback(int error, const char* description);
 void resize_callback(GLFWwindow* window, int width, int height);
+void refresh_callback(GLFWwindow* window);
+void deliver_frame(void *context, FrameBuffer *frame);
+void record_frame_latency(ClientState *state, const FrameBuffer *frame, uint64_t done_ns);
 
 // GLFW error callback
 void error_callback(int error, const char* description) {
@@ -69,6 +195,11 @@ void resize_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
 }
 
+// Window damage callback; renders happen only on new frames otherwise
+void refresh_callback(GLFWwindow* window) {
+    redraw_requested = true;
+}
+
 // Initialize UDP sockets
 bool init_network(ClientState *state) {
     printf("Initializing UDP sockets...\n");
@@ -88,24 +219,35 @@ bool init_network(ClientState *state) {
         return false;
     }
 
+    // Control input and NACKs jump the queue ahead of bulk traffic
+    udp_set_dscp(state->control_socket, CONTROL_DSCP);
+
     // Set up server video address
     memset(&state->server_video_addr, 0, sizeof(state->server_video_addr));
     state->server_video_addr.sin_family = AF_INET;
-    state->server_video_addr.sin_addr.s_addr = inet_addr(SERVER_IP);
-    state->server_video_addr.sin_port = htons(VIDEO_PORT);
+    state->server_video_addr.sin_addr.s_addr = inet_addr(config.server_ip);
+    state->server_video_addr.sin_port = htons(config.video_port);
 
     // Set up server control address
     memset(&state->server_control_addr, 0, sizeof(state->server_control_addr));
     state->server_control_addr.sin_family = AF_INET;
-    state->server_control_addr.sin_addr.s_addr = inet_addr(SERVER_IP);
-    state->server_control_addr.sin_port = htons(CONTROL_PORT);
+    state->server_control_addr.sin_addr.s_addr = inet_addr(config.server_ip);
+    state->server_control_addr.sin_port = htons(config.control_port);
+
+    // Several clients on one host may join the same multicast group
+    if (VIDEO_MULTICAST) {
+        int reuse = 1;
+        if (setsockopt(state->video_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+            perror("Failed to set SO_REUSEADDR on video socket");
+        }
+    }
 
     // Bind video socket to receive video data
     struct sockaddr_in client_addr;
     memset(&client_addr, 0, sizeof(client_addr));
     client_addr.sin_family = AF_INET;
     client_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    client_addr.sin_port = htons(VIDEO_PORT);
+    client_addr.sin_port = htons(config.video_port);
 
     if (bind(state->video_socket, (struct sockaddr*)&client_addr, sizeof(client_addr)) < 0) {
         perror("Failed to bind video socket");
@@ -114,15 +256,73 @@ bool init_network(ClientState *state) {
         return false;
     }
 
+    // Multicast: frames arrive on the group, retransmissions still unicast on the same port
+    if (VIDEO_MULTICAST) {
+        struct ip_mreq membership;
+        memset(&membership, 0, sizeof(membership));
+        membership.imr_multiaddr.s_addr = inet_addr(VIDEO_MULTICAST_GROUP);
+        membership.imr_interface.s_addr = inet_addr(VIDEO_MULTICAST_INTERFACE);
+        if (setsockopt(state->video_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                       &membership, sizeof(membership)) < 0) {
+            perror("Failed to join multicast group");
+            close(state->video_socket);
+            close(state->control_socket);
+            return false;
+        }
+        printf("Joined multicast group %s\n", VIDEO_MULTICAST_GROUP);
+    }
+
     // Set video socket to non-blocking
     int flags = fcntl(state->video_socket, F_GETFL, 0);
     fcntl(state->video_socket, F_SETFL, flags | O_NONBLOCK);
 
+    // Let the kernel queue several frames while the render loop is busy
+    int rcvbuf = config.receive_buffer_size;
+    if (rcvbuf > 0 && setsockopt(state->video_socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+        perror("Failed to set video socket receive buffer");
+    }
+
+    // Allocate the receive slot ring once
+    if (!udp_receiver_init(&state->video_receiver, state->video_socket,
+                           RECV_BATCH_SLOTS, MAX_DATAGRAM_SIZE)) {
+        close(state->video_socket);
+        close(state->control_socket);
+        return false;
+    }
+
+#ifdef __linux__
+    // The network thread (or the headless loop) sleeps in epoll on both sockets
+    state->network_epoll = epoll_create1(0);
+    int sockets[2] = {state->video_socket, state->control_socket};
+    for (int i = 0; i < 2; i++) {
+        struct epoll_event event = { .events = EPOLLIN, .data.fd = sockets[i] };
+        if (state->network_epoll < 0 ||
+            epoll_ctl(state->network_epoll, EPOLL_CTL_ADD, sockets[i], &event) < 0) {
+            perror("Failed to set up network epoll");
+            return false;
+        }
+    }
+#endif
+
     printf("UDP sockets initialized: Connected to %s (Video: port %d, Control: port %d)\n",
-          SERVER_IP, VIDEO_PORT, CONTROL_PORT);
+          config.server_ip, config.video_port, config.control_port);
     return true;
 }
 
+// Map fresh storage of `size` bytes for a display slot's upload buffer.
+// Respecifying the storage first lets the driver hand out new memory rather
+// than wait for an upload still reading the old. Render thread only.
+void map_upload_buffer(ClientState *state, int slot, size_t size) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, state->pbo_ids[slot]);
+    if (state->pbo_mapped[slot]) {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    state->pbo_mapped[slot] = (uint8_t *)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    state->pbo_size[slot] = size;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
 // Initialize GLFW and OpenGL
 bool init_graphics(ClientState *state) {
     printf("Initializing GLFW and OpenGL...\n");
@@ -137,7 +337,7 @@ bool init_graphics(ClientState *state) {
     glfwSetErrorCallback(error_callback);
 
     // Create window
-    state->window = glfwCreateWindow(FRAME_WIDTH, FRAME_HEIGHT, "Video Stream Client", NULL, NULL);
+    state->window = glfwCreateWindow(config.frame_width, config.frame_height, "Video Stream Client", NULL, NULL);
     if (!state->window) {
         fprintf(stderr, "Failed to create GLFW window\n");
         glfwTerminate();
@@ -147,8 +347,13 @@ bool init_graphics(ClientState *state) {
     // Make OpenGL context current
     glfwMakeContextCurrent(state->window);
 
-    // Set resize callback
+    // Set resize and damage callbacks
     glfwSetFramebufferSizeCallback(state->window, resize_callback);
+    glfwSetWindowRefreshCallback(state->window, refresh_callback);
+
+    // Swaps wait for vblank: the display paces rendering, which only happens
+    // when a frame arrives
+    glfwSwapInterval(1);
 
     // Create texture
     glGenTextures(1, &state->texture_id);
@@ -160,15 +365,32 @@ bool init_graphics(ClientState *state) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // Initialize empty texture
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, FRAME_WIDTH, FRAME_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    // Initialize empty texture (rows of RGB24 are tightly packed)
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, config.frame_width, config.frame_height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    state->texture_width = config.frame_width;
+    state->texture_height = config.frame_height;
+
+    // Create the upload ring and map a buffer for every slot
+    glGenBuffers(PBO_COUNT, state->pbo_ids);
+    state->use_pbo = glGetError() == GL_NO_ERROR;
+    for (int i = 0; i < PBO_COUNT && state->use_pbo; i++) {
+        map_upload_buffer(state, i, (size_t)config.frame_width * config.frame_height * 3);
+        state->use_pbo = state->pbo_mapped[i] != NULL;
+    }
+    if (!state->use_pbo && state->pbo_ids[0]) {
+        glDeleteBuffers(PBO_COUNT, state->pbo_ids);
+        memset(state->pbo_ids, 0, sizeof(state->pbo_ids));
+        memset(state->pbo_mapped, 0, sizeof(state->pbo_mapped));
+    }
 
     // Clear screen to black
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     glfwSwapBuffers(state->window);
 
-    printf("GLFW and OpenGL initialized successfully\n");
+    printf("GLFW and OpenGL initialized successfully (%s texture upload)\n",
+           state->use_pbo ? "PBO" : "synchronous");
     return true;
 }
 
@@ -176,24 +398,22 @@ bool init_graphics(ClientState *state) {
 bool init_frame_buffers(ClientState *state) {
     printf("Initializing frame buffers...\n");
 
-    // Initialize current frame
-    state->current_frame.frame_id = 0;
-    state->current_frame.width = FRAME_WIDTH;
-    state->current_frame.height = FRAME_HEIGHT;
-    state->current_frame.total_chunks = 0;
-    state->current_frame.chunks_received = 0;
-    state->current_frame.chunks_status = NULL;
-    state->current_frame.frame_data = NULL;
-    state->current_frame.complete = false;
+    // Initialize the reassembly window (payloads are allocated on first use)
+    frame_rx_init(&state->assembler, PLAYOUT_DELAY_MS, deliver_frame, state);
+
+    // Frames handed to the render thread are allocated on first use too
+    triple_buffer_init(&state->display_buffers);
 
     // Initialize display frame
+    size_t rgb_size = (size_t)config.frame_width * config.frame_height * 3;
     state->display_frame.frame_id = 0;
-    state->display_frame.width = FRAME_WIDTH;
-    state->display_frame.height = FRAME_HEIGHT;
+    state->display_frame.width = config.frame_width;
+    state->display_frame.height = config.frame_height;
     state->display_frame.total_chunks = 0;
     state->display_frame.chunks_received = 0;
     state->display_frame.chunks_status = NULL;
-    state->display_frame.frame_data = malloc(FRAME_WIDTH * FRAME_HEIGHT * 3);
+    state->display_frame.frame_data = malloc(rgb_size + FRAME_BUFFER_PADDING);
+    state->display_frame.data_capacity = rgb_size + FRAME_BUFFER_PADDING;
     state->display_frame.complete = false;
 
     if (!state->display_frame.frame_data) {
@@ -202,175 +422,443 @@ bool init_frame_buffers(ClientState *state) {
     }
 
     // Clear display frame
-    memset(state->display_frame.frame_data, 0, FRAME_WIDTH * FRAME_HEIGHT * 3);
+    memset(state->display_frame.frame_data, 0, rgb_size);
 
-    printf("Frame buffers initialized\n");
+    printf("Frame buffers initialized (%s YUV conversion)\n", yuv_convert_backend());
     return true;
 }
 
-// Allocate or reallocate frame resources
-bool ensure_frame_resources(FrameBuffer *frame, uint32_t width, uint32_t height, uint32_t total_chunks) {
-    // Check if dimensions or chunk count changed
-    if (frame->width != width || frame->height != height ||
-        frame->total_chunks != total_chunks || !frame->frame_data) {
+// Make sure a display buffer can hold a width x height RGB frame
+bool ensure_display_size(FrameBuffer *display, uint32_t width, uint32_t height) {
+    size_t needed = (size_t)width * height * 3;
+    if (needed <= display->data_capacity) {
+        return true;
+    }
 
-        // Free old resources if they exist
-        if (frame->chunks_status) {
-            free(frame->chunks_status);
-            frame->chunks_status = NULL;
-        }
+    uint8_t *data = (uint8_t *)realloc(display->frame_data, needed);
+    if (!data) {
+        fprintf(stderr, "Failed to grow display frame buffer\n");
+        return false;
+    }
 
-        if (frame->frame_data) {
-            free(frame->frame_data);
-            frame->frame_data = NULL;
-        }
+    display->frame_data = data;
+    display->data_capacity = needed;
+    return true;
+}
+
+// Create (or replace) the decoder for an encoded transport codec
+bool ensure_decoder(ClientState *state, uint8_t codec) {
+    if (state->decoder_context && state->decoder_codec == codec) {
+        return true;
+    }
+
+    if (state->decoder_context) {
+        avcodec_free_context(&state->decoder_context);
+    }
+
+    enum AVCodecID codec_id = (codec == VIDEO_CODEC_H264) ? AV_CODEC_ID_H264 : AV_CODEC_ID_MJPEG;
+    const AVCodec *decoder = avcodec_find_decoder(codec_id);
+    if (!decoder) {
+        fprintf(stderr, "No decoder for transport codec %d\n", codec);
+        return false;
+    }
+
+    state->decoder_context = avcodec_alloc_context3(decoder);
+    if (!state->decoder_context) {
+        fprintf(stderr, "Could not allocate decoder context\n");
+        return false;
+    }
 
-        // Update frame properties
-        frame->width = width;
-        frame->height = height;
-        frame->total_chunks = total_chunks;
-        frame->chunks_received = 0;
-        frame->complete = false;
+    // One thread so each packet comes straight back out as a picture. LOW_DELAY
+    // is left off: zerolatency streams signal no reordering anyway, and
+    // passthrough sources may contain B-frames that need it.
+    state->decoder_context->thread_count = 1;
+    state->decoder_context->flags2 |= AV_CODEC_FLAG2_FAST;
 
-        // Allocate new resources
-        frame->chunks_status = (uint8_t *)calloc(total_chunks, sizeof(uint8_t));
-        frame->frame_data = (uint8_t *)malloc(width * height * 3);
+    if (avcodec_open2(state->decoder_context, decoder, NULL) < 0) {
+        fprintf(stderr, "Could not open decoder %s\n", decoder->name);
+        avcodec_free_context(&state->decoder_context);
+        return false;
+    }
+
+    if (!state->decode_packet) state->decode_packet = av_packet_alloc();
+    if (!state->decoded_frame) state->decoded_frame = av_frame_alloc();
+    if (!state->decode_packet || !state->decoded_frame) {
+        fprintf(stderr, "Could not allocate decoder packet or frame\n");
+        return false;
+    }
+
+    state->decoder_codec = codec;
+    state->waiting_for_keyframe = true;
+    printf("Decoder initialized: %s\n", decoder->name);
+    return true;
+}
+
+// Decode a completed encoded frame into `rgb` (RGB24 at the frame size)
+bool decode_frame(ClientState *state, FrameBuffer *frame, uint8_t *rgb) {
+    if (!ensure_decoder(state, frame->codec)) {
+        return false;
+    }
 
-        if (!frame->chunks_status || !frame->frame_data) {
-            fprintf(stderr, "Failed to allocate frame resources\n");
+    // H.264 frames reference earlier ones: after a gap, hold off until the next keyframe
+    bool keyframe = (frame->flags & FRAME_FLAG_KEYFRAME) != 0;
+    if (frame->codec == VIDEO_CODEC_H264 && frame->frame_id != state->last_decoded_frame_id + 1) {
+        state->waiting_for_keyframe = true;
+    }
+    state->last_decoded_frame_id = frame->frame_id;
+
+    if (state->waiting_for_keyframe) {
+        if (!keyframe) {
             return false;
         }
+        state->waiting_for_keyframe = false;
+    }
+
+    // Feed the assembled packet straight from the frame buffer
+    state->decode_packet->data = frame->frame_data;
+    state->decode_packet->size = frame->frame_size;
+    state->decode_packet->flags = keyframe ? AV_PKT_FLAG_KEY : 0;
 
-        // Initialize frame data to black
-        memset(frame->frame_data, 0, width * height * 3);
+    if (avcodec_send_packet(state->decoder_context, state->decode_packet) < 0) {
+        fprintf(stderr, "Error sending packet to decoder\n");
+        state->waiting_for_keyframe = true;
+        return false;
+    }
 
-        printf("Allocated frame resources: %dx%d, %d chunks\n", width, height, total_chunks);
+    if (avcodec_receive_frame(state->decoder_context, state->decoded_frame) < 0) {
+        return false;
     }
 
+    // Convert to RGB24 at the advertised frame size
+    AVFrame *decoded = state->decoded_frame;
+    state->rgb_sws_context = sws_getCachedContext(state->rgb_sws_context,
+        decoded->width, decoded->height, decoded->format,
+        frame->width, frame->height, AV_PIX_FMT_RGB24,
+        scaler_flags[config.scaler], NULL, NULL, NULL);
+    if (!state->rgb_sws_context) {
+        fprintf(stderr, "Could not initialize the conversion context\n");
+        return false;
+    }
+
+    uint8_t *dst_data[4] = {rgb, NULL, NULL, NULL};
+    int dst_linesize[4] = {(int)frame->width * 3, 0, 0, 0};
+    sws_scale(state->rgb_sws_context,
+              (const uint8_t * const *)decoded->data, decoded->linesize,
+              0, decoded->height, dst_data, dst_linesize);
     return true;
 }
 
-// Reset frame for new frame ID
-void reset_frame(FrameBuffer *frame, uint32_t frame_id) {
-    frame->frame_id = frame_id;
-    frame->chunks_received = 0;
-    frame->complete = false;
+// Bytes of a full raw frame
+size_t raw_frame_size(uint8_t codec, uint32_t width, uint32_t height) {
+    return codec == VIDEO_CODEC_RAW_YUV420 ? yuv420_frame_size(width, height) : (size_t)width * height * 3;
+}
+
+// A delta only applies on top of the frame sent right before it
+bool raw_delta_follows(const ClientState *state, const FrameBuffer *frame) {
+    return state->raw_valid && frame->frame_id == state->raw_frame_id + 1 &&
+           frame->codec == state->raw_codec &&
+           frame->width == state->raw_width && frame->height == state->raw_height;
+}
+
+// Bring a copy of the raw stream in `base` up to date: a full frame
+// replaces it (buffers are swapped, not copied), a delta frame patches its
+// tiles in, so `base` must hold the frame before it. Returns false when the
+// frame cannot be used.
+bool update_raw_frame(ClientState *state, FrameBuffer *frame, uint8_t **base, size_t *base_capacity) {
+    if (frame->flags & FRAME_FLAG_DELTA) {
+        if (!raw_delta_follows(state, frame) ||
+            !tile_delta_apply(*base, frame->codec, frame->width, frame->height,
+                              frame->frame_data, frame->frame_size)) {
+            state->raw_valid = false;
+            state->raw_waiting_for_keyframe = true;
+            return false;
+        }
+        state->raw_frame_id = frame->frame_id;
+        return true;
+    }
+
+    if (frame->frame_size != raw_frame_size(frame->codec, frame->width, frame->height)) {
+        fprintf(stderr, "Dropping raw frame %u: %u bytes for %ux%u\n",
+                frame->frame_id, frame->frame_size, frame->width, frame->height);
+        return false;
+    }
+
+    // Swap buffers: the assembled frame becomes the copy and the old copy
+    // is reused for assembly (every chunk overwrites it)
+    uint8_t *data = *base;
+    size_t capacity = *base_capacity;
+    *base = frame->frame_data;
+    *base_capacity = frame->data_capacity;
+    frame->frame_data = data;
+    frame->data_capacity = capacity;
+
+    state->raw_codec = frame->codec;
+    state->raw_width = frame->width;
+    state->raw_height = frame->height;
+    state->raw_frame_id = frame->frame_id;
+    state->raw_valid = true;
+    state->raw_waiting_for_keyframe = false;
+    return true;
+}
 
-    // Reset chunk status
-    if (frame->chunks_status) {
-        memset(frame->chunks_status, 0, frame->total_chunks);
+// Convert the YUV 4:2:0 copy into the display buffer
+bool convert_yuv_frame(ClientState *state, uint32_t width, uint32_t height) {
+    if (!ensure_display_size(&state->display_frame, width, height)) {
+        return false;
     }
+    yuv420_to_rgb24(state->yuv_frame, width, height, state->display_frame.frame_data);
+    return true;
 }
 
-// Process incoming video chunks
-void process_video_chunks(ClientState *state) {
-    // Allocate buffer for receiving chunks
-    uint8_t *chunk_buffer = (uint8_t *)malloc(sizeof(FrameChunkHeader) + MAX_PACKET_SIZE);
-    if (!chunk_buffer) {
-        fprintf(stderr, "Failed to allocate chunk buffer\n");
+// Hand a completed frame to the render thread: decode or convert it into
+// the back slot's mapped upload buffer (or its display buffer when the
+// buffer is missing or too small), publish that and wake the render thread up
+void present_frame(ClientState *state, FrameBuffer *frame) {
+    int slot = state->display_buffers.back;
+    FrameBuffer *display = &state->display_frames[slot];
+    size_t size = (size_t)frame->width * frame->height * 3;
+    uint8_t *target = state->pbo_mapped[slot];
+    state->pbo_filled[slot] = target && size <= state->pbo_size[slot];
+    if (!state->pbo_filled[slot]) {
+        if (!ensure_display_size(display, frame->width, frame->height)) {
+            return;
+        }
+        target = display->frame_data;
+    }
+
+    if (frame->codec == VIDEO_CODEC_RAW_RGB24 && state->use_pbo) {
+        // Mapped memory is write-only and changes every frame, so deltas
+        // patch the copy in display_frame, which then goes to the buffer
+        if (!update_raw_frame(state, frame, &state->display_frame.frame_data,
+                              &state->display_frame.data_capacity)) {
+            return;
+        }
+        memcpy(target, state->display_frame.frame_data, size);
+    } else if (frame->codec == VIDEO_CODEC_RAW_RGB24) {
+        // A full frame is swapped into the back buffer. A delta patches a
+        // copy of the last published frame, which is the one right before
+        // it whenever the delta applies.
+        if ((frame->flags & FRAME_FLAG_DELTA) && raw_delta_follows(state, frame)) {
+            memcpy(display->frame_data, state->display_frames[state->display_published].frame_data, size);
+        }
+        if (!update_raw_frame(state, frame, &display->frame_data, &display->data_capacity)) {
+            return;
+        }
+    } else if (frame->codec == VIDEO_CODEC_RAW_YUV420) {
+        if (!update_raw_frame(state, frame, &state->yuv_frame, &state->yuv_capacity)) {
+            return;
+        }
+        yuv420_to_rgb24(state->yuv_frame, frame->width, frame->height, target);
+    } else if (!decode_frame(state, frame, target)) {
         return;
     }
 
-    // Process all available chunks
-    while (1) {
-        // Try to receive a chunk
-        struct sockaddr_in sender_addr;
-        socklen_t sender_addr_len = sizeof(sender_addr);
+    display->width = frame->width;
+    display->height = frame->height;
+    display->frame_id = frame->frame_id;
+    display->complete = true;
+
+    // Carry the frame's timestamps through to the screen
+    display->server_decode_ns = frame->server_decode_ns;
+    display->server_capture_us = frame->server_capture_us;
+    display->server_scale_us = frame->server_scale_us;
+    display->server_send_us = frame->server_send_us;
+    display->first_chunk_ns = frame->first_chunk_ns;
+    display->complete_ns = frame->complete_ns;
+    display->present_ns = monotonic_ns();
+
+    state->display_published = state->display_buffers.back;
+    triple_buffer_publish(&state->display_buffers);
+    glfwPostEmptyEvent();
+
+    // Mark that we've displayed this frame
+    state->frames_displayed++;
+
+    if (state->frames_displayed % 30 == 0) {
+        printf("Received frame %u (complete with %u chunks, %u bytes)\n",
+               frame->frame_id, frame->total_chunks, frame->frame_size);
+    }
+}
+
+// Headless: record a raw frame once any delta is patched in. Remuxing
+// writes the whole frame, since a delta payload means nothing to a player.
+void record_raw_frame(ClientState *state, FrameBuffer *frame) {
+    bool yuv = frame->codec == VIDEO_CODEC_RAW_YUV420;
+    if (!update_raw_frame(state, frame, yuv ? &state->yuv_frame : &state->display_frame.frame_data,
+                          yuv ? &state->yuv_capacity : &state->display_frame.data_capacity)) {
+        return;
+    }
+
+    uint8_t *base = yuv ? state->yuv_frame : state->display_frame.frame_data;
+    if (!recorder_wants_rgb(&state->recorder)) {
+        FrameBuffer full = *frame;
+        full.frame_data = base;
+        full.frame_size = (uint32_t)raw_frame_size(frame->codec, frame->width, frame->height);
+        full.flags = FRAME_FLAG_KEYFRAME;
+        recorder_write_packet(&state->recorder, &full);
+    } else if (!yuv) {
+        recorder_write_rgb(&state->recorder, base, frame->width, frame->height);
+    } else if (convert_yuv_frame(state, frame->width, frame->height)) {
+        recorder_write_rgb(&state->recorder, state->display_frame.frame_data,
+                           frame->width, frame->height);
+    }
+}
+
+// Headless: record (or just count) a completed frame, decoding only when the output needs pixels
+void output_frame(ClientState *state, FrameBuffer *frame) {
+    if (state->recording) {
+        if (frame->codec == VIDEO_CODEC_RAW_RGB24 || frame->codec == VIDEO_CODEC_RAW_YUV420) {
+            record_raw_frame(state, frame);
+        } else if (!recorder_wants_rgb(&state->recorder)) {
+            recorder_write_packet(&state->recorder, frame);
+        } else if (ensure_display_size(&state->display_frame, frame->width, frame->height) &&
+                   decode_frame(state, frame, state->display_frame.frame_data)) {
+            recorder_write_rgb(&state->recorder, state->display_frame.frame_data,
+                               frame->width, frame->height);
+        }
+    }
+
+    frame->present_ns = monotonic_ns();
+    record_frame_latency(state, frame, frame->present_ns);
 
-        int recv_size = recvfrom(state->video_socket, chunk_buffer,
-                                sizeof(FrameChunkHeader) + MAX_PACKET_SIZE, 0,
-                                (struct sockaddr*)&sender_addr, &sender_addr_len);
+    state->frames_displayed++;
+
+    if (state->frames_displayed % 30 == 0) {
+        printf("Received frame %u (complete with %u chunks, %u bytes)\n",
+               frame->frame_id, frame->total_chunks, frame->frame_size);
+    }
+}
 
-        if (recv_size <= 0) {
+// Assembler callback for each frame released in order
+void deliver_frame(void *context, FrameBuffer *frame) {
+    ClientState *state = (ClientState *)context;
+    if (state->headless) {
+        output_frame(state, frame);
+    } else {
+        present_frame(state, frame);
+    }
+}
+
+// Process incoming video chunks
+void process_video_chunks(ClientState *state) {
+    FrameChunk valid[RECV_BATCH_SLOTS];
+
+    // Drain the socket a batch at a time
+    while (1) {
+        int count = udp_receiver_recv(&state->video_receiver);
+        if (count <= 0) {
             // No more chunks or error
             break;
         }
 
-        // Check if we received at least a header
-        if ((size_t)recv_size < sizeof(FrameChunkHeader)) {
-            fprintf(stderr, "Received incomplete chunk header\n");
-            continue;
+        int num_valid = frame_rx_validate(&state->assembler, &state->video_receiver, count, valid);
+        for (int i = 0; i < num_valid; i++) {
+            frame_rx_apply(&state->assembler, &valid[i]);
         }
+    }
 
-        // Parse header
-        FrameChunkHeader *header = (FrameChunkHeader *)chunk_buffer;
+    // Hand finished (or overdue) frames to the display in order
+    frame_rx_release(&state->assembler);
+}
 
-        // Validate message type
-        if (header->msg_type != MSG_TYPE_FRAME_CHUNK) {
-            fprintf(stderr, "Received invalid message type: %d\n", header->msg_type);
-            continue;
-        }
+// Ask the server to resend chunks still missing
+void send_nacks(ClientState *state) {
+    frame_rx_send_nacks(&state->assembler, state->control_socket, &state->server_control_addr);
+}
 
-        // Validate chunk size
-        if (header->chunk_size > MAX_PACKET_SIZE ||
-            (size_t)recv_size != sizeof(FrameChunkHeader) + header->chunk_size) {
-            fprintf(stderr, "Received invalid chunk size\n");
-            continue;
-        }
+// Tell the server how the link is doing so it can adapt the stream
+void send_receiver_report(ClientState *state) {
+    frame_rx_send_report(&state->assembler, state->control_socket, &state->server_control_addr);
+}
 
-        // Check if this is a new frame
-        if (header->frame_id != state->current_frame.frame_id) {
-            // New frame
-            reset_frame(&state->current_frame, header->frame_id);
-        }
+// Upload the frame in display slot `slot` (front) to the texture. From its
+// upload buffer the copy is only queued for the driver (DMA), so this
+// returns without waiting for it; the slot then gets freshly mapped storage
+// for the frame it carries next. Texture storage is reallocated only when
+// the frame size changes.
+void update_texture(ClientState *state, int slot) {
+    const FrameBuffer *frame = &state->display_frames[slot];
+    uint32_t width = frame->width;
+    uint32_t height = frame->height;
+    size_t size = (size_t)width * height * 3;
+    glBindTexture(GL_TEXTURE_2D, state->texture_id);
+    if (width != state->texture_width || height != state->texture_height) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        state->texture_width = width;
+        state->texture_height = height;
+    }
 
-        // Ensure we have resources for this frame
-        if (!ensure_frame_resources(&state->current_frame, header->width, header->height,
-                                   header->total_chunks)) {
-            fprintf(stderr, "Failed to ensure frame resources\n");
-            continue;
+    if (state->pbo_filled[slot]) {
+        // Source the upload from the buffer (offset 0)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, state->pbo_ids[slot]);
+        if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, NULL);
         }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        state->pbo_mapped[slot] = NULL;
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, frame->frame_data);
+    }
 
-        // Process the chunk
-        uint32_t chunk_index = header->chunk_index;
+    // Map the slot again before the network thread gets it back, growing
+    // the buffer when a frame did not fit
+    if (state->use_pbo && (!state->pbo_mapped[slot] || state->pbo_size[slot] < size)) {
+        map_upload_buffer(state, slot, size > state->pbo_size[slot] ? size : state->pbo_size[slot]);
+    }
 
-        // Skip if we've already received this chunk
-        if (chunk_index >= header->total_chunks || state->current_frame.chunks_status[chunk_index]) {
-            continue;
-        }
+    // Time the upload of each frame
+    state->upload_ns = monotonic_ns();
+    state->swap_pending = true;
+}
 
-        // Copy chunk data to frame buffer
-        uint8_t *chunk_data = chunk_buffer + sizeof(FrameChunkHeader);
-        memcpy(state->current_frame.frame_data + header->chunk_offset, chunk_data, header->chunk_size);
-
-        // Mark chunk as received
-        state->current_frame.chunks_status[chunk_index] = 1;
-        state->current_frame.chunks_received++;
-        state->chunks_received++;
-
-        // Check if frame is complete
-        if (state->current_frame.chunks_received == state->current_frame.total_chunks) {
-            state->current_frame.complete = true;
-            state->frames_received++;
-
-            // Swap frames (copy current to display)
-            memcpy(state->display_frame.frame_data, state->current_frame.frame_data,
-                  state->current_frame.width * state->current_frame.height * 3);
-            state->display_frame.width = state->current_frame.width;
-            state->display_frame.height = state->current_frame.height;
-            state->display_frame.frame_id = state->current_frame.frame_id;
-            state->display_frame.complete = true;
-
-            // Mark that we've displayed this frame
-            state->frames_displayed++;
-
-            if (state->frames_displayed % 30 == 0) {
-                printf("Received frame %u (complete with %u chunks)\n",
-                       state->current_frame.frame_id, state->current_frame.total_chunks);
-            }
-        }
+// Record every stage of a frame that just reached the screen (headless: the output)
+void record_frame_latency(ClientState *state, const FrameBuffer *frame, uint64_t done_ns) {
+    // Server stamps in client clock
+    uint64_t decode_ns = frame->server_decode_ns - state->clock_offset_ns;
+    uint64_t send_ns = decode_ns + frame->server_send_us * 1000ull;
+
+    if (frame->server_capture_us) {
+        latency_record_ns(&state->server_capture, frame->server_capture_us * 1000ll);
+    }
+    latency_record_ns(&state->server_scale, frame->server_scale_us * 1000ll);
+    latency_record_ns(&state->server_queue, ((int64_t)frame->server_send_us - frame->server_scale_us) * 1000);
+    latency_record_ns(&state->assembly, frame->complete_ns - frame->first_chunk_ns);
+    latency_record_ns(&state->playout, frame->present_ns - frame->complete_ns);
+    if (!state->headless) {
+        latency_record_ns(&state->upload, state->upload_ns - frame->present_ns);
+        latency_record_ns(&state->swap, done_ns - state->upload_ns);
     }
 
-    free(chunk_buffer);
+    // Cross-clock stages need an offset estimate first
+    if (state->clock_sample_count > 0) {
+        latency_record_ns(&state->network, (int64_t)(frame->first_chunk_ns - send_ns));
+        latency_record_ns(&state->end_to_end, (int64_t)(done_ns - decode_ns));
+        if (frame->server_capture_us) {
+            uint64_t capture_ns = decode_ns - frame->server_capture_us * 1000ull;
+            latency_record_ns(&state->capture_to_glass, (int64_t)(done_ns - capture_ns));
+        }
+    }
 }
 
-// Update texture with current display frame
-void update_texture(ClientState *state) {
-    if (state->display_frame.complete) {
-        glBindTexture(GL_TEXTURE_2D, state->texture_id);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                    state->display_frame.width, state->display_frame.height,
-                    0, GL_RGB, GL_UNSIGNED_BYTE, state->display_frame.frame_data);
+// Print the per-stage latency histograms
+void print_latency_report(ClientState *state) {
+    printf("Latency (%u frames displayed, clock offset %.3f ms):\n",
+           state->frames_displayed, state->clock_offset_ns / 1e6);
+    if (state->server_capture.count > 0) {
+        latency_print(&state->server_capture, "server capture -> decode");
+    }
+    latency_print(&state->server_scale, "server decode -> scale");
+    latency_print(&state->server_queue, "server scale -> send");
+    latency_print(&state->network, "network");
+    latency_print(&state->assembly, "assembly");
+    latency_print(&state->playout, state->headless ? "playout/output" : "playout/decode");
+    if (!state->headless) {
+        latency_print(&state->upload, "texture upload");
+        latency_print(&state->swap, "swap");
+    }
+    latency_print(&state->end_to_end, state->headless ? "decode -> output" : "decode -> glass");
+    if (state->capture_to_glass.count > 0) {
+        latency_print(&state->capture_to_glass, state->headless ? "capture -> output" : "capture -> glass");
     }
 }
 
@@ -392,6 +880,19 @@ void render(ClientState *state) {
     glDisable(GL_TEXTURE_2D);
 
     glfwSwapBuffers(state->window);
+
+    if (state->swap_pending) {
+        state->swap_pending = false;
+        record_frame_latency(state, &state->display_frames[state->display_buffers.front], monotonic_ns());
+    }
+}
+
+// Encode the current control state and send it to the server
+void send_control_message(ClientState *state) {
+    uint8_t wire[CONTROL_MESSAGE_SIZE];
+    wire_encode_control(wire, &state->control_msg);
+    sendto(state->control_socket, wire, sizeof(wire), 0,
+          (struct sockaddr*)&state->server_control_addr, sizeof(state->server_control_addr));
 }
 
 // Send control input to server
@@ -400,19 +901,23 @@ void send_control_input(ClientState *state) {
     struct timeval current_time;
     gettimeofday(&current_time, NULL);
 
-    // Send control every 20ms (50Hz)
+    // Send control every CONTROL_INTERVAL_MS
     long elapsed_ms = (current_time.tv_sec - state->last_control_time.tv_sec) * 1000 +
                       (current_time.tv_usec - state->last_control_time.tv_usec) / 1000;
 
-    if (elapsed_ms < 20) {
+    if (elapsed_ms < CONTROL_INTERVAL_MS) {
         return;
     }
 
     // Update control message
     state->control_msg.msg_type = MSG_TYPE_CONTROL;
 
-    // Check for joystick
-    if (glfwJoystickPresent(GLFW_JOYSTICK_1)) {
+    if (state->headless) {
+        // No input devices without a window; neutral input keeps the server streaming
+        state->control_msg.x_axis = 0.0f;
+        state->control_msg.y_axis = 0.0f;
+        memset(state->control_msg.buttons, 0, sizeof(state->control_msg.buttons));
+    } else if (glfwJoystickPresent(GLFW_JOYSTICK_1)) {
         int count;
         const float *axes = glfwGetJoystickAxes(GLFW_JOYSTICK_1, &count);
         if (count >= 2) {
@@ -443,13 +948,106 @@ void send_control_input(ClientState *state) {
     }
 
     // Send control message
-    sendto(state->control_socket, &state->control_msg, sizeof(state->control_msg), 0,
-          (struct sockaddr*)&state->server_control_addr, sizeof(state->server_control_addr));
+    send_control_message(state);
 
     // Update timestamp
     state->last_control_time = current_time;
 }
 
+// Probe the server clock once per CLOCK_SYNC_INTERVAL_MS
+void send_clock_sync(ClientState *state) {
+    uint64_t now = monotonic_ns();
+    if (now - state->last_clock_sync_ns < CLOCK_SYNC_INTERVAL_MS * 1000000ull) {
+        return;
+    }
+
+    ClockSyncMessage probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.msg_type = MSG_TYPE_CLOCK_SYNC;
+    probe.client_send_ns = now;
+    uint8_t wire[CLOCK_SYNC_SIZE];
+    wire_encode_clock_sync(wire, &probe);
+    sendto(state->control_socket, wire, sizeof(wire), 0,
+           (struct sockaddr*)&state->server_control_addr, sizeof(state->server_control_addr));
+
+    state->last_clock_sync_ns = now;
+}
+
+// While the decoder (or the remuxer, or the raw copy after a lost delta)
+// waits for a keyframe, ask the server for one instead of waiting out the
+// GOP; repeated in case the request is lost
+void send_keyframe_request(ClientState *state) {
+    bool decoder_waiting = state->decoder_context && state->waiting_for_keyframe;
+    bool recorder_waiting = state->recording && !recorder_wants_rgb(&state->recorder) &&
+                            state->recorder.waiting_for_keyframe;
+    bool raw_waiting = state->raw_waiting_for_keyframe;
+    if (!decoder_waiting && !recorder_waiting && !raw_waiting) {
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    if (now - state->last_keyframe_request_ns < KEYFRAME_REQUEST_INTERVAL_MS * 1000000ull) {
+        return;
+    }
+
+    KeyframeRequest request;
+    memset(&request, 0, sizeof(request));
+    request.msg_type = MSG_TYPE_KEYFRAME_REQUEST;
+    request.last_frame_id = decoder_waiting ? state->last_decoded_frame_id
+                          : raw_waiting ? state->raw_frame_id : state->recorder.last_frame_id;
+    uint8_t wire[KEYFRAME_REQUEST_SIZE];
+    wire_encode_keyframe_request(wire, &request);
+    sendto(state->control_socket, wire, sizeof(wire), 0,
+           (struct sockaddr*)&state->server_control_addr, sizeof(state->server_control_addr));
+
+    state->last_keyframe_request_ns = now;
+}
+
+// Fold clock probe replies into the offset estimate
+void process_control_replies(ClientState *state) {
+    uint8_t wire[CLOCK_SYNC_SIZE];
+    ClockSyncMessage reply;
+
+    while (recvfrom(state->control_socket, wire, sizeof(wire), MSG_DONTWAIT, NULL, NULL) ==
+           (ssize_t)sizeof(wire)) {
+        uint64_t now = monotonic_ns();
+        if (!wire_decode_clock_sync(wire, &reply) || reply.client_send_ns > now) {
+            continue;
+        }
+
+        // Offset assuming a symmetric path; the server's hold time is not network delay
+        uint64_t server_hold = reply.server_send_ns - reply.server_recv_ns;
+        uint64_t round_trip = now - reply.client_send_ns;
+        ClockSample sample = {
+            .offset_ns = ((int64_t)(reply.server_recv_ns - reply.client_send_ns) +
+                          (int64_t)(reply.server_send_ns - now)) / 2,
+            .rtt_ns = round_trip > server_hold ? round_trip - server_hold : 0
+        };
+        state->clock_samples[state->clock_sample_count % CLOCK_SYNC_SAMPLES] = sample;
+        state->clock_sample_count++;
+
+        // The lowest RTT probe was least disturbed by queueing
+        uint32_t count = state->clock_sample_count < CLOCK_SYNC_SAMPLES
+                       ? state->clock_sample_count : CLOCK_SYNC_SAMPLES;
+        const ClockSample *best = &state->clock_samples[0];
+        for (uint32_t i = 1; i < count; i++) {
+            if (state->clock_samples[i].rtt_ns < best->rtt_ns) {
+                best = &state->clock_samples[i];
+            }
+        }
+        state->clock_offset_ns = best->offset_ns;
+    }
+}
+
+// Print the latency report when L is pressed
+void check_report_key(ClientState *state) {
+    bool down = glfwGetKey(state->window, GLFW_KEY_L) == GLFW_PRESS;
+    if (down && !state->report_key_down) {
+        print_latency_report(state);
+    }
+    state->report_key_down = down;
+}
+
 // Print statistics
 void print_statistics(ClientState *state) {
     struct timeval current_time;
@@ -460,8 +1058,12 @@ void print_statistics(ClientState *state) {
                       (current_time.tv_usec - state->last_stats_time.tv_usec) / 1000;
 
     if (elapsed_ms >= 1000) {
-        printf("Statistics: Frames received=%u, displayed=%u, chunks=%u\n",
-               state->frames_received, state->frames_displayed, state->chunks_received);
+        printf("Statistics: Frames received=%u, %s=%u, skipped=%u, chunks=%u (late %u), "
+               "FEC recovered=%u, NACKs=%u\n",
+               state->assembler.frames_received, state->headless ? "output" : "displayed",
+               state->frames_displayed, state->assembler.frames_skipped,
+               state->assembler.chunks_received, state->assembler.late_chunks,
+               state->assembler.chunks_recovered, state->assembler.nacks_sent);
 
         // Update timestamp
         state->last_stats_time = current_time;
@@ -473,28 +1075,203 @@ void cleanup(ClientState *state) {
     // Free network resources
     if (state->video_socket >= 0) close(state->video_socket);
     if (state->control_socket >= 0) close(state->control_socket);
+    if (state->network_epoll >= 0) close(state->network_epoll);
+    udp_receiver_free(&state->video_receiver);
 
     // Free frame buffers
-    if (state->current_frame.chunks_status) free(state->current_frame.chunks_status);
-    if (state->current_frame.frame_data) free(state->current_frame.frame_data);
+    frame_rx_free(&state->assembler);
     if (state->display_frame.chunks_status) free(state->display_frame.chunks_status);
     if (state->display_frame.frame_data) free(state->display_frame.frame_data);
+    for (int i = 0; i < PBO_COUNT; i++) {
+        free(state->display_frames[i].frame_data);
+    }
+    if (state->yuv_frame) free(state->yuv_frame);
+
+    // Free decoder
+    if (state->decoder_context) avcodec_free_context(&state->decoder_context);
+    if (state->decode_packet) av_packet_free(&state->decode_packet);
+    if (state->decoded_frame) av_frame_free(&state->decoded_frame);
+    if (state->rgb_sws_context) sws_freeContext(state->rgb_sws_context);
+
+    // Finish the recording (container trailer)
+    if (state->recording) recorder_close(&state->recorder);
 
     // Clean up OpenGL/GLFW
-    if (state->texture_id) glDeleteTextures(1, &state->texture_id);
-    if (state->window) glfwDestroyWindow(state->window);
-    glfwTerminate();
+    if (!state->headless) {
+        if (state->pbo_ids[0]) glDeleteBuffers(PBO_COUNT, state->pbo_ids);
+        if (state->texture_id) glDeleteTextures(1, &state->texture_id);
+        if (state->window) glfwDestroyWindow(state->window);
+        glfwTerminate();
+    }
 
     printf("Client cleanup complete\n");
 }
 
-int main() {
+// Leave the main loop on Ctrl-C; SIGUSR1 asks for a latency report
+void handle_signal(int signum) {
+    if (signum == SIGUSR1) {
+        atomic_store(&latency_report_requested, true);
+        return;
+    }
+    atomic_store(&client_running, false);
+}
+
+// Sleep until a datagram arrives on either socket or the next timer is due.
+// Timers only need a tight wake-up while a frame is incomplete.
+void wait_for_packets(ClientState *state) {
+    int timeout_ms = frame_rx_waiting(&state->assembler) ? NETWORK_POLL_MS : NETWORK_IDLE_MS;
+#ifdef __linux__
+    struct epoll_event events[2];
+    epoll_wait(state->network_epoll, events, 2, timeout_ms);
+#else
+    struct timeval timeout = {0, timeout_ms * 1000};
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(state->video_socket, &read_fds);
+    FD_SET(state->control_socket, &read_fds);
+    int max_fd = state->video_socket > state->control_socket ? state->video_socket : state->control_socket;
+    select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
+#endif
+}
+
+// One pass of the network side: receive and reassemble, ask for repairs,
+// report on the link and keep the clock offset fresh
+void service_network(ClientState *state) {
+    wait_for_packets(state);
+
+    process_video_chunks(state);
+    send_nacks(state);
+    send_keyframe_request(state);
+    send_receiver_report(state);
+
+    send_clock_sync(state);
+    process_control_replies(state);
+
+    print_statistics(state);
+}
+
+// Headless main loop: receive at line rate, no rendering or frame pacing
+void run_headless(ClientState *state) {
+    while (atomic_load(&client_running)) {
+        service_network(state);
+        send_control_input(state);
+        if (atomic_exchange(&latency_report_requested, false)) {
+            print_latency_report(state);
+        }
+    }
+
+    print_latency_report(state);
+}
+
+// Windowed: the network thread receives, repairs and decodes, and wakes the
+// render thread only when a frame is ready
+void *network_thread(void *arg) {
+    ClientState *state = (ClientState *)arg;
+    while (atomic_load(&client_running)) {
+        service_network(state);
+    }
+    return NULL;
+}
+
+// Seconds until the next control input is due
+double control_wait_seconds(ClientState *state) {
+    struct timeval current_time;
+    gettimeofday(&current_time, NULL);
+    long elapsed_ms = (current_time.tv_sec - state->last_control_time.tv_sec) * 1000 +
+                      (current_time.tv_usec - state->last_control_time.tv_usec) / 1000;
+    return elapsed_ms < CONTROL_INTERVAL_MS ? (CONTROL_INTERVAL_MS - elapsed_ms) / 1000.0 : 0.0;
+}
+
+// Windowed main loop (render thread): sleep until a frame, a window event or
+// the next control input, render only new frames, poll input
+void run_windowed(ClientState *state) {
+    pthread_t network;
+    if (pthread_create(&network, NULL, network_thread, state) != 0) {
+        fprintf(stderr, "Failed to start network thread\n");
+        return;
+    }
+
+    while (!glfwWindowShouldClose(state->window) && atomic_load(&client_running)) {
+        // The network thread posts an empty event for every frame
+        double wait = control_wait_seconds(state);
+        if (wait > 0.0) {
+            glfwWaitEventsTimeout(wait);
+        } else {
+            glfwPollEvents();
+        }
+
+        // Upload and render the newest frame (swaps wait for vblank)
+        if (triple_buffer_take(&state->display_buffers)) {
+            update_texture(state, state->display_buffers.front);
+            render(state);
+        } else if (redraw_requested) {
+            render(state);
+        }
+        redraw_requested = false;
+
+        // Send control input
+        send_control_input(state);
+
+        // Print latency histograms on demand
+        check_report_key(state);
+        if (atomic_exchange(&latency_report_requested, false)) {
+            print_latency_report(state);
+        }
+    }
+
+    atomic_store(&client_running, false);
+    pthread_join(network, NULL);
+}
+
+void print_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-H] [-o FILE] [-c FILE] [--key value ...]\n"
+            "  -H        headless: no window, frames are received and discarded\n"
+            "  -o FILE   headless, recording to FILE: .y4m (YUV 4:2:0), .rgb/.raw (RGB24)\n"
+            "            or any container libavformat knows (.mp4, .mkv: remuxed, no decode)\n",
+            name);
+    config_print_usage(stderr);
+}
+
+int main(int argc, char *argv[]) {
     printf("===== UDP Video Streaming Client Starting =====\n");
 
     // Initialize client state
     ClientState state = {0};
     state.video_socket = -1;
     state.control_socket = -1;
+    state.network_epoll = -1;
+
+    // Settings: defaults, then the -c file, then --key options
+    if (!config_parse_args(&config, argc, argv, "c:Ho:")) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *record_path = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:Ho:", config_long_options(), NULL)) != -1) {
+        switch (opt) {
+            case 0:
+            case 'c':
+                // Taken by config_parse_args
+                break;
+            case 'H':
+                state.headless = true;
+                break;
+            case 'o':
+                state.headless = true;
+                record_path = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGUSR1, handle_signal);
 
     // Initialize UDP sockets
     if (!init_network(&state)) {
@@ -503,10 +1280,20 @@ int main() {
         return EXIT_FAILURE;
     }
 
-    printf("Attempting to connect to server at %s:%d\n", SERVER_IP, CONTROL_PORT);
+    printf("Attempting to connect to server at %s:%d\n", config.server_ip, config.control_port);
 
-    // Initialize graphics
-    if (!init_graphics(&state)) {
+    // Initialize graphics (headless: open the recording instead)
+    if (state.headless) {
+        if (record_path) {
+            if (!recorder_open(&state.recorder, record_path)) {
+                fprintf(stderr, "Failed to open recording\n");
+                cleanup(&state);
+                return EXIT_FAILURE;
+            }
+            state.recording = true;
+        }
+        printf("Running headless (%s)\n", record_path ? "recording" : "discarding frames");
+    } else if (!init_graphics(&state)) {
         fprintf(stderr, "Failed to initialize graphics\n");
         cleanup(&state);
         return EXIT_FAILURE;
@@ -527,31 +1314,15 @@ int main() {
 
     // Send initial control message to establish connection
     state.control_msg.msg_type = MSG_TYPE_CONTROL;
-    sendto(state.control_socket, &state.control_msg, sizeof(state.control_msg), 0,
-          (struct sockaddr*)&state.server_control_addr, sizeof(state.server_control_addr));
+    send_control_message(&state);
 
     printf("Sent initial control message. Waiting for video...\n");
 
     // Main loop
-    while (!glfwWindowShouldClose(state.window)) {
-        // Process video chunks
-        process_video_chunks(&state);
-
-        // Update texture and render
-        update_texture(&state);
-        render(&state);
-
-        // Send control input
-        send_control_input(&state);
-
-        // Print statistics
-        print_statistics(&state);
-
-        // Poll events
-        glfwPollEvents();
-
-        // Small delay to prevent CPU hogging
-        usleep(1000);  // 1ms
+    if (state.headless) {
+        run_headless(&state);
+    } else {
+        run_windowed(&state);
     }
 
     printf("Exiting...\n");
@@ -3,71 +3,275 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/select.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavcodec/bsf.h>
 
 #include "common.h"
+#include "udp_batch.h"
+#include "fec.h"
+#include "frame_tx.h"
+#include "subscriber.h"
+#include "rate_control.h"
+#include "pipeline.h"
+#include "latency.h"
+#include "capture.h"
+#include "yuv.h"
+#include "tile_delta.h"
+#include "wire.h"
+#include "config.h"
+
+// Source, frame size and rate, socket buffers, pacing, thread affinity and
+// the scaler are runtime settings (config.h)
+
+// libswscale flags of each resize filter (config.h)
+static const int scaler_flags[] = {
+    [SCALER_BILINEAR] = SWS_BILINEAR,
+    [SCALER_FAST_BILINEAR] = SWS_FAST_BILINEAR,
+    [SCALER_POINT] = SWS_POINT,
+    [SCALER_BICUBIC] = SWS_BICUBIC,
+    [SCALER_AREA] = SWS_AREA,
+};
+
+// Transport configuration
+#define TRANSPORT_PASSTHROUGH 0            // 1 = forward the source's H.264 packets, no decode/encode
+#define TRANSPORT_CODEC VIDEO_CODEC_H264   // VIDEO_CODEC_RAW_YUV420 / _RAW_RGB24 ship uncompressed frames
+#define TRANSPORT_RAW (TRANSPORT_CODEC == VIDEO_CODEC_RAW_RGB24 || TRANSPORT_CODEC == VIDEO_CODEC_RAW_YUV420)
+#define ENCODER_BITRATE 2000000            // Encoder target bitrate in bits/s
+#define KEYFRAME_REQUEST_MIN_MS 250        // Forced keyframes at most this often, however many clients ask
+#define TILE_DELTA 0                       // 1 = raw transport sends only the tiles that changed, full once a second
+#define TILE_SIZE 32                       // Tile edge in pixels (even)
+#define TILE_DIFF_THRESHOLD 1.0            // Resend a tile when its mean |difference| per byte exceeds this (0 = any change)
+
+// Transmit configuration
+#define PACING_TXTIME 0                    // 1 = the fq qdisc spaces paced bursts (SO_TXTIME; needs `tc qdisc ... fq`)
+#define FEC_GROUP_SIZE 8                   // Data chunks per XOR parity chunk (0 = FEC off)
+#define RETRANSMIT_FRAMES 4                // Recent frames kept for NACK retransmission
+
+// Adaptive quality: every subscriber's receiver reports drive a rate
+// controller (rate_control.h), and the slowest one's target picks a rung of
+// quality_ladder and the encoder bitrate. Raw transport adapts resolution
+// and frame rate only; passthrough cannot adapt.
+#define ADAPTIVE_QUALITY 1                 // 0 = always the configured frame size and rate
+#define MIN_BITRATE 100000                 // Lowest encoder bitrate in bits/s
+#define MIN_BITS_PER_PIXEL 0.1             // Encoded rung needs this many bits per pixel to be worth it
+#define QUALITY_UPGRADE_MARGIN 1.25        // Step up only with this much headroom over the next rung
+#define QUALITY_HOLD_MS 2000               // Minimum time on a rung before stepping back up
+#define BITRATE_CHANGE_THRESHOLD 0.05      // Smaller encoder bitrate changes are not applied
+
+// Control configuration
+#define CONTROL_PRIORITY 50                // SCHED_FIFO priority of the control thread (0 = normal scheduling)
+#define CONTROL_WAIT_MS 100                // Longest control thread sleep (shutdown check)
+#define ACTUATION_INTERVAL_US 1000         // Period of the actuation loop picking up new commands
+
+// Pipeline configuration
+#define PIPELINE_DEPTH 4                   // Frame buffers circulating between two stages
+#define SEND_POOL_SIZE (PIPELINE_DEPTH + RETRANSMIT_FRAMES) // Send items in flight or held for NACKs
+
+// A frame payload ready to send: raw frame or encoded packet. Items are
+// refcounted: the send stage keeps a reference while the frame's datagrams
+// sit in the retransmit cache, since those datagrams point into the payload.
+typedef struct {
+    const uint8_t *data;                   // Payload: buffer or packet->data
+    size_t size;
+    uint8_t *buffer;                       // Owned storage for raw frames
+    size_t capacity;
+    AVPacket *packet;                      // Encoded packet, referenced rather than copied
+    atomic_int refs;
+    uint8_t codec;
+    uint8_t flags;
+    uint32_t width;
+    uint32_t height;
+    uint64_t capture_ns;                   // Camera capture (0 = file source)
+    uint64_t decode_ns;                    // Frame decoded (passthrough: packet read)
+    uint64_t scale_ns;                     // Frame scaled or encoded
+    uint64_t interval_ns;                  // Source time this item stands for: the next one goes out that much later
+} SendItem;
+
+// One rung of the adaptive quality ladder, best first
+typedef struct {
+    int width;
+    int height;
+    int frame_divisor;                     // Encode every nth source frame
+} QualityLevel;
+
+#define QUALITY_LEVELS 5
+
+// Built from the configured frame size by init_quality_ladder()
+static QualityLevel quality_ladder[QUALITY_LEVELS];
+
+// Runtime settings, parsed in main before any thread starts and read-only after
+static Config config;
+
+// A decoded frame on its way to the scale stage
+typedef struct {
+    AVFrame *frame;
+    uint64_t capture_ns;                   // Camera capture (0 = file source)
+    uint64_t decode_ns;
+} DecodedFrame;
 
-// Video source configuration
-#define VIDEO_PATH "video.mp4"   // Path to video file (or device)
-#define TARGET_FPS 30            // Target frames per second
+// Subscriber activity handed from the control thread to the send thread
+typedef struct {
+    uint8_t msg_type;                      // MSG_TYPE_CONTROL (keepalive), _NACK or _RECEIVER_REPORT
+    struct sockaddr_in from;
+    uint64_t recv_ns;
+    size_t length;                         // NACK datagram length
+    union {
+        NackMessage nack;
+        ReceiverReport report;
+    };
+} ControlEvent;
+
+// Newest command of the controlling client
+typedef struct {
+    ControlMessage message;
+    uint64_t recv_ns;                      // Its datagram was read (0 = none)
+} ControlCommand;
 
 // Server state
 typedef struct {
-    // UDP sockets
-    int video_socket;
+    // UDP sockets (video goes out through one socket per subscriber)
     int control_socket;
-
-    // Client address for video
-    struct sockaddr_in client_addr;
-    socklen_t client_addr_len;
+    int control_epoll;                     // Control thread waits here (Linux)
 
     // FFmpeg components
     AVFormatContext *format_context;
     AVCodecContext *codec_context;
     struct SwsContext *sws_context;
-    AVFrame *frame;
     AVPacket *packet;
 
+    // Live source (camera or raw stand-in) instead of the demuxer; the
+    // decoder above is only used for MJPEG cameras
+    bool live;
+    Capture capture;
+
+    // Passthrough (Annex B conversion with in-band SPS/PPS)
+    AVBSFContext *bsf_context;
+
+    // Encoder (unused for raw transport)
+    AVCodecContext *encoder_context;
+    AVFrame *encoder_frame;
+    AVPacket *encoded_packet;
+
+    // Raw transport with TILE_DELTA: the receivers' copy of the frame
+    TileEncoder tiles;
+
     // Video stream info
     int video_stream_index;
     uint32_t frame_count;
-    uint32_t chunk_count;
 
-    // Frame buffer
-    uint8_t *rgb_buffer;
+    // Pipeline: decode -> scale/encode -> send, connected by SPSC queues of
+    // pooled buffers that flow back upstream once consumed
+    AVFrame *frame_pool[PIPELINE_DEPTH];
+    SendItem item_pool[SEND_POOL_SIZE];
+    SpscQueue decoded_queue;               // decode -> scale (DecodedFrame)
+    SpscQueue free_frame_queue;            // scale -> decode (AVFrame *)
+    SpscQueue send_queue;                  // scale, or decode in passthrough -> send (SendItem *)
+    SpscQueue free_item_queue;             // send -> producer (SendItem *)
+    SpscQueue control_queue;               // control -> send (ControlEvent)
+    Doorbell send_doorbell;                // Wakes the send thread for new items and NACKs
+
+    // Per-stage latency, recorded by the send thread
+    LatencyHistogram capture_to_decode;    // Live sources only
+    LatencyHistogram decode_to_scale;
+    LatencyHistogram scale_to_send;
+    LatencyHistogram send_duration;        // First to last chunk of a frame
+    LatencyHistogram decode_to_sent;       // Decode done to last chunk sent
+
+    // Chunking, FEC and the retransmit cache, and the viewers every frame
+    // fans out to (send thread only)
+    FrameTx frame_tx;
+    SubscriberTable subscribers;
+
+    // Control state: the first client to connect drives until it goes quiet
+    // (control thread only)
+    struct sockaddr_in controller_addr;
+    uint64_t controller_seen_ns;           // 0 = nobody in control
+
+    // The control thread publishes the newest command, the actuation loop
+    // picks it up without either side waiting for the other
+    Seqlock command_lock;
+    ControlCommand command;
+    LatencyHistogram command_to_actuation; // Actuation loop only
+
+    // Keyframe requests: set by the control thread, consumed by the encoder
+    // (or the tile encoder, which answers with a full frame)
+    atomic_bool keyframe_requested;
+    uint64_t last_forced_keyframe_ns;
+
+    // Adaptive quality: the send thread publishes the subscribers' target,
+    // the scale thread moves along the ladder (scale thread only below)
+    atomic_uint target_bitrate_kbps;       // 0 = no receiver reports yet
+    int quality_level;                     // Index into quality_ladder
+    uint64_t quality_changed_ns;
+} ServerState;
 
-    // Control state
-    ControlMessage last_control;
-    bool client_connected;
+// Cleared by SIGINT/SIGTERM to wind the pipeline down
+static atomic_bool server_running = true;
+
+// Set by SIGUSR1; the send thread prints its latency histograms
+static atomic_bool latency_report_requested = false;
+
+// Full size, three quarters, half, half at half rate, quarter at half rate
+void init_quality_ladder(void) {
+    static const struct { int num, den, frame_divisor; } rungs[QUALITY_LEVELS] = {
+        {1, 1, 1}, {3, 4, 1}, {1, 2, 1}, {1, 2, 2}, {1, 4, 2},
+    };
+    for (int i = 0; i < QUALITY_LEVELS; i++) {
+        quality_ladder[i].width = (config.frame_width * rungs[i].num / rungs[i].den) & ~1;
+        quality_ladder[i].height = (config.frame_height * rungs[i].num / rungs[i].den) & ~1;
+        quality_ladder[i].frame_divisor = rungs[i].frame_divisor;
+    }
+}
 
-    // Timing
-    struct timeval last_frame_time;
-} ServerState;
+// Bitrate a ladder rung needs: raw frames are a fixed size, encoded ones need
+// enough bits per pixel to look better than the rung below
+uint64_t quality_level_bitrate(const QualityLevel *level) {
+    double pixel_rate = (double)level->width * level->height * config.target_fps / level->frame_divisor;
+    if (TRANSPORT_CODEC == VIDEO_CODEC_RAW_RGB24) {
+        return (uint64_t)(pixel_rate * 24);
+    }
+    if (TRANSPORT_CODEC == VIDEO_CODEC_RAW_YUV420) {
+        return (uint64_t)(pixel_rate * 12);
+    }
+    return (uint64_t)(pixel_rate * MIN_BITS_PER_PIXEL);
+}
+
+// Range the rate controllers work in
+uint64_t max_stream_bitrate(void) {
+    return TRANSPORT_RAW ? quality_level_bitrate(&quality_ladder[0]) : ENCODER_BITRATE;
+}
+
+uint64_t min_stream_bitrate(void) {
+    return TRANSPORT_RAW
+         ? quality_level_bitrate(&quality_ladder[QUALITY_LEVELS - 1]) : MIN_BITRATE;
+}
 
 // Initialize UDP sockets
 bool init_network(ServerState *state) {
     printf("Initializing UDP sockets...\n");
 
-    // Create video socket
-    state->video_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (state->video_socket < 0) {
-        perror("Failed to create video socket");
-        return false;
-    }
-
     // Create control socket
     state->control_socket = socket(AF_INET, SOCK_DGRAM, 0);
     if (state->control_socket < 0) {
         perror("Failed to create control socket");
-        close(state->video_socket);
         return false;
     }
 
@@ -76,36 +280,136 @@ bool init_network(ServerState *state) {
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    server_addr.sin_port = htons(CONTROL_PORT);
+    server_addr.sin_port = htons(config.control_port);
 
     // Bind control socket
     if (bind(state->control_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("Failed to bind control socket");
-        close(state->video_socket);
         close(state->control_socket);
         return false;
     }
 
-    // Set control socket to non-blocking mode
+    // Subscribers get a video socket with room for a whole frame burst when they join
+    subscribers_init(&state->subscribers, config.video_port, config.packet_size,
+                     (uint64_t)(config.pacing_rate_mbps * 1e6), config.send_buffer_size);
+    subscribers_set_bitrate_range(&state->subscribers, min_stream_bitrate(), max_stream_bitrate());
+    if (PACING_TXTIME) {
+        subscribers_enable_txtime(&state->subscribers);
+    }
+
+    // Multicast: one copy of each frame for every viewer; subscriber sockets only retransmit
+    if (VIDEO_MULTICAST &&
+        !subscribers_enable_multicast(&state->subscribers, VIDEO_MULTICAST_GROUP, config.video_port,
+                                      VIDEO_MULTICAST_TTL, VIDEO_MULTICAST_INTERFACE)) {
+        close(state->control_socket);
+        return false;
+    }
+
+    // Set control socket to non-blocking mode, clock sync replies marked like control input
     int flags = fcntl(state->control_socket, F_GETFL, 0);
     fcntl(state->control_socket, F_SETFL, flags | O_NONBLOCK);
+    udp_set_dscp(state->control_socket, CONTROL_DSCP);
+
+#ifdef __linux__
+    // The control thread sleeps in epoll until a datagram arrives
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = state->control_socket };
+    state->control_epoll = epoll_create1(0);
+    if (state->control_epoll < 0 ||
+        epoll_ctl(state->control_epoll, EPOLL_CTL_ADD, state->control_socket, &event) < 0) {
+        perror("Failed to set up control epoll");
+        return false;
+    }
+#endif
+
+    if (FEC_GROUP_SIZE > 0) {
+        printf("FEC: one parity chunk per %d data chunks (%s XOR)\n",
+               FEC_GROUP_SIZE, fec_xor_backend());
+    }
+
+    printf("UDP sockets initialized: Video port: %d, Control port: %d, up to %d subscribers\n",
+           config.video_port, config.control_port, MAX_SUBSCRIBERS);
+    return true;
+}
+
+// Set up packet passthrough: MP4 stores H.264 length-prefixed with SPS/PPS in
+// extradata, h264_mp4toannexb rewrites it to start codes and repeats SPS/PPS
+// in-band ahead of every keyframe
+bool init_passthrough(ServerState *state) {
+    AVStream *stream = state->format_context->streams[state->video_stream_index];
+    if (stream->codecpar->codec_id != AV_CODEC_ID_H264) {
+        fprintf(stderr, "Passthrough needs an H.264 source\n");
+        return false;
+    }
+
+    const AVBitStreamFilter *filter = av_bsf_get_by_name("h264_mp4toannexb");
+    if (!filter) {
+        fprintf(stderr, "h264_mp4toannexb bitstream filter not available\n");
+        return false;
+    }
+
+    if (av_bsf_alloc(filter, &state->bsf_context) < 0) {
+        fprintf(stderr, "Could not allocate bitstream filter\n");
+        return false;
+    }
+
+    if (avcodec_parameters_copy(state->bsf_context->par_in, stream->codecpar) < 0) {
+        fprintf(stderr, "Could not copy codec parameters to bitstream filter\n");
+        return false;
+    }
+    state->bsf_context->time_base_in = stream->time_base;
+
+    if (av_bsf_init(state->bsf_context) < 0) {
+        fprintf(stderr, "Could not initialize bitstream filter\n");
+        return false;
+    }
+
+    printf("Transport: H.264 passthrough at source resolution %dx%d\n",
+           stream->codecpar->width, stream->codecpar->height);
+    return true;
+}
+
+// Open a camera or raw stand-in; MJPEG cameras also need a decoder
+bool init_capture(ServerState *state) {
+    if (TRANSPORT_PASSTHROUGH) {
+        fprintf(stderr, "Passthrough needs an H.264 file source\n");
+        return false;
+    }
+
+    if (!capture_open(&state->capture, config.video_path, config.capture_width, config.capture_height,
+                      config.target_fps, config.capture_format)) {
+        return false;
+    }
+    state->live = true;
 
-    // Initialize client address structure
-    state->client_addr_len = sizeof(state->client_addr);
-    memset(&state->client_addr, 0, state->client_addr_len);
+    // Captured MJPEG frames arrive as packets
+    state->packet = av_packet_alloc();
+    if (!state->packet) {
+        fprintf(stderr, "Could not allocate packet\n");
+        return false;
+    }
 
-    printf("UDP sockets initialized: Video port: %d, Control port: %d\n",
-           VIDEO_PORT, CONTROL_PORT);
+    if (state->capture.mjpeg) {
+        const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+        state->codec_context = codec ? avcodec_alloc_context3(codec) : NULL;
+        if (!state->codec_context || avcodec_open2(state->codec_context, codec, NULL) < 0) {
+            fprintf(stderr, "Could not open the MJPEG decoder\n");
+            return false;
+        }
+    }
     return true;
 }
 
 // Initialize FFmpeg and open video
 bool init_video(ServerState *state) {
-    printf("Initializing FFmpeg and opening video: %s\n", VIDEO_PATH);
+    printf("Initializing FFmpeg and opening video: %s\n", config.video_path);
+
+    if (capture_is_live(config.video_path)) {
+        return init_capture(state);
+    }
 
     // Open input file
-    if (avformat_open_input(&state->format_context, VIDEO_PATH, NULL, NULL) != 0) {
-        fprintf(stderr, "Could not open input file '%s'\n", VIDEO_PATH);
+    if (avformat_open_input(&state->format_context, config.video_path, NULL, NULL) != 0) {
+        fprintf(stderr, "Could not open input file '%s'\n", config.video_path);
         return false;
     }
 
@@ -132,6 +436,16 @@ bool init_video(ServerState *state) {
     AVCodecParameters *codec_params = state->format_context->streams[state->video_stream_index]->codecpar;
     printf("Original video dimensions: %dx%d\n", codec_params->width, codec_params->height);
 
+    // Passthrough never decodes, so it only needs a packet
+    if (TRANSPORT_PASSTHROUGH) {
+        state->packet = av_packet_alloc();
+        if (!state->packet) {
+            fprintf(stderr, "Could not allocate packet\n");
+            return false;
+        }
+        return init_passthrough(state);
+    }
+
     // Find decoder
     const AVCodec *codec = avcodec_find_decoder(codec_params->codec_id);
     if (!codec) {
@@ -158,50 +472,230 @@ bool init_video(ServerState *state) {
         return false;
     }
 
-    // Allocate frame and packet
-    state->frame = av_frame_alloc();
+    // Allocate packet (decoded frames come from the pipeline pool)
     state->packet = av_packet_alloc();
-    if (!state->frame || !state->packet) {
-        fprintf(stderr, "Could not allocate frame or packet\n");
+    if (!state->packet) {
+        fprintf(stderr, "Could not allocate packet\n");
         return false;
     }
 
-    // Initialize SWS context for scaling
-    state->sws_context = sws_getContext(
-        state->codec_context->width, state->codec_context->height, state->codec_context->pix_fmt,
-        FRAME_WIDTH, FRAME_HEIGHT, AV_PIX_FMT_RGB24,
-        SWS_BILINEAR, NULL, NULL, NULL
-    );
+    // The scaler is set up from the first decoded frame (update_scaler)
+    printf("FFmpeg initialized successfully\n");
+    return true;
+}
 
-    if (!state->sws_context) {
-        fprintf(stderr, "Could not initialize the conversion context\n");
+// Create the transport encoder for one quality ladder rung
+bool open_encoder(ServerState *state, int width, int height, int frame_divisor, int64_t bit_rate) {
+    // Find encoder, preferring the low latency software H.264 encoders
+    const AVCodec *codec = NULL;
+    if (TRANSPORT_CODEC == VIDEO_CODEC_H264) {
+        codec = avcodec_find_encoder_by_name("libx264");
+        if (!codec) codec = avcodec_find_encoder_by_name("libopenh264");
+        if (!codec) codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    } else {
+        codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    }
+
+    if (!codec) {
+        fprintf(stderr, "No encoder available for transport codec %d\n", TRANSPORT_CODEC);
         return false;
     }
 
-    // Allocate RGB buffer
-    state->rgb_buffer = (uint8_t *)malloc(FRAME_WIDTH * FRAME_HEIGHT * 3);
-    if (!state->rgb_buffer) {
-        fprintf(stderr, "Failed to allocate RGB buffer\n");
+    // Create encoder context
+    state->encoder_context = avcodec_alloc_context3(codec);
+    if (!state->encoder_context) {
+        fprintf(stderr, "Could not allocate encoder context\n");
         return false;
     }
 
-    printf("FFmpeg initialized successfully\n");
+    // Timestamps count source frames, so a reduced frame rate leaves gaps in pts
+    AVCodecContext *enc = state->encoder_context;
+    enc->width = width;
+    enc->height = height;
+    enc->time_base = (AVRational){1, config.target_fps};
+    enc->framerate = (AVRational){config.target_fps, frame_divisor};
+    enc->pix_fmt = (TRANSPORT_CODEC == VIDEO_CODEC_MJPEG) ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P;
+    enc->bit_rate = bit_rate;
+    enc->gop_size = config.target_fps / frame_divisor;  // A keyframe every second
+    enc->max_b_frames = 0;
+    enc->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+    // Zero latency tuning: no lookahead, no frame threading, headers repeated on keyframes
+    AVDictionary *options = NULL;
+    if (strcmp(codec->name, "libx264") == 0) {
+        av_dict_set(&options, "preset", "ultrafast", 0);
+        av_dict_set(&options, "tune", "zerolatency", 0);
+        av_dict_set(&options, "forced-idr", "1", 0);
+    }
+
+    int ret = avcodec_open2(enc, codec, &options);
+    av_dict_free(&options);
+    if (ret < 0) {
+        fprintf(stderr, "Could not open encoder %s\n", codec->name);
+        return false;
+    }
+
+    // Allocate encoder input frame
+    state->encoder_frame = av_frame_alloc();
+    if (!state->encoder_frame) {
+        fprintf(stderr, "Could not allocate encoder frame\n");
+        return false;
+    }
+
+    state->encoder_frame->format = enc->pix_fmt;
+    state->encoder_frame->width = width;
+    state->encoder_frame->height = height;
+    if (av_frame_get_buffer(state->encoder_frame, 32) < 0) {
+        fprintf(stderr, "Could not allocate encoder frame buffer\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Initialize the transport encoder
+bool init_encoder(ServerState *state) {
+    if (TRANSPORT_PASSTHROUGH) {
+        return true;
+    }
+
+    if (TRANSPORT_RAW) {
+        printf("Transport: raw %s\n", TRANSPORT_CODEC == VIDEO_CODEC_RAW_YUV420 ? "YUV 4:2:0" : "RGB24");
+        if (TILE_DELTA) {
+            printf("Tile deltas: %dx%d tiles, resent above %.1f mean difference (%s), full every %d frames\n",
+                   TILE_SIZE, TILE_SIZE, TILE_DIFF_THRESHOLD, tile_diff_backend(), config.target_fps);
+        }
+        return true;
+    }
+
+    state->encoded_packet = av_packet_alloc();
+    if (!state->encoded_packet) {
+        fprintf(stderr, "Could not allocate encoder packet\n");
+        return false;
+    }
+
+    if (!open_encoder(state, config.frame_width, config.frame_height, 1, ENCODER_BITRATE)) {
+        return false;
+    }
+
+    printf("Transport: %s at %d kbit/s, keyframe every %d frames\n",
+           state->encoder_context->codec->name, ENCODER_BITRATE / 1000, config.target_fps);
+    return true;
+}
+
+// Make sure a send item's own buffer can hold `size` bytes
+bool ensure_item_capacity(SendItem *item, size_t size) {
+    if (size <= item->capacity) {
+        return true;
+    }
+
+    uint8_t *buffer = (uint8_t *)realloc(item->buffer, size);
+    if (!buffer) {
+        fprintf(stderr, "Failed to grow send item\n");
+        return false;
+    }
+
+    item->buffer = buffer;
+    item->capacity = size;
+    return true;
+}
+
+// Duration of `frames` frames at the target frame rate
+uint64_t frames_interval_ns(int frames) {
+    return frames * 1000000000ull / config.target_fps;
+}
+
+// Take a free send item, waiting for the send stage to hand one back
+SendItem *acquire_send_item(ServerState *state) {
+    SendItem *item;
+    while (!spsc_pop(&state->free_item_queue, &item)) {
+        if (!atomic_load(&server_running)) {
+            return NULL;
+        }
+        pipeline_backoff();
+    }
+
+    // The producing stage holds the first reference
+    item->size = 0;
+    item->interval_ns = frames_interval_ns(1);
+    item->capture_ns = 0;
+    atomic_store(&item->refs, 1);
+    return item;
+}
+
+// Drop a reference; the last one returns the item to the pool.
+// Only the send stage releases items, so the free queue keeps one producer.
+void release_send_item(ServerState *state, SendItem *item) {
+    if (atomic_fetch_sub(&item->refs, 1) != 1) {
+        return;
+    }
+
+    av_packet_unref(item->packet);
+    spsc_push(&state->free_item_queue, &item);
+}
+
+// Called by the frame sender when a frame leaves the retransmit cache
+void release_cached_item(void *context, void *owner) {
+    release_send_item((ServerState *)context, (SendItem *)owner);
+}
+
+// Hand a filled send item to the send stage. Items circulate in a fixed
+// pool, so the queue only stays full when the send stage has stopped:
+// returns false on shutdown and leaves the item to cleanup().
+bool submit_send_item(ServerState *state, SendItem *item) {
+    while (!spsc_push(&state->send_queue, &item)) {
+        if (!atomic_load(&server_running)) {
+            return false;
+        }
+        pipeline_backoff();
+    }
+    doorbell_ring(&state->send_doorbell);
     return true;
 }
 
-// Read and process a single video frame
-bool process_frame(ServerState *state) {
-    // Check if we need a new packet
+// Next live frame: raw formats are referenced in place, MJPEG is decoded
+bool capture_next_frame(ServerState *state, AVFrame *frame, uint64_t *capture_ns) {
+    switch (capture_read(&state->capture, frame, state->packet, capture_ns)) {
+        case CAPTURE_FRAME:
+            return true;
+
+        case CAPTURE_PACKET: {
+            // Unreferencing the packet hands the buffer back to the driver
+            int ret = avcodec_send_packet(state->codec_context, state->packet);
+            av_packet_unref(state->packet);
+            if (ret < 0 || avcodec_receive_frame(state->codec_context, frame) < 0) {
+                fprintf(stderr, "Could not decode camera frame\n");
+                return false;
+            }
+            return true;
+        }
+
+        case CAPTURE_AGAIN:
+            return false;
+
+        default:
+            fprintf(stderr, "Video source lost, stopping\n");
+            atomic_store(&server_running, false);
+            return false;
+    }
+}
+
+// Demux and decode the next video frame into `frame`; live sources also
+// report when the frame was captured
+bool decode_next_frame(ServerState *state, AVFrame *frame, uint64_t *capture_ns) {
     int ret;
-    bool frame_available = false;
 
-    while (!frame_available) {
+    if (state->live) {
+        return capture_next_frame(state, frame, capture_ns);
+    }
+
+    while (1) {
         // Try to receive a frame from the existing packet
-        ret = avcodec_receive_frame(state->codec_context, state->frame);
+        ret = avcodec_receive_frame(state->codec_context, frame);
 
         if (ret == 0) {
             // We have a frame
-            frame_available = true;
+            return true;
         } else if (ret == AVERROR(EAGAIN)) {
             // Need more packets
             if (av_read_frame(state->format_context, state->packet) < 0) {
@@ -231,123 +725,792 @@ bool process_frame(ServerState *state) {
             return false;
         }
     }
+}
+
+// Point the scaler at this frame's size and format and the current rung
+// (straight to the encoder's input format when encoding or sending YUV). A camera's
+// format is only known once its frames arrive; unchanged parameters
+// keep the existing context.
+bool update_scaler(ServerState *state, const AVFrame *frame) {
+    const QualityLevel *level = &quality_ladder[state->quality_level];
+    enum AVPixelFormat scaled_format = (TRANSPORT_CODEC == VIDEO_CODEC_RAW_RGB24)
+                                     ? AV_PIX_FMT_RGB24 : AV_PIX_FMT_YUV420P;
+    state->sws_context = sws_getCachedContext(state->sws_context,
+        frame->width, frame->height, (enum AVPixelFormat)frame->format,
+        level->width, level->height, scaled_format,
+        scaler_flags[config.scaler], NULL, NULL, NULL);
+    if (!state->sws_context) {
+        fprintf(stderr, "Could not initialize the conversion context for %dx%d\n",
+                level->width, level->height);
+        return false;
+    }
+    return true;
+}
 
-    // Convert frame to RGB
-    uint8_t *dst_data[4] = {state->rgb_buffer, NULL, NULL, NULL};
-    int dst_linesize[4] = {FRAME_WIDTH * 3, 0, 0, 0};
+// Consume a client's keyframe request, at most once per KEYFRAME_REQUEST_MIN_MS.
+// A client lost sync (or joined a multicast stream mid-GOP) and would
+// otherwise wait for the next scheduled keyframe.
+bool take_keyframe_request(ServerState *state, uint64_t decode_ns) {
+    if (!atomic_exchange(&state->keyframe_requested, false) ||
+        decode_ns - state->last_forced_keyframe_ns < KEYFRAME_REQUEST_MIN_MS * 1000000ull) {
+        return false;
+    }
+    state->last_forced_keyframe_ns = decode_ns;
+    printf("Forcing a keyframe at frame %u (client request)\n", state->frame_count);
+    return true;
+}
+
+// Scale a decoded frame to the raw wire format straight into a send item:
+// RGB24, or packed I420 planes at half the size for the client to convert.
+// With TILE_DELTA the frame is scaled aside and only its changed tiles go
+// into the item, except for periodic and requested full frames.
+bool scale_to_raw(ServerState *state, const AVFrame *frame, SendItem *item) {
+    const QualityLevel *level = &quality_ladder[state->quality_level];
+    bool yuv = TRANSPORT_CODEC == VIDEO_CODEC_RAW_YUV420;
+    size_t frame_size = yuv ? yuv420_frame_size(level->width, level->height)
+                            : (size_t)level->width * level->height * 3;
+    if (!ensure_item_capacity(item, frame_size) || !update_scaler(state, frame)) {
+        return false;
+    }
+
+    uint8_t *target = item->buffer;
+    if (TILE_DELTA) {
+        // A new rung drops the receivers' copy, so its first frame goes out in full
+        if (!tile_encoder_configure(&state->tiles, TRANSPORT_CODEC, level->width, level->height,
+                                    TILE_SIZE, TILE_DIFF_THRESHOLD) ||
+            !ensure_item_capacity(item, tile_delta_max_size(&state->tiles.layout))) {
+            return false;
+        }
+        target = state->tiles.frame;
+    }
+
+    uint8_t *dst_data[4] = {target, NULL, NULL, NULL};
+    int dst_linesize[4] = {level->width * 3, 0, 0, 0};
+    if (yuv) {
+        int chroma_width = (level->width + 1) / 2;
+        dst_data[1] = target + (size_t)level->width * level->height;
+        dst_data[2] = dst_data[1] + (size_t)chroma_width * ((level->height + 1) / 2);
+        dst_linesize[0] = level->width;
+        dst_linesize[1] = chroma_width;
+        dst_linesize[2] = chroma_width;
+    }
 
     sws_scale(state->sws_context,
-              (const uint8_t * const *)state->frame->data, state->frame->linesize,
-              0, state->codec_context->height,
+              (const uint8_t * const *)frame->data, frame->linesize,
+              0, frame->height,
               dst_data, dst_linesize);
 
-    state->frame_count++;
+    item->data = item->buffer;
+    item->size = frame_size;
+    item->codec = TRANSPORT_CODEC;
+    item->flags = FRAME_FLAG_KEYFRAME;
+    item->width = level->width;
+    item->height = level->height;
+    item->interval_ns = frames_interval_ns(level->frame_divisor);
+
+    if (TILE_DELTA) {
+        bool refresh = state->tiles.frames_since_full + 1 >= (uint32_t)(config.target_fps / level->frame_divisor);
+        bool requested = take_keyframe_request(state, item->decode_ns);
+        bool delta;
+        item->size = tile_encoder_encode(&state->tiles, refresh || requested, item->buffer, &delta);
+        item->flags = delta ? FRAME_FLAG_DELTA : FRAME_FLAG_KEYFRAME;
+    }
     return true;
 }
 
-// Send frame in chunks via UDP
-void send_frame(ServerState *state) {
-    // Only send if we have a client address
-    if (state->client_addr.sin_addr.s_addr == 0) {
+// Chunk one frame payload once and fan it out to every subscriber. The item
+// stays referenced while its datagrams are cached, since they point into it.
+void send_frame(ServerState *state, SendItem *item) {
+    // Only send if somebody is watching
+    if (state->subscribers.count == 0) {
         return;
     }
 
-    // Calculate number of chunks
-    size_t frame_size = FRAME_WIDTH * FRAME_HEIGHT * 3;
-    int num_chunks = CALC_NUM_CHUNKS(frame_size, MAX_PACKET_SIZE - sizeof(FrameChunkHeader));
+    FramePayload payload = {
+        .data = item->data,
+        .size = item->size,
+        .codec = item->codec,
+        .flags = item->flags,
+        .width = item->width,
+        .height = item->height,
+        .capture_ns = item->capture_ns,
+        .decode_ns = item->decode_ns,
+        .scale_ns = item->scale_ns,
+        .owner = item
+    };
+
+    // Chunks as large as every viewer's path takes
+    FrameTx *tx = &state->frame_tx;
+    frame_tx_set_datagram_size(tx, subscribers_datagram_size(&state->subscribers));
+
+    // Tell the viewers how long the frame's chunks may take to come in
+    uint64_t spread_ns = (uint64_t)(config.pacing_spread * item->interval_ns);
+    payload.pacing_ns = subscribers_pacing_span(&state->subscribers, frame_tx_wire_bytes(tx, item->size), spread_ns);
+
+    atomic_fetch_add(&item->refs, 1);
+    TxFrame *frame = frame_tx_prepare(tx, &payload);
+    if (!frame) {
+        return;
+    }
 
-    // Allocate memory for message (header + data)
-    size_t max_msg_size = sizeof(FrameChunkHeader) + MAX_PACKET_SIZE;
-    uint8_t *msg_buffer = (uint8_t *)malloc(max_msg_size);
+    // Unpaced subscribers get the whole frame now, paced ones their first burst
+    subscribers_enqueue(&state->subscribers, frame, (item->flags & FRAME_FLAG_KEYFRAME) != 0, spread_ns);
+    subscribers_pump(&state->subscribers, tx, tx->last_send_ns);
+    uint64_t done_ns = monotonic_ns();
 
-    // Send frame in chunks
-    for (int i = 0; i < num_chunks; i++) {
-        // Calculate chunk offset and size
-        size_t chunk_offset = i * (MAX_PACKET_SIZE - sizeof(FrameChunkHeader));
-        size_t chunk_size = (chunk_offset + (MAX_PACKET_SIZE - sizeof(FrameChunkHeader)) <= frame_size)
-                          ? (MAX_PACKET_SIZE - sizeof(FrameChunkHeader))
-                          : (frame_size - chunk_offset);
+    if (item->capture_ns) {
+        latency_record_ns(&state->capture_to_decode, item->decode_ns - item->capture_ns);
+    }
+    latency_record_ns(&state->decode_to_scale, item->scale_ns - item->decode_ns);
+    latency_record_ns(&state->scale_to_send, tx->last_send_ns - item->scale_ns);
+    latency_record_ns(&state->send_duration, done_ns - tx->last_send_ns);
+    latency_record_ns(&state->decode_to_sent, done_ns - item->decode_ns);
+
+    if (tx->frames_sent % 30 == 0) {
+        printf("Sent frame %u (%zu bytes%s) in %d chunks + %d parity to %d subscribers, %.3f ms "
+               "(total: %llu retransmitted, %llu late NACKs)\n",
+               tx->frames_sent, item->size, (item->flags & FRAME_FLAG_KEYFRAME) ? ", key" : "",
+               tx->last_num_chunks, tx->last_num_parity, state->subscribers.count,
+               (done_ns - tx->last_send_ns) / 1e6,
+               (unsigned long long)tx->retransmit_count, (unsigned long long)tx->expired_nack_count);
+    }
+}
 
-        // Prepare header
-        FrameChunkHeader *header = (FrameChunkHeader *)msg_buffer;
-        header->msg_type = MSG_TYPE_FRAME_CHUNK;
-        header->frame_id = state->frame_count;
-        header->chunk_index = i;
-        header->total_chunks = num_chunks;
-        header->width = FRAME_WIDTH;
-        header->height = FRAME_HEIGHT;
-        header->chunk_size = chunk_size;
-        header->chunk_offset = chunk_offset;
+// Scale and encode a decoded frame, handing each packet to the send stage
+bool encode_frame(ServerState *state, const AVFrame *frame, uint64_t capture_ns, uint64_t decode_ns) {
+    // Scale straight into the encoder's input frame
+    if (av_frame_make_writable(state->encoder_frame) < 0) {
+        fprintf(stderr, "Encoder frame not writable\n");
+        return false;
+    }
+    if (!update_scaler(state, frame)) {
+        return false;
+    }
 
-        // Copy data
-        memcpy(msg_buffer + sizeof(FrameChunkHeader),
-               state->rgb_buffer + chunk_offset,
-               chunk_size);
+    sws_scale(state->sws_context,
+              (const uint8_t * const *)frame->data, frame->linesize,
+              0, frame->height,
+              state->encoder_frame->data, state->encoder_frame->linesize);
+
+    state->encoder_frame->pts = state->frame_count;
 
-        // Send the chunk
-        size_t msg_size = sizeof(FrameChunkHeader) + chunk_size;
-        sendto(state->video_socket, msg_buffer, msg_size, 0,
-               (struct sockaddr*)&state->client_addr, state->client_addr_len);
+    // A client lost decoder sync (or joined a multicast stream mid-GOP):
+    // make this an IDR frame rather than leave it waiting out the GOP
+    state->encoder_frame->pict_type = AV_PICTURE_TYPE_NONE;
+    if (take_keyframe_request(state, decode_ns)) {
+        state->encoder_frame->pict_type = AV_PICTURE_TYPE_I;
+    }
+
+    int ret = avcodec_send_frame(state->encoder_context, state->encoder_frame);
+    if (ret < 0) {
+        fprintf(stderr, "Error sending frame to encoder\n");
+        return false;
+    }
 
-        state->chunk_count++;
+    // With zero latency tuning every input frame yields one packet
+    while ((ret = avcodec_receive_packet(state->encoder_context, state->encoded_packet)) == 0) {
+        SendItem *item = acquire_send_item(state);
+        if (!item) {
+            av_packet_unref(state->encoded_packet);
+            return false;
+        }
 
-        if (i % 10 == 0) {
-            // Small delay every 10 chunks to prevent overwhelming the network
-            usleep(1000);  // 1ms
+        // Hand the packet's buffer over by reference
+        av_packet_move_ref(item->packet, state->encoded_packet);
+        item->data = item->packet->data;
+        item->size = item->packet->size;
+        item->codec = TRANSPORT_CODEC;
+        item->flags = (item->packet->flags & AV_PKT_FLAG_KEY) ? FRAME_FLAG_KEYFRAME : 0;
+        item->width = state->encoder_context->width;
+        item->height = state->encoder_context->height;
+        item->interval_ns = frames_interval_ns(quality_ladder[state->quality_level].frame_divisor);
+        item->capture_ns = capture_ns;
+        item->decode_ns = decode_ns;
+        item->scale_ns = monotonic_ns();
+
+        if (!submit_send_item(state, item)) {
+            return false;
         }
     }
 
-    if (state->frame_count % 30 == 0) {
-        printf("Sent frame %u in %d chunks (total: %u chunks)\n",
-               state->frame_count, num_chunks, state->chunk_count);
+    if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+        fprintf(stderr, "Error during encoding\n");
+        return false;
     }
 
-    free(msg_buffer);
+    return true;
+}
+
+// How long a passthrough packet plays: its duration, else one frame at the
+// stream's average (then base) frame rate. The file sets the pace, whatever
+// target_fps says; that is only the last resort of a stream with no timing.
+uint64_t packet_interval_ns(ServerState *state, const AVPacket *packet) {
+    const AVStream *stream = state->format_context->streams[state->video_stream_index];
+    const AVRational ns = {1, 1000000000};
+    if (packet->duration > 0) {
+        return av_rescale_q(packet->duration, state->bsf_context->time_base_out, ns);
+    }
+    if (stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0) {
+        return av_rescale_q(1, av_inv_q(stream->avg_frame_rate), ns);
+    }
+    if (stream->r_frame_rate.num > 0 && stream->r_frame_rate.den > 0) {
+        return av_rescale_q(1, av_inv_q(stream->r_frame_rate), ns);
+    }
+    return frames_interval_ns(1);
 }
 
-// Check for control messages
-void check_control_messages(ServerState *state) {
-    // Try to receive a control message
-    ControlMessage control;
+// Read the next source packet into a send item without decoding it
+bool forward_packet(ServerState *state, SendItem *item) {
+    while (1) {
+        // Drain the bitstream filter first, straight into the item's packet
+        int ret = av_bsf_receive_packet(state->bsf_context, item->packet);
+        if (ret == 0) {
+            AVCodecParameters *codec_params = state->format_context->streams[state->video_stream_index]->codecpar;
+            item->data = item->packet->data;
+            item->size = item->packet->size;
+            item->codec = VIDEO_CODEC_H264;
+            item->flags = (item->packet->flags & AV_PKT_FLAG_KEY) ? FRAME_FLAG_KEYFRAME : 0;
+            item->width = codec_params->width;
+            item->height = codec_params->height;
+            item->interval_ns = packet_interval_ns(state, item->packet);
+            item->decode_ns = monotonic_ns();
+            item->scale_ns = item->decode_ns;
+            state->frame_count++;
+            return true;
+        } else if (ret != AVERROR(EAGAIN)) {
+            fprintf(stderr, "Error in bitstream filter\n");
+            return false;
+        }
+
+        // Need more packets
+        if (av_read_frame(state->format_context, state->packet) < 0) {
+            // End of file or error, seek back to start
+            av_seek_frame(state->format_context, state->video_stream_index, 0, AVSEEK_FLAG_BACKWARD);
+            continue;
+        }
+
+        if (state->packet->stream_index != state->video_stream_index) {
+            // Not a video packet
+            av_packet_unref(state->packet);
+            continue;
+        }
+
+        // The filter takes ownership of the packet's data
+        if (av_bsf_send_packet(state->bsf_context, state->packet) < 0) {
+            fprintf(stderr, "Error sending packet to bitstream filter\n");
+            av_packet_unref(state->packet);
+            return false;
+        }
+    }
+}
+
+// Check for control messages; returns false once the socket is drained.
+// The controller's commands only overwrite `latest`, so a backlog
+// collapses to the newest one.
+bool check_control_messages(ServerState *state, ControlCommand *latest) {
+    // Try to receive a control message (NACKs are the largest message type)
+    uint8_t message[NACK_MESSAGE_SIZE];
     struct sockaddr_in client_addr;
     socklen_t addr_len = sizeof(client_addr);
 
-    int recv_size = recvfrom(state->control_socket, &control, sizeof(control), 0,
+    int recv_size = recvfrom(state->control_socket, message, sizeof(message), 0,
                             (struct sockaddr*)&client_addr, &addr_len);
+    if (recv_size < 0) {
+        return false;
+    }
+    uint64_t recv_ns = monotonic_ns();
+
+    ClockSyncMessage clock_sync;
+    if (recv_size == CLOCK_SYNC_SIZE && wire_decode_clock_sync(message, &clock_sync)) {
+        // Echo the probe with our receive and reply times
+        clock_sync.server_recv_ns = recv_ns;
+        clock_sync.server_send_ns = monotonic_ns();
+        wire_encode_clock_sync(message, &clock_sync);
+        sendto(state->control_socket, message, CLOCK_SYNC_SIZE, 0,
+               (struct sockaddr*)&client_addr, addr_len);
+        return true;
+    }
+
+    NackMessage nack;
+    if (wire_decode_nack(message, (size_t)recv_size, &nack)) {
+        // The send thread owns the subscriber table and the retransmit
+        // cache, so hand the request over with its sender
+        ControlEvent event = {
+            .msg_type = MSG_TYPE_NACK,
+            .from = client_addr,
+            .recv_ns = recv_ns,
+            .length = (size_t)recv_size,
+            .nack = nack
+        };
+        if (spsc_push(&state->control_queue, &event)) {
+            doorbell_ring(&state->send_doorbell);
+        }
+        return true;
+    }
+
+    ReceiverReport report;
+    if (recv_size == RECEIVER_REPORT_SIZE && wire_decode_receiver_report(message, &report)) {
+        // Rate control state lives with the subscribers on the send thread
+        ControlEvent event = {
+            .msg_type = MSG_TYPE_RECEIVER_REPORT,
+            .from = client_addr,
+            .recv_ns = recv_ns,
+            .report = report
+        };
+        if (spsc_push(&state->control_queue, &event)) {
+            doorbell_ring(&state->send_doorbell);
+        }
+        return true;
+    }
+
+    KeyframeRequest keyframe_request;
+    if (recv_size == KEYFRAME_REQUEST_SIZE && wire_decode_keyframe_request(message, &keyframe_request)) {
+        // Passthrough and intra-only codecs have nothing to force; the
+        // request then just lapses until the next keyframe
+        atomic_store(&state->keyframe_requested, true);
+        return true;
+    }
+
+    ControlMessage control;
+    if (recv_size == CONTROL_MESSAGE_SIZE && wire_decode_control(message, &control)) {
+        // Every control message keeps its sender subscribed to the video
+        ControlEvent event = {
+            .msg_type = MSG_TYPE_CONTROL,
+            .from = client_addr,
+            .recv_ns = recv_ns
+        };
+        if (spsc_push(&state->control_queue, &event)) {
+            doorbell_ring(&state->send_doorbell);
+        }
+
+        // Only one client drives: the first one, until it goes quiet. The others just watch.
+        bool is_controller = state->controller_seen_ns != 0 &&
+                             subscriber_addr_equal(&client_addr, &state->controller_addr);
+        if (!is_controller) {
+            if (state->controller_seen_ns != 0 &&
+                recv_ns - state->controller_seen_ns < SUBSCRIBER_TIMEOUT_MS * 1000000ull) {
+                return true;
+            }
+            printf("Client %s:%u has the controls\n",
+                   inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+            state->controller_addr = client_addr;
+        }
+        state->controller_seen_ns = recv_ns;
 
-    if (recv_size == sizeof(control) && control.msg_type == MSG_TYPE_CONTROL) {
         // Valid control message received
-        memcpy(&state->last_control, &control, sizeof(control));
+        latest->message = control;
+        latest->recv_ns = recv_ns;
+    }
 
-        // Update client address for video streaming
-        memcpy(&state->client_addr, &client_addr, addr_len);
-        state->client_addr.sin_port = htons(VIDEO_PORT);
+    return true;
+}
+
+// Sleep until the control socket is readable; false on timeout
+bool wait_for_control(ServerState *state) {
+#ifdef __linux__
+    struct epoll_event event;
+    return epoll_wait(state->control_epoll, &event, 1, CONTROL_WAIT_MS) > 0;
+#else
+    struct pollfd fd = { .fd = state->control_socket, .events = POLLIN };
+    return poll(&fd, 1, CONTROL_WAIT_MS) > 0;
+#endif
+}
+
+// Control thread: serves the control port as soon as a datagram lands, so
+// input never waits behind a frame, and hands the newest command on
+void *control_thread(void *arg) {
+    ServerState *state = (ServerState *)arg;
+    pin_current_thread(config.control_cpu, "control");
+    set_realtime_priority(CONTROL_PRIORITY, "control");
+
+    while (atomic_load(&server_running)) {
+        if (!wait_for_control(state)) {
+            continue;
+        }
+
+        ControlCommand latest = {0};
+        while (check_control_messages(state, &latest)) {
+        }
+        if (latest.recv_ns != 0) {
+            seqlock_write(&state->command_lock, &state->command, &latest, sizeof(latest));
+        }
+    }
+    return NULL;
+}
+
+// Act on a new command from the controlling client
+void apply_control(const ControlMessage *control) {
+    printf("Control: X=%.2f, Y=%.2f, Buttons=[%d,%d,%d,%d,%d,%d,%d,%d]\n",
+           control->x_axis, control->y_axis,
+           control->buttons[0], control->buttons[1], control->buttons[2], control->buttons[3],
+           control->buttons[4], control->buttons[5], control->buttons[6], control->buttons[7]);
+
+    // Add your motor control or other logic here
+}
+
+// Actuation loop (main thread): pick up the newest command every
+// ACTUATION_INTERVAL_US; reading it never holds up the control thread
+void run_actuation(ServerState *state) {
+    unsigned int applied = 0;
+    while (atomic_load(&server_running)) {
+        ControlCommand command;
+        unsigned int sequence = seqlock_read(&state->command_lock, &state->command,
+                                             &command, sizeof(command));
+        if (sequence != applied) {
+            applied = sequence;
+            latency_record_ns(&state->command_to_actuation, monotonic_ns() - command.recv_ns);
+            apply_control(&command.message);
+        }
+
+        usleep(ACTUATION_INTERVAL_US);
+    }
+}
+
+// Allocate the buffer pools and the queues between the pipeline stages
+bool init_pipeline(ServerState *state) {
+    bool ok = spsc_init(&state->decoded_queue, PIPELINE_DEPTH, sizeof(DecodedFrame)) &&
+              spsc_init(&state->free_frame_queue, PIPELINE_DEPTH, sizeof(AVFrame *)) &&
+              spsc_init(&state->send_queue, PIPELINE_DEPTH, sizeof(SendItem *)) &&
+              spsc_init(&state->free_item_queue, SEND_POOL_SIZE, sizeof(SendItem *)) &&
+              spsc_init(&state->control_queue, 256, sizeof(ControlEvent)) &&
+              doorbell_init(&state->send_doorbell);
+    if (!ok) {
+        return false;
+    }
 
-        if (!state->client_connected) {
-            printf("Client connected from %s! First control message received.\n",
-                   inet_ntoa(client_addr.sin_addr));
-            state->client_connected = true;
+    // Every buffer starts out free
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        state->frame_pool[i] = av_frame_alloc();
+        if (!state->frame_pool[i]) {
+            fprintf(stderr, "Could not allocate frame\n");
+            return false;
+        }
+        spsc_push(&state->free_frame_queue, &state->frame_pool[i]);
+    }
+
+    // Encoded payloads live in packet references; only raw frames need a buffer
+    bool raw = !state->encoder_context && !state->bsf_context;
+    size_t raw_size = (size_t)config.frame_width * config.frame_height * 3;
+    for (int i = 0; i < SEND_POOL_SIZE; i++) {
+        SendItem *item = &state->item_pool[i];
+        item->packet = av_packet_alloc();
+        if (!item->packet || (raw && !ensure_item_capacity(item, raw_size))) {
+            fprintf(stderr, "Could not allocate send item\n");
+            return false;
+        }
+        spsc_push(&state->free_item_queue, &item);
+    }
+
+    // Cached frames hold a reference to their send item
+    frame_tx_init(&state->frame_tx, FEC_GROUP_SIZE, RETRANSMIT_FRAMES,
+                  release_cached_item, state);
+
+    printf("Pipeline initialized: %d frame buffers, %d send items\n", PIPELINE_DEPTH, SEND_POOL_SIZE);
+    return true;
+}
+
+// Stage 1: demux and decode (or, in passthrough, demux and filter)
+void *decode_thread(void *arg) {
+    ServerState *state = (ServerState *)arg;
+    pin_current_thread(config.decode_cpu, "decode");
+
+    AVFrame *frame = NULL;
+    SendItem *item = NULL;
+
+    while (atomic_load(&server_running)) {
+        if (state->bsf_context) {
+            // Passthrough feeds the send stage directly
+            if (!item && !(item = acquire_send_item(state))) {
+                break;
+            }
+            if (forward_packet(state, item)) {
+                if (!submit_send_item(state, item)) {
+                    break;
+                }
+                item = NULL;
+            }
+            continue;
         }
 
-        // Process control input
-        printf("Control: X=%.2f, Y=%.2f, Buttons=[%d,%d,%d,%d,%d,%d,%d,%d]\n",
-               control.x_axis, control.y_axis,
-               control.buttons[0], control.buttons[1], control.buttons[2], control.buttons[3],
-               control.buttons[4], control.buttons[5], control.buttons[6], control.buttons[7]);
+        // Wait for the scale stage to return a frame buffer
+        if (!frame && !spsc_pop(&state->free_frame_queue, &frame)) {
+            pipeline_backoff();
+            continue;
+        }
 
-        // Add your motor control or other logic here
+        uint64_t capture_ns = 0;
+        if (decode_next_frame(state, frame, &capture_ns)) {
+            DecodedFrame decoded = { .frame = frame, .capture_ns = capture_ns, .decode_ns = monotonic_ns() };
+            while (!spsc_push(&state->decoded_queue, &decoded)) {
+                pipeline_backoff();
+            }
+            frame = NULL;
+        }
     }
+
+    return NULL;
+}
+
+// Encoder bitrate for a rate controller target
+int64_t encoder_bitrate(uint64_t target_bps) {
+    if (target_bps > ENCODER_BITRATE) return ENCODER_BITRATE;
+    if (target_bps < MIN_BITRATE) return MIN_BITRATE;
+    return (int64_t)target_bps;
+}
+
+// Move to another rung: the scaler follows on the next frame and, when
+// encoding, a new encoder starts (its first frame is a keyframe at the new size)
+bool set_quality_level(ServerState *state, int index, uint64_t target_bps, uint64_t now_ns) {
+    const QualityLevel *level = &quality_ladder[index];
+
+    // Packets already handed on hold their own buffer references, so the old encoder can go
+    if (state->encoder_context) {
+        avcodec_free_context(&state->encoder_context);
+        av_frame_free(&state->encoder_frame);
+        if (!open_encoder(state, level->width, level->height, level->frame_divisor,
+                          encoder_bitrate(target_bps))) {
+            return false;
+        }
+    }
+
+    printf("Quality: %dx%d at %d fps for a %.0f kbit/s target\n",
+           level->width, level->height, config.target_fps / level->frame_divisor, target_bps / 1e3);
+    state->quality_level = index;
+    state->quality_changed_ns = now_ns;
+    return true;
+}
+
+// Follow the subscribers' target bitrate: drop a rung as soon as the current
+// one no longer fits, climb one only with headroom and after QUALITY_HOLD_MS,
+// and track the target with the encoder bitrate in between
+bool adapt_quality(ServerState *state, uint64_t now_ns) {
+    uint32_t target_kbps = atomic_load(&state->target_bitrate_kbps);
+    uint64_t target_bps = target_kbps ? target_kbps * 1000ull : max_stream_bitrate();
+
+    int index = state->quality_level;
+    while (index < QUALITY_LEVELS - 1 && quality_level_bitrate(&quality_ladder[index]) > target_bps) {
+        index++;
+    }
+    if (index == state->quality_level && index > 0 &&
+        now_ns - state->quality_changed_ns >= QUALITY_HOLD_MS * 1000000ull &&
+        quality_level_bitrate(&quality_ladder[index - 1]) * QUALITY_UPGRADE_MARGIN <= target_bps) {
+        index--;
+    }
+
+    if (index != state->quality_level) {
+        return set_quality_level(state, index, target_bps, now_ns);
+    }
+
+    // libx264 picks up a new bit_rate on the next frame without restarting;
+    // MJPEG keeps its initial rate control and adapts through the ladder only
+    AVCodecContext *enc = state->encoder_context;
+    if (enc) {
+        int64_t bit_rate = encoder_bitrate(target_bps);
+        int64_t change = bit_rate > enc->bit_rate ? bit_rate - enc->bit_rate : enc->bit_rate - bit_rate;
+        if (change > enc->bit_rate * BITRATE_CHANGE_THRESHOLD) {
+            enc->bit_rate = bit_rate;
+        }
+    }
+    return true;
+}
+
+// Stage 2: scale (and encode) decoded frames into send items
+void *scale_thread(void *arg) {
+    ServerState *state = (ServerState *)arg;
+    pin_current_thread(config.scale_cpu, "scale");
+
+    while (atomic_load(&server_running)) {
+        DecodedFrame decoded;
+        if (!spsc_pop(&state->decoded_queue, &decoded)) {
+            pipeline_backoff();
+            continue;
+        }
+        AVFrame *frame = decoded.frame;
+
+        if (ADAPTIVE_QUALITY && !adapt_quality(state, decoded.decode_ns)) {
+            fprintf(stderr, "Could not change stream quality, stopping\n");
+            atomic_store(&server_running, false);
+            break;
+        }
+
+        // A reduced frame rate skips source frames; the send stage paces
+        // each item for the frames it stands for
+        int frame_divisor = quality_ladder[state->quality_level].frame_divisor;
+        if (state->frame_count % frame_divisor == 0) {
+            if (state->encoder_context) {
+                encode_frame(state, frame, decoded.capture_ns, decoded.decode_ns);
+            } else {
+                // A failed scale is submitted empty so the send stage recycles it
+                SendItem *item = acquire_send_item(state);
+                if (item) {
+                    item->capture_ns = decoded.capture_ns;
+                    item->decode_ns = decoded.decode_ns;
+                    scale_to_raw(state, frame, item);
+                    item->scale_ns = monotonic_ns();
+                    if (!submit_send_item(state, item)) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Give the frame buffer back to the decode stage
+        av_frame_unref(frame);
+        spsc_push(&state->free_frame_queue, &frame);
+        state->frame_count++;
+    }
+
+    return NULL;
+}
+
+// Apply queued subscriber keepalives and serve retransmit requests
+void serve_control_events(ServerState *state) {
+    ControlEvent event;
+    while (spsc_pop(&state->control_queue, &event)) {
+        if (event.msg_type == MSG_TYPE_CONTROL) {
+            if (!subscribers_touch(&state->subscribers, &event.from, event.recv_ns)) {
+                fprintf(stderr, "Subscriber table full, ignoring %s\n", inet_ntoa(event.from.sin_addr));
+            }
+        } else if (event.msg_type == MSG_TYPE_RECEIVER_REPORT) {
+            subscribers_report(&state->subscribers, &event.from, &event.report, event.recv_ns);
+        } else {
+            subscribers_nack(&state->subscribers, &state->frame_tx, &event.from, &event.nack, event.length);
+        }
+    }
+
+    subscribers_expire(&state->subscribers, monotonic_ns());
+
+    // The encoder serves every subscriber, so it follows the slowest
+    uint64_t target_bps = subscribers_target_bitrate(&state->subscribers);
+    atomic_store(&state->target_bitrate_kbps, (unsigned int)(target_bps / 1000));
+}
+
+// Print the server side per-stage latency histograms
+void print_latency_report(ServerState *state) {
+    printf("Server latency (%u frames sent):\n", state->frame_tx.frames_sent);
+    if (state->live) {
+        latency_print(&state->capture_to_decode, "capture -> decode");
+    }
+    latency_print(&state->decode_to_scale, "decode -> scale");
+    latency_print(&state->scale_to_send, "scale -> first chunk");
+    latency_print(&state->send_duration, "first -> last chunk");
+    latency_print(&state->decode_to_sent, "decode -> last chunk");
+    subscribers_print(&state->subscribers);
+}
+
+// Stage 3: pace frames out at the source's frame rate, fan them out and answer NACKs in between
+void *send_thread(void *arg) {
+    ServerState *state = (ServerState *)arg;
+    pin_current_thread(config.send_cpu, "send");
+    udp_pacing_thread_init();
+
+    uint64_t next_frame_ns = monotonic_ns();
+    SendItem *pending = NULL;
+
+    while (atomic_load(&server_running)) {
+        serve_control_events(state);
+
+        if (atomic_exchange(&latency_report_requested, false)) {
+            print_latency_report(state);
+        }
+
+        if (!pending) {
+            spsc_pop(&state->send_queue, &pending);
+        }
+
+        uint64_t now = monotonic_ns();
+        if (pending && now >= next_frame_ns) {
+            // Frames are consumed at the frame rate even without a client
+            if (pending->size > 0) {
+                send_frame(state, pending);
+            }
+
+            // Absolute schedule; after a stall, restart from now instead of bursting
+            next_frame_ns += pending->interval_ns;
+            release_send_item(state, pending);
+            pending = NULL;
+            if (next_frame_ns < now) {
+                next_frame_ns = now;
+            }
+            continue;
+        }
+
+        // Paced subscribers still working through earlier frames
+        uint64_t resume_ns = subscribers_pump(&state->subscribers, &state->frame_tx, now);
+
+        // Sleep until the frame is due, a subscriber may send, a new item arrives or a NACK comes in
+        uint64_t wait_ns = pending ? next_frame_ns - now : 100000000ull;
+        if (resume_ns) {
+            now = monotonic_ns();
+            uint64_t resume_wait_ns = resume_ns > now ? resume_ns - now : 0;
+            if (resume_wait_ns < wait_ns) {
+                wait_ns = resume_wait_ns;
+            }
+        }
+        struct timeval timeout = {
+            .tv_sec = wait_ns / 1000000000ull,
+            .tv_usec = (wait_ns % 1000000000ull) / 1000
+        };
+
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(state->send_doorbell.read_fd, &read_fds);
+        if (select(state->send_doorbell.read_fd + 1, &read_fds, NULL, NULL, &timeout) > 0) {
+            doorbell_drain(&state->send_doorbell);
+        }
+    }
+
+    return NULL;
+}
+
+// Stop the pipeline on Ctrl-C; SIGUSR1 asks for a latency report
+void handle_signal(int signum) {
+    if (signum == SIGUSR1) {
+        atomic_store(&latency_report_requested, true);
+        return;
+    }
+    atomic_store(&server_running, false);
 }
 
 // Cleanup resources
 void cleanup(ServerState *state) {
     // Free network resources
-    if (state->video_socket >= 0) close(state->video_socket);
     if (state->control_socket >= 0) close(state->control_socket);
+    if (state->control_epoll >= 0) close(state->control_epoll);
+    subscribers_free(&state->subscribers);
 
     // Free FFmpeg resources
-    if (state->rgb_buffer) free(state->rgb_buffer);
-    if (state->frame) av_frame_free(&state->frame);
+    if (state->bsf_context) av_bsf_free(&state->bsf_context);
+    if (state->encoder_frame) av_frame_free(&state->encoder_frame);
+    if (state->encoded_packet) av_packet_free(&state->encoded_packet);
+    if (state->encoder_context) avcodec_free_context(&state->encoder_context);
+    if (state->tiles.full_frames > 0) {
+        TileEncoder *tiles = &state->tiles;
+        printf("Tile deltas: %llu full and %llu delta frames, %.1f%% of tiles sent in deltas\n",
+               (unsigned long long)tiles->full_frames, (unsigned long long)tiles->delta_frames,
+               tiles->tiles_compared ? 100.0 * tiles->tiles_sent / tiles->tiles_compared : 0.0);
+    }
+    tile_encoder_free(&state->tiles);
+    frame_tx_free(&state->frame_tx);
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        if (state->frame_pool[i]) av_frame_free(&state->frame_pool[i]);
+    }
+    if (state->live) {
+        // Every frame referencing a capture buffer is gone by now
+        printf("Capture: %llu frames, %llu dropped by the driver\n",
+               (unsigned long long)state->capture.frames, (unsigned long long)state->capture.dropped);
+        capture_close(&state->capture);
+    }
+    for (int i = 0; i < SEND_POOL_SIZE; i++) {
+        if (state->item_pool[i].packet) av_packet_free(&state->item_pool[i].packet);
+        free(state->item_pool[i].buffer);
+    }
+    spsc_free(&state->decoded_queue);
+    spsc_free(&state->free_frame_queue);
+    spsc_free(&state->send_queue);
+    spsc_free(&state->free_item_queue);
+    spsc_free(&state->control_queue);
+    doorbell_free(&state->send_doorbell);
     if (state->packet) av_packet_free(&state->packet);
     if (state->codec_context) avcodec_free_context(&state->codec_context);
     if (state->sws_context) sws_freeContext(state->sws_context);
@@ -356,35 +1519,27 @@ void cleanup(ServerState *state) {
     printf("Server cleanup complete\n");
 }
 
-// Calculate time until next frame should be sent (for frame rate control)
-int calculate_wait_time(ServerState *state) {
-    struct timeval current_time;
-    gettimeofday(&current_time, NULL);
-
-    // Calculate time elapsed since last frame
-    long elapsed_us = (current_time.tv_sec - state->last_frame_time.tv_sec) * 1000000 +
-                      (current_time.tv_usec - state->last_frame_time.tv_usec);
-
-    // Time per frame in microseconds
-    long frame_time_us = 1000000 / TARGET_FPS;
-
-    // Calculate wait time
-    long wait_time = frame_time_us - elapsed_us;
-
-    // Update last frame time
-    state->last_frame_time = current_time;
-
-    // Return wait time (or 0 if we're behind)
-    return (wait_time > 0) ? wait_time : 0;
+void print_usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-c FILE] [--key value ...]\n", name);
+    config_print_usage(stderr);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     printf("===== UDP Video Streaming Server Starting =====\n");
 
+    // Settings: defaults, then the -c file, then --key options
+    if (!config_parse_args(&config, argc, argv, "c:")) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    init_quality_ladder();
+
     // Initialize server state
     ServerState state = {0};
-    state.video_socket = -1;
     state.control_socket = -1;
+    state.control_epoll = -1;
+    state.send_doorbell.read_fd = -1;
+    state.send_doorbell.write_fd = -1;
 
     // Initialize UDP sockets
     if (!init_network(&state)) {
@@ -400,36 +1555,49 @@ int main() {
         return EXIT_FAILURE;
     }
 
-    printf("Server initialized successfully. Waiting for client...\n");
+    // Initialize the transport encoder
+    if (!init_encoder(&state)) {
+        fprintf(stderr, "Failed to initialize encoder\n");
+        cleanup(&state);
+        return EXIT_FAILURE;
+    }
 
-    // Initialize timing
-    gettimeofday(&state.last_frame_time, NULL);
+    // Initialize the stage queues and buffer pools
+    if (!init_pipeline(&state)) {
+        fprintf(stderr, "Failed to initialize pipeline\n");
+        cleanup(&state);
+        return EXIT_FAILURE;
+    }
 
-    // Main loop
-    while (1) {
-        // Check for control messages
-        check_control_messages(&state);
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGUSR1, handle_signal);
 
-        // If no client yet, wait and continue
-        if (!state.client_connected) {
-            usleep(100000); // 100ms
-            continue;
-        }
+    // Start the pipeline stages (passthrough has no scale stage) and the control thread
+    pthread_t decoder, scaler, sender, controller;
+    bool has_scaler = state.bsf_context == NULL;
+    pthread_create(&decoder, NULL, decode_thread, &state);
+    if (has_scaler) {
+        pthread_create(&scaler, NULL, scale_thread, &state);
+    }
+    pthread_create(&sender, NULL, send_thread, &state);
+    pthread_create(&controller, NULL, control_thread, &state);
 
-        // Process and send frame
-        if (process_frame(&state)) {
-		printf("Sending to client at %s:%d\n", inet_ntoa(state.client_addr.sin_addr), ntohs(state.client_addr.sin_port));
-            send_frame(&state);
-        }
+    printf("Server initialized successfully. Waiting for client...\n");
 
-        // Control frame rate
-        int wait_time = calculate_wait_time(&state);
-        if (wait_time > 0) {
-            usleep(wait_time);
-        }
+    // The main thread runs the actuation loop
+    run_actuation(&state);
+
+    printf("Shutting down...\n");
+    pthread_join(controller, NULL);
+    pthread_join(decoder, NULL);
+    if (has_scaler) {
+        pthread_join(scaler, NULL);
     }
+    pthread_join(sender, NULL);
+    print_latency_report(&state);
+    latency_print(&state.command_to_actuation, "command -> actuation");
 
-    // We never reach here in this example, but proper cleanup is important
     cleanup(&state);
     return 0;
 }
@@ -0,0 +1,335 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "common.h"
+
+// Byte layout of the messages that carry the stream: fixed offsets, no
+// padding, multi-byte fields little-endian whatever the compiler or CPU.
+// Fields are moved with memcpy, which is safe at any alignment and compiles
+// to plain loads and stores; the byte swap is chosen at compile time and
+// vanishes on little-endian hosts, so encoding and decoding are straight
+// line code with no branches.
+//
+// Frame chunk header (CHUNK_HEADER_SIZE bytes, every chunk datagram):
+//    0  u8   msg_type          MSG_TYPE_FRAME_CHUNK
+//    1  u8   version           WIRE_VERSION
+//    2  u8   flags             CHUNK_FLAG_*
+//    3  u8   fec_group_size
+//    4  u32  frame_id
+//    8  u32  frame_size        Stream bytes (FrameInfo + payload)
+//   12  u16  chunk_index       Parity: group
+//   14  u16  chunk_stride
+//
+// Frame info (FRAME_INFO_SIZE bytes, start of the stream, so in chunk 0):
+//    0  u16  width
+//    2  u16  height
+//    4  u8   codec             VIDEO_CODEC_*
+//    5  u8   flags             FRAME_FLAG_*
+//    6  u16  reserved          Zero
+//    8  u64  decode_ns
+//   16  u32  scale_us
+//   20  u32  send_us
+//   24  u32  capture_us
+//   28  u32  pacing_us
+//
+// Control message (CONTROL_MESSAGE_SIZE bytes):
+//    0  u8   msg_type          MSG_TYPE_CONTROL
+//    1  u8   version           WIRE_VERSION
+//    2  u8   buttons           Bit i = buttons[i] pressed
+//    3  u8   reserved          Zero
+//    4  f32  x_axis            IEEE 754 binary32
+//    8  f32  y_axis
+//
+// NACK (NACK_HEADER_SIZE bytes plus the bitmap bytes in use):
+//    0  u8   msg_type          MSG_TYPE_NACK
+//    1  u8   version           WIRE_VERSION
+//    2  u16  reserved          Zero
+//    4  u32  frame_id
+//    8  u32  base_chunk
+//   12  u8[] bitmap            Bit i (byte i / 8, bit i % 8) = chunk base_chunk + i missing
+//
+// Clock sync probe and reply (CLOCK_SYNC_SIZE bytes):
+//    0  u8   msg_type          MSG_TYPE_CLOCK_SYNC
+//    1  u8   version           WIRE_VERSION
+//    2  u8[6] reserved         Zero
+//    8  u64  client_send_ns
+//   16  u64  server_recv_ns
+//   24  u64  server_send_ns
+//
+// Keyframe request (KEYFRAME_REQUEST_SIZE bytes):
+//    0  u8   msg_type          MSG_TYPE_KEYFRAME_REQUEST
+//    1  u8   version           WIRE_VERSION
+//    2  u16  reserved          Zero
+//    4  u32  last_frame_id
+//
+// Receiver report (RECEIVER_REPORT_SIZE bytes):
+//    0  u8   msg_type          MSG_TYPE_RECEIVER_REPORT
+//    1  u8   version           WIRE_VERSION
+//    2  u8   fraction_lost     In 1/256
+//    3  u8   reserved          Zero
+//    4  u16  probe_size
+//    6  u16  reserved          Zero
+//    8  u32  last_frame_id
+//   12  u32  interval_us
+//   16  u32  frames_completed
+//   20  u32  frames_skipped
+//   24  u32  receive_rate_kbps
+//   28  u32  jitter_us
+//   32  u32  queue_delay_us
+//
+// Tile delta header (TILE_DELTA_HEADER_SIZE bytes, start of a delta payload):
+//    0  u8   version           WIRE_VERSION
+//    1  u8   reserved          Zero
+//    2  u16  tile_size
+//    4  u32  tiles_changed
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define WIRE_SWAP16(x) __builtin_bswap16(x)
+#define WIRE_SWAP32(x) __builtin_bswap32(x)
+#define WIRE_SWAP64(x) __builtin_bswap64(x)
+#else
+#define WIRE_SWAP16(x) (x)
+#define WIRE_SWAP32(x) (x)
+#define WIRE_SWAP64(x) (x)
+#endif
+
+_Static_assert(sizeof(float) == 4, "control axes travel as binary32");
+_Static_assert(sizeof(((ControlMessage *)0)->buttons) <= 8, "buttons travel as one bitmask byte");
+
+static inline void wire_put_u16(uint8_t *p, uint16_t v) {
+    v = WIRE_SWAP16(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void wire_put_u32(uint8_t *p, uint32_t v) {
+    v = WIRE_SWAP32(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void wire_put_u64(uint8_t *p, uint64_t v) {
+    v = WIRE_SWAP64(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void wire_put_f32(uint8_t *p, float f) {
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    wire_put_u32(p, v);
+}
+
+static inline uint16_t wire_get_u16(const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return WIRE_SWAP16(v);
+}
+
+static inline uint32_t wire_get_u32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return WIRE_SWAP32(v);
+}
+
+static inline uint64_t wire_get_u64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return WIRE_SWAP64(v);
+}
+
+static inline float wire_get_f32(const uint8_t *p) {
+    uint32_t v = wire_get_u32(p);
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+// Write a chunk header into the first CHUNK_HEADER_SIZE bytes of `wire`
+static inline void wire_encode_chunk_header(uint8_t *wire, const FrameChunkHeader *header) {
+    wire[0] = header->msg_type;
+    wire[1] = header->version;
+    wire[2] = header->flags;
+    wire[3] = header->fec_group_size;
+    wire_put_u32(wire + 4, header->frame_id);
+    wire_put_u32(wire + 8, header->frame_size);
+    wire_put_u16(wire + 12, header->chunk_index);
+    wire_put_u16(wire + 14, header->chunk_stride);
+}
+
+// Read a chunk header; the caller checks msg_type and version
+static inline void wire_decode_chunk_header(const uint8_t *wire, FrameChunkHeader *header) {
+    header->msg_type = wire[0];
+    header->version = wire[1];
+    header->flags = wire[2];
+    header->fec_group_size = wire[3];
+    header->frame_id = wire_get_u32(wire + 4);
+    header->frame_size = wire_get_u32(wire + 8);
+    header->chunk_index = wire_get_u16(wire + 12);
+    header->chunk_stride = wire_get_u16(wire + 14);
+}
+
+static inline void wire_encode_frame_info(uint8_t *wire, const FrameInfo *info) {
+    wire_put_u16(wire + 0, info->width);
+    wire_put_u16(wire + 2, info->height);
+    wire[4] = info->codec;
+    wire[5] = info->flags;
+    wire_put_u16(wire + 6, 0);
+    wire_put_u64(wire + 8, info->decode_ns);
+    wire_put_u32(wire + 16, info->scale_us);
+    wire_put_u32(wire + 20, info->send_us);
+    wire_put_u32(wire + 24, info->capture_us);
+    wire_put_u32(wire + 28, info->pacing_us);
+}
+
+static inline void wire_decode_frame_info(const uint8_t *wire, FrameInfo *info) {
+    info->width = wire_get_u16(wire + 0);
+    info->height = wire_get_u16(wire + 2);
+    info->codec = wire[4];
+    info->flags = wire[5];
+    info->decode_ns = wire_get_u64(wire + 8);
+    info->scale_us = wire_get_u32(wire + 16);
+    info->send_us = wire_get_u32(wire + 20);
+    info->capture_us = wire_get_u32(wire + 24);
+    info->pacing_us = wire_get_u32(wire + 28);
+}
+
+// Pack a control message; buttons become one bit each
+static inline void wire_encode_control(uint8_t *wire, const ControlMessage *control) {
+    uint8_t buttons = 0;
+    for (size_t i = 0; i < sizeof(control->buttons); i++) {
+        buttons |= (uint8_t)((control->buttons[i] != 0) << i);
+    }
+
+    wire[0] = MSG_TYPE_CONTROL;
+    wire[1] = WIRE_VERSION;
+    wire[2] = buttons;
+    wire[3] = 0;
+    wire_put_f32(wire + 4, control->x_axis);
+    wire_put_f32(wire + 8, control->y_axis);
+}
+
+// Unpack a control message of CONTROL_MESSAGE_SIZE bytes. Returns false for
+// another message type or wire version.
+static inline bool wire_decode_control(const uint8_t *wire, ControlMessage *control) {
+    control->msg_type = wire[0];
+    for (size_t i = 0; i < sizeof(control->buttons); i++) {
+        control->buttons[i] = (wire[2] >> i) & 1;
+    }
+    control->x_axis = wire_get_f32(wire + 4);
+    control->y_axis = wire_get_f32(wire + 8);
+    return (wire[0] == MSG_TYPE_CONTROL) & (wire[1] == WIRE_VERSION);
+}
+
+// Pack a NACK with the first `bitmap_bytes` of its bitmap; returns the
+// datagram length
+static inline size_t wire_encode_nack(uint8_t *wire, const NackMessage *nack, size_t bitmap_bytes) {
+    wire[0] = MSG_TYPE_NACK;
+    wire[1] = WIRE_VERSION;
+    wire_put_u16(wire + 2, 0);
+    wire_put_u32(wire + 4, nack->frame_id);
+    wire_put_u32(wire + 8, nack->base_chunk);
+    memcpy(wire + NACK_HEADER_SIZE, nack->bitmap, bitmap_bytes);
+    return NACK_HEADER_SIZE + bitmap_bytes;
+}
+
+// Unpack a NACK of `length` bytes; bitmap bytes it did not carry read as
+// zero. Returns false for another message type or wire version, or a
+// length out of range.
+static inline bool wire_decode_nack(const uint8_t *wire, size_t length, NackMessage *nack) {
+    if (length < NACK_HEADER_SIZE || length > NACK_MESSAGE_SIZE) {
+        return false;
+    }
+    size_t bitmap_bytes = length - NACK_HEADER_SIZE;
+    nack->msg_type = wire[0];
+    nack->frame_id = wire_get_u32(wire + 4);
+    nack->base_chunk = wire_get_u32(wire + 8);
+    memcpy(nack->bitmap, wire + NACK_HEADER_SIZE, bitmap_bytes);
+    memset(nack->bitmap + bitmap_bytes, 0, sizeof(nack->bitmap) - bitmap_bytes);
+    return (wire[0] == MSG_TYPE_NACK) & (wire[1] == WIRE_VERSION);
+}
+
+static inline void wire_encode_clock_sync(uint8_t *wire, const ClockSyncMessage *sync) {
+    wire[0] = MSG_TYPE_CLOCK_SYNC;
+    wire[1] = WIRE_VERSION;
+    memset(wire + 2, 0, 6);
+    wire_put_u64(wire + 8, sync->client_send_ns);
+    wire_put_u64(wire + 16, sync->server_recv_ns);
+    wire_put_u64(wire + 24, sync->server_send_ns);
+}
+
+// Unpack a clock sync message of CLOCK_SYNC_SIZE bytes. Returns false for
+// another message type or wire version.
+static inline bool wire_decode_clock_sync(const uint8_t *wire, ClockSyncMessage *sync) {
+    sync->msg_type = wire[0];
+    sync->client_send_ns = wire_get_u64(wire + 8);
+    sync->server_recv_ns = wire_get_u64(wire + 16);
+    sync->server_send_ns = wire_get_u64(wire + 24);
+    return (wire[0] == MSG_TYPE_CLOCK_SYNC) & (wire[1] == WIRE_VERSION);
+}
+
+static inline void wire_encode_keyframe_request(uint8_t *wire, const KeyframeRequest *request) {
+    wire[0] = MSG_TYPE_KEYFRAME_REQUEST;
+    wire[1] = WIRE_VERSION;
+    wire_put_u16(wire + 2, 0);
+    wire_put_u32(wire + 4, request->last_frame_id);
+}
+
+// Unpack a keyframe request of KEYFRAME_REQUEST_SIZE bytes. Returns false
+// for another message type or wire version.
+static inline bool wire_decode_keyframe_request(const uint8_t *wire, KeyframeRequest *request) {
+    request->msg_type = wire[0];
+    request->last_frame_id = wire_get_u32(wire + 4);
+    return (wire[0] == MSG_TYPE_KEYFRAME_REQUEST) & (wire[1] == WIRE_VERSION);
+}
+
+static inline void wire_encode_receiver_report(uint8_t *wire, const ReceiverReport *report) {
+    wire[0] = MSG_TYPE_RECEIVER_REPORT;
+    wire[1] = WIRE_VERSION;
+    wire[2] = report->fraction_lost;
+    wire[3] = 0;
+    wire_put_u16(wire + 4, report->probe_size);
+    wire_put_u16(wire + 6, 0);
+    wire_put_u32(wire + 8, report->last_frame_id);
+    wire_put_u32(wire + 12, report->interval_us);
+    wire_put_u32(wire + 16, report->frames_completed);
+    wire_put_u32(wire + 20, report->frames_skipped);
+    wire_put_u32(wire + 24, report->receive_rate_kbps);
+    wire_put_u32(wire + 28, report->jitter_us);
+    wire_put_u32(wire + 32, report->queue_delay_us);
+}
+
+// Unpack a receiver report of RECEIVER_REPORT_SIZE bytes. Returns false
+// for another message type or wire version.
+static inline bool wire_decode_receiver_report(const uint8_t *wire, ReceiverReport *report) {
+    report->msg_type = wire[0];
+    report->fraction_lost = wire[2];
+    report->probe_size = wire_get_u16(wire + 4);
+    report->last_frame_id = wire_get_u32(wire + 8);
+    report->interval_us = wire_get_u32(wire + 12);
+    report->frames_completed = wire_get_u32(wire + 16);
+    report->frames_skipped = wire_get_u32(wire + 20);
+    report->receive_rate_kbps = wire_get_u32(wire + 24);
+    report->jitter_us = wire_get_u32(wire + 28);
+    report->queue_delay_us = wire_get_u32(wire + 32);
+    return (wire[0] == MSG_TYPE_RECEIVER_REPORT) & (wire[1] == WIRE_VERSION);
+}
+
+static inline void wire_encode_tile_delta_header(uint8_t *wire, const TileDeltaHeader *header) {
+    wire[0] = WIRE_VERSION;
+    wire[1] = 0;
+    wire_put_u16(wire + 2, header->tile_size);
+    wire_put_u32(wire + 4, header->tiles_changed);
+}
+
+// Read a tile delta header of TILE_DELTA_HEADER_SIZE bytes. Returns false
+// for another wire version.
+static inline bool wire_decode_tile_delta_header(const uint8_t *wire, TileDeltaHeader *header) {
+    header->tile_size = wire_get_u16(wire + 2);
+    header->tiles_changed = wire_get_u32(wire + 4);
+    return wire[0] == WIRE_VERSION;
+}
+
+#endif /* WIRE_H */
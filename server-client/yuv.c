@@ -0,0 +1,233 @@
+#include <string.h>
+
+#include "yuv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUV_X86 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define YUV_NEON 1
+#endif
+
+// BT.601 limited range in 6-bit fixed point, chosen so 16-bit SIMD lanes
+// cannot overflow (blue may saturate, which clamps to 255 all the same):
+//   R = 1.164 (Y - 16) + 1.596 (V - 128)
+//   G = 1.164 (Y - 16) - 0.391 (U - 128) - 0.813 (V - 128)
+//   B = 1.164 (Y - 16) + 2.018 (U - 128)
+// The luma term is ((Y - 16) << 8) * Y_GAIN >> 16, an unsigned multiply-high.
+#define Y_GAIN 19071                  // 1.164 * 64 * 256
+#define V_TO_R 102                    // 1.596 * 64
+#define U_TO_G 25                     // 0.391 * 64
+#define V_TO_G 52                     // 0.813 * 64
+#define U_TO_B 129                    // 2.018 * 64
+#define ROUND 32                      // Half of the final >> 6
+
+static inline uint8_t clamp_channel(int value) {
+    value >>= 6;
+    return value < 0 ? 0 : value > 255 ? 255 : (uint8_t)value;
+}
+
+// Portable tail/fallback kernel: one row, chroma shared by pixel pairs
+static void row_scalar(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                       uint8_t *rgb, uint32_t width) {
+    for (uint32_t x = 0; x < width; x++) {
+        int luma = y[x] > 16 ? y[x] - 16 : 0;
+        int yt = ((luma * Y_GAIN) >> 8) + ROUND;
+        int cu = u[x / 2] - 128;
+        int cv = v[x / 2] - 128;
+        rgb[3 * x] = clamp_channel(yt + V_TO_R * cv);
+        rgb[3 * x + 1] = clamp_channel(yt - (U_TO_G * cu + V_TO_G * cv));
+        rgb[3 * x + 2] = clamp_channel(yt + U_TO_B * cu);
+    }
+}
+
+#ifdef YUV_X86
+// 8 pixels per step. RGB24 is stored as 6-byte halves of 64-bit lanes,
+// each store spilling 2 bytes the next one overwrites.
+static void row_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                     uint8_t *rgb, uint32_t width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i luma_offset = _mm_set1_epi8(16);
+    const __m128i chroma_offset = _mm_set1_epi16(128);
+    const __m128i gain = _mm_set1_epi16((short)Y_GAIN);
+    const __m128i round = _mm_set1_epi16(ROUND);
+    const __m128i low_pixel = _mm_set1_epi64x(0x0000000000ffffffll);
+    const __m128i high_pixel = _mm_set1_epi64x(0x0000ffffff000000ll);
+
+    uint32_t x = 0;
+    // The last store spills past the block, so keep at least one pixel for the tail
+    for (; x + 8 < width; x += 8) {
+        // (Y - 16) << 8 by unpacking into the high byte
+        __m128i y8 = _mm_subs_epu8(_mm_loadl_epi64((const __m128i *)(y + x)), luma_offset);
+        __m128i yt = _mm_add_epi16(_mm_mulhi_epu16(_mm_unpacklo_epi8(zero, y8), gain), round);
+
+        // Four chroma samples, each doubled for its pixel pair
+        uint32_t u4, v4;
+        memcpy(&u4, u + x / 2, 4);
+        memcpy(&v4, v + x / 2, 4);
+        __m128i cu = _mm_cvtsi32_si128((int)u4);
+        __m128i cv = _mm_cvtsi32_si128((int)v4);
+        cu = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(cu, cu), zero), chroma_offset);
+        cv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(cv, cv), zero), chroma_offset);
+
+        __m128i r = _mm_adds_epi16(yt, _mm_mullo_epi16(cv, _mm_set1_epi16(V_TO_R)));
+        __m128i g = _mm_subs_epi16(yt, _mm_add_epi16(_mm_mullo_epi16(cu, _mm_set1_epi16(U_TO_G)),
+                                                     _mm_mullo_epi16(cv, _mm_set1_epi16(V_TO_G))));
+        __m128i b = _mm_adds_epi16(yt, _mm_mullo_epi16(cu, _mm_set1_epi16(U_TO_B)));
+        r = _mm_packus_epi16(_mm_srai_epi16(r, 6), zero);
+        g = _mm_packus_epi16(_mm_srai_epi16(g, 6), zero);
+        b = _mm_packus_epi16(_mm_srai_epi16(b, 6), zero);
+
+        // RGB0 words, then squeeze each pair of pixels into 6 bytes
+        __m128i rg = _mm_unpacklo_epi8(r, g);
+        __m128i b0 = _mm_unpacklo_epi8(b, zero);
+        __m128i lo = _mm_unpacklo_epi16(rg, b0);
+        __m128i hi = _mm_unpackhi_epi16(rg, b0);
+        lo = _mm_or_si128(_mm_and_si128(lo, low_pixel), _mm_and_si128(_mm_srli_epi64(lo, 8), high_pixel));
+        hi = _mm_or_si128(_mm_and_si128(hi, low_pixel), _mm_and_si128(_mm_srli_epi64(hi, 8), high_pixel));
+
+        uint8_t *out = rgb + 3 * (size_t)x;
+        _mm_storel_epi64((__m128i *)out, lo);
+        _mm_storel_epi64((__m128i *)(out + 6), _mm_srli_si128(lo, 8));
+        _mm_storel_epi64((__m128i *)(out + 12), hi);
+        _mm_storel_epi64((__m128i *)(out + 18), _mm_srli_si128(hi, 8));
+    }
+    row_scalar(y + x, u + x / 2, v + x / 2, rgb + 3 * (size_t)x, width - x);
+}
+
+// 16 pixels per step; each 128-bit lane packs its RGB0 words with a byte
+// shuffle and is stored whole, spilling 4 bytes
+__attribute__((target("avx2")))
+static void row_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                     uint8_t *rgb, uint32_t width) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max_channel = _mm256_set1_epi16(255);
+    const __m256i chroma_offset = _mm256_set1_epi16(128);
+    const __m256i gain = _mm256_set1_epi16((short)Y_GAIN);
+    const __m256i round = _mm256_set1_epi16(ROUND);
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    uint32_t x = 0;
+    for (; x + 18 <= width; x += 16) {
+        __m128i y8 = _mm_subs_epu8(_mm_loadu_si128((const __m128i *)(y + x)), _mm_set1_epi8(16));
+        __m256i yt = _mm256_slli_epi16(_mm256_cvtepu8_epi16(y8), 8);
+        yt = _mm256_add_epi16(_mm256_mulhi_epu16(yt, gain), round);
+
+        __m128i u8 = _mm_loadl_epi64((const __m128i *)(u + x / 2));
+        __m128i v8 = _mm_loadl_epi64((const __m128i *)(v + x / 2));
+        __m256i cu = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u8, u8)), chroma_offset);
+        __m256i cv = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v8, v8)), chroma_offset);
+
+        __m256i r = _mm256_adds_epi16(yt, _mm256_mullo_epi16(cv, _mm256_set1_epi16(V_TO_R)));
+        __m256i g = _mm256_subs_epi16(yt, _mm256_add_epi16(_mm256_mullo_epi16(cu, _mm256_set1_epi16(U_TO_G)),
+                                                           _mm256_mullo_epi16(cv, _mm256_set1_epi16(V_TO_G))));
+        __m256i b = _mm256_adds_epi16(yt, _mm256_mullo_epi16(cu, _mm256_set1_epi16(U_TO_B)));
+        r = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(r, 6), zero), max_channel);
+        g = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(g, 6), zero), max_channel);
+        b = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(b, 6), zero), max_channel);
+
+        // Lane order: lo holds pixels 0-3 and 8-11, hi holds 4-7 and 12-15
+        __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+        __m256i lo = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(rg, b), pack);
+        __m256i hi = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(rg, b), pack);
+
+        uint8_t *out = rgb + 3 * (size_t)x;
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(lo));
+        _mm_storeu_si128((__m128i *)(out + 12), _mm256_castsi256_si128(hi));
+        _mm_storeu_si128((__m128i *)(out + 24), _mm256_extracti128_si256(lo, 1));
+        _mm_storeu_si128((__m128i *)(out + 36), _mm256_extracti128_si256(hi, 1));
+    }
+    row_sse2(y + x, u + x / 2, v + x / 2, rgb + 3 * (size_t)x, width - x);
+}
+#endif
+
+#ifdef YUV_NEON
+// ((Y - 16) << 8) * Y_GAIN >> 16 for 8 pixels
+static inline int16x8_t luma_neon(uint8x8_t y) {
+    uint16x8_t shifted = vshll_n_u8(y, 8);
+    uint16x4_t gain = vdup_n_u16(Y_GAIN);
+    uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(shifted), gain), 16);
+    uint16x4_t hi = vshrn_n_u32(vmull_u16(vget_high_u16(shifted), gain), 16);
+    return vaddq_s16(vreinterpretq_s16_u16(vcombine_u16(lo, hi)), vdupq_n_s16(ROUND));
+}
+
+// 16 pixels per step, interleaved by vst3q_u8
+static void row_neon(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                     uint8_t *rgb, uint32_t width) {
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t y8 = vqsubq_u8(vld1q_u8(y + x), vdupq_n_u8(16));
+        int16x8_t yt[2] = {luma_neon(vget_low_u8(y8)), luma_neon(vget_high_u8(y8))};
+
+        // Eight chroma samples, each doubled for its pixel pair
+        uint8x8x2_t u8 = vzip_u8(vld1_u8(u + x / 2), vld1_u8(u + x / 2));
+        uint8x8x2_t v8 = vzip_u8(vld1_u8(v + x / 2), vld1_u8(v + x / 2));
+
+        uint8x8_t r[2], g[2], b[2];
+        for (int half = 0; half < 2; half++) {
+            int16x8_t cu = vreinterpretq_s16_u16(vsubl_u8(u8.val[half], vdup_n_u8(128)));
+            int16x8_t cv = vreinterpretq_s16_u16(vsubl_u8(v8.val[half], vdup_n_u8(128)));
+            int16x8_t cg = vaddq_s16(vmulq_n_s16(cu, U_TO_G), vmulq_n_s16(cv, V_TO_G));
+            r[half] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(yt[half], vmulq_n_s16(cv, V_TO_R)), 6));
+            g[half] = vqmovun_s16(vshrq_n_s16(vqsubq_s16(yt[half], cg), 6));
+            b[half] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(yt[half], vmulq_n_s16(cu, U_TO_B)), 6));
+        }
+
+        uint8x16x3_t out;
+        out.val[0] = vcombine_u8(r[0], r[1]);
+        out.val[1] = vcombine_u8(g[0], g[1]);
+        out.val[2] = vcombine_u8(b[0], b[1]);
+        vst3q_u8(rgb + 3 * (size_t)x, out);
+    }
+    row_scalar(y + x, u + x / 2, v + x / 2, rgb + 3 * (size_t)x, width - x);
+}
+#endif
+
+typedef void (*RowKernel)(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                          uint8_t *rgb, uint32_t width);
+
+static RowKernel row_kernel = NULL;
+static const char *row_kernel_name = "scalar";
+
+// Pick the widest conversion kernel this CPU supports
+static void select_row_kernel(void) {
+    row_kernel = row_scalar;
+#if defined(YUV_X86)
+    row_kernel = row_sse2;
+    row_kernel_name = "sse2";
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        row_kernel = row_avx2;
+        row_kernel_name = "avx2";
+    }
+#elif defined(YUV_NEON)
+    row_kernel = row_neon;
+    row_kernel_name = "neon";
+#endif
+}
+
+// Convert a packed I420 frame to RGB24; chroma is replicated over each 2x2 block
+void yuv420_to_rgb24(const uint8_t *yuv, uint32_t width, uint32_t height, uint8_t *rgb) {
+    if (!row_kernel) {
+        select_row_kernel();
+    }
+
+    size_t chroma_width = (width + 1) / 2;
+    const uint8_t *u_plane = yuv + (size_t)width * height;
+    const uint8_t *v_plane = u_plane + chroma_width * ((height + 1) / 2);
+    for (uint32_t row = 0; row < height; row++) {
+        size_t chroma_row = (size_t)(row / 2) * chroma_width;
+        row_kernel(yuv + (size_t)row * width, u_plane + chroma_row, v_plane + chroma_row,
+                   rgb + (size_t)row * width * 3, width);
+    }
+}
+
+// Name of the conversion kernel selected for this CPU
+const char *yuv_convert_backend(void) {
+    if (!row_kernel) {
+        select_row_kernel();
+    }
+    return row_kernel_name;
+}
@@ -0,0 +1,25 @@
+#ifndef YUV_H
+#define YUV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// YUV 4:2:0 frames on the wire (VIDEO_CODEC_RAW_YUV420): planar I420 as
+// swscale writes AV_PIX_FMT_YUV420P, packed without row padding. The Y
+// plane comes first, then U and V at half width and height (rounded up).
+// Limited range BT.601, the swscale default for this format.
+
+// Bytes in one packed I420 frame
+static inline size_t yuv420_frame_size(uint32_t width, uint32_t height) {
+    size_t chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    return (size_t)width * height + 2 * chroma;
+}
+
+// Convert a packed I420 frame to RGB24 (width * 3 bytes per row, SIMD
+// where available). Every backend produces identical output.
+void yuv420_to_rgb24(const uint8_t *yuv, uint32_t width, uint32_t height, uint8_t *rgb);
+
+// Name of the conversion kernel selected for this CPU
+const char *yuv_convert_backend(void);
+
+#endif /* YUV_H */